@@ -6,7 +6,7 @@ help: common-help
 COMPILER_         = clang
 COMPILER_FLAGS_   = $(CFLAGS) -fompss-2 -fompss-fpga-wrapper-code
 COMPILER_FLAGS_D_ = $(COMPILER_FLAGS_) -g -fompss-fpga-hls-tasks-dir $(PWD)
-LINKER_FLAGS_     = $(LDFLAGS)
+LINKER_FLAGS_     = $(LDFLAGS) -lm
 
 AIT_FLAGS__        = --name=$(PROGRAM_) --board=$(BOARD) -c=$(FPGA_CLOCK)
 AIT_FLAGS_DESIGN__ = --to_step=design
@@ -43,5 +43,5 @@ AIT_FLAGS_DESIGN_ = -fompss-fpga-ait-flags "$(AIT_FLAGS_DESIGN__)"
 AIT_FLAGS_D_      = -fompss-fpga-ait-flags "$(AIT_FLAGS_D__)"
 
 clean:
-	rm -fv *.o $(PROGRAM_)-? $(PROGRAM_)_hls_automatic_clang.cpp ait_extracted.json
+	rm -fv *.o $(PROGRAM_)-? $(PROGRAM_)-emu lib$(PROGRAM_).a lib$(PROGRAM_).so $(PROGRAM_)_hls_automatic_clang.cpp ait_extracted.json
 	rm -frv $(PROGRAM_)_ait
@@ -7,7 +7,7 @@ COMPILER_         = $(CROSS_COMPILE)fpgacc
 COMPILER_FLAGS_   = $(CFLAGS) -O3 $(MCC_FLAGS) --ompss-2 --fpga
 COMPILER_FLAGS_I_ = $(COMPILER_FLAGS_) --instrument
 COMPILER_FLAGS_D_ = $(COMPILER_FLAGS_) --debug -g -k
-LINKER_FLAGS_     = $(LDFLAGS)
+LINKER_FLAGS_     = $(LDFLAGS) -lm
 
 AIT_FLAGS_        = --bitstream-generation --Wf,--name=$(PROGRAM_),--board=$(BOARD),-c=$(FPGA_CLOCK)
 AIT_FLAGS_DESIGN_ = --Wf,--to_step=design
@@ -40,5 +40,5 @@ ifdef PLACEMENT_FILE
 endif
 
 clean:
-	rm -fv *.o $(PROGRAM_)-? $(COMPILER_)_$(PROGRAM_)*.c *hls_auto_mcxx.cpp ait_$(PROGRAM_)*.json
+	rm -fv *.o $(PROGRAM_)-? $(PROGRAM_)-emu lib$(PROGRAM_).a lib$(PROGRAM_).so $(COMPILER_)_$(PROGRAM_)*.c *hls_auto_mcxx.cpp ait_$(PROGRAM_)*.json
 	rm -frv $(PROGRAM_)_ait
@@ -0,0 +1,52 @@
+#!/bin/bash -el
+
+# Regression test of the result checks: the reference-free check (-c 4) must
+# pass the correct products and fail the products with one lost block task,
+# also with two Strassen-Winograd levels (-S), where the lost block corrupts a
+# quadrant product.
+# MATMUL_FAULT is a binary built with the CHECK_FAULT preprocessor variable,
+# which undoes the product of the first blocks of A and B in the first block of
+# C after each run, or of the first quadrant product (P1) with -S:
+#   make matmul-emu CFLAGS=-DCHECK_FAULT && mv matmul-emu matmul-emu-fault
+# The products run once (-w 0 -r 1 -t 0), the tolerance grows with the number
+# of products accumulated in C
+
+MATMUL=${MATMUL:-./matmul-emu}
+MATMUL_FAULT=${MATMUL_FAULT:-./matmul-emu-fault}
+SIZES=${SIZES:-"1024 2048 4096"}
+
+FAILED=0
+
+# Runs <binary> with the given options, expecting the exit status <status>
+# and an output line containing <message>
+expect() {
+  local binary=$1
+  local status=$2
+  local message=$3
+  shift 3
+  local rc=0
+  local out
+  out=$(timeout --preserve-status 3600s $binary -w 0 -r 1 -t 0 "$@" 2>&1) || rc=$?
+  if [ $rc -eq $status ] && grep -qF -- "$message" <<< "$out"; then
+    echo "ok:     $binary $*"
+  else
+    echo "FAILED: $binary $* (exit status $rc, expected $status with \"$message\")"
+    echo "$out" | grep -E "Tolerance|residual" | head -5
+    FAILED=$((FAILED + 1))
+  fi
+}
+
+for s in $SIZES; do
+  echo "=== Freivalds check, size ${s} ==="
+  for f in 0 1; do
+    expect $MATMUL 0 "Output matrix is OK!" -s $s -f $f -c 4
+    expect $MATMUL_FAULT 1 "Output matrix is WRONG!" -s $s -f $f -c 4
+  done
+  expect $MATMUL_FAULT 1 "Output matrix is WRONG!" -s $s -f 1 -c 4 -G counter
+  echo "=== Freivalds check, size ${s}, Strassen cutoff $((s/4)) ==="
+  expect $MATMUL 0 "Output matrix is OK!" -s $s -f 1 -c 4 -S $((s/4))
+  expect $MATMUL_FAULT 1 "Output matrix is WRONG!" -s $s -f 1 -c 4 -S $((s/4))
+done
+
+echo "=== ${FAILED} failed ==="
+[ $FAILED -eq 0 ]
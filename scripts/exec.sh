@@ -1,21 +1,18 @@
 #!/bin/bash -el
 
-MATRIX_SIZES=(2048 4096)
-RES_FILE=$(pwd -P)/test_results.json
+RES_FILE=$(pwd -P)/test_results.jsonl
 
 # Missing reference solution for 3072@256, so using 2048
 #if [ "$BOARD" == "alveo_u200" ]; then
-#  MATRIX_SIZES=(3072 6144)
+#  CHECKED_SIZES=3072
+#  UNCHECKED_SIZES=6144
 #fi
+CHECKED_SIZES=${CHECKED_SIZES:-2048}
+UNCHECKED_SIZES=${UNCHECKED_SIZES:-4096}
 
+# Each sweep runs all the create from modes and sizes in one process, appending a line per configuration
 for EXEC_MODE in d p; do
-  for CREATE_FROM in 0 1; do
-    for MATRIX_SIZE in ${MATRIX_SIZES[@]}; do
-      echo "=== Check mode: ${EXEC_MODE}, from: ${CREATE_FROM}, msize: ${MATRIX_SIZE} ==="
-      CHECK=$((([ "$MATRIX_SIZE" == "2048" ] || [ "$MATRIX_SIZE" == "3072" ]) && echo 1) || echo 0)
-      NX_ARGS="--summary --fpga-alloc-pool-size=1G --smp-workers=6" timeout --preserve-status 250s ./build/matmul-${EXEC_MODE} ${MATRIX_SIZE} ${CHECK} ${CREATE_FROM}
-      cat test_result.json >>$RES_FILE
-      echo "," >>$RES_FILE
-    done
-  done
+  echo "=== Check mode: ${EXEC_MODE}, from: 0,1, msize: ${CHECKED_SIZES} ${UNCHECKED_SIZES} ==="
+  NX_ARGS="--summary --fpga-alloc-pool-size=1G --smp-workers=6" timeout --preserve-status 500s ./build/matmul-${EXEC_MODE} -s ${CHECKED_SIZES} -c 1 -f 0,1 -j $RES_FILE
+  NX_ARGS="--summary --fpga-alloc-pool-size=1G --smp-workers=6" timeout --preserve-status 500s ./build/matmul-${EXEC_MODE} -s ${UNCHECKED_SIZES} -c 0 -f 0,1 -j $RES_FILE
 done
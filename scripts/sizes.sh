@@ -0,0 +1,107 @@
+#!/bin/bash -el
+
+# Regression test of the matrix size limits: the sizes that do not fit the
+# 32-bit dimensions or block indices must be rejected by the option parsing,
+# the block offsets must be right beyond 2^32 elements, and the products with
+# more than 2^32 elements in a matrix must pass the check.
+# The block offsets are checked by a small program built with CC on the
+# sources of SRC_DIR. The large C product runs out of core in a temporary
+# directory of SIZES_DIR, with about 17 GiB of sparse files for the default
+# block size, and in memory, as does the product with a large A, if the
+# available memory is enough for the matrices of ELEM_BYTES and ACC_BYTES
+# bytes per element (the types of the binary)
+
+MATMUL=${MATMUL:-./matmul-emu}
+BSIZE=${MATMUL_BLOCK_SIZE:-64}
+SIZES_DIR=${SIZES_DIR:-/tmp}
+WINDOW=${WINDOW:-1024}
+SRC_DIR=${SRC_DIR:-$(dirname $0)/../src}
+CC=${CC:-gcc}
+ELEM_BYTES=${ELEM_BYTES:-4}
+ACC_BYTES=${ACC_BYTES:-4}
+
+FAILED=0
+
+# Runs the binary with the given options, expecting the exit status <status>
+# and an output line containing <message>
+expect() {
+  local status=$1
+  local message=$2
+  shift 2
+  local rc=0
+  local out
+  out=$(timeout --preserve-status 3600s $MATMUL "$@" 2>&1) || rc=$?
+  if [ $rc -eq $status ] && grep -qF -- "$message" <<< "$out"; then
+    echo "ok:     $*"
+  else
+    echo "FAILED: $* (exit status $rc, expected $status with \"$message\")"
+    echo "$out" | head -5
+    FAILED=$((FAILED + 1))
+  fi
+}
+
+# Smallest dimension whose block count times itself does not fit in 32 bits
+OVER=$(( (65536 + 1)*BSIZE ))
+
+echo "=== Invalid sizes, block size ${BSIZE} ==="
+expect 1 "Invalid value in option -s" -s 4294967295 -c 0
+expect 1 "Invalid value in option -s" -s 4294967296 -c 0
+expect 1 "Invalid value in option -s" -s -${BSIZE} -c 0
+expect 1 "Invalid value in option -s" -s 1x2x3junk -c 0
+expect 1 "Invalid value in option -s" -s ${OVER}x${BSIZE}x${OVER} -c 0
+expect 1 "Invalid value in option -s" -s ${BSIZE}x${OVER}x${OVER} -c 0
+expect 1 "Invalid value in option -s" -s ${OVER}x${OVER}x${BSIZE} -c 0
+
+# Matrices of (65536 + BSIZE)^2 elements, just past 2^32
+LARGE=$(( 65536 + BSIZE ))
+TMP_DIR=$(mktemp -d ${SIZES_DIR}/matmul-sizes.XXXXXX)
+trap "rm -rf $TMP_DIR" EXIT
+
+# The offset of each block of a blocked matrix must be the number of elements
+# of the blocks before it, in row-major order of the blocks
+echo "=== Block offsets of ${LARGE}x${LARGE} ==="
+cat > $TMP_DIR/offsets.c << EOF
+#include "matmul.c"
+int main() {
+   const unsigned int n = ${LARGE};
+   size_t off = 0;
+   for (unsigned int i = 0; i < numBlocks(n); ++i) {
+      for (unsigned int j = 0; j < numBlocks(n); ++j) {
+         if (blockOffset(n, n, i, j) != off) {
+            printf("Block (%u,%u) at %zu instead of %zu\n", i, j, blockOffset(n, n, i, j), off);
+            return 1;
+         }
+         off += (size_t)blockDim(n, i)*blockDim(n, j);
+      }
+   }
+   printf("Block offsets are OK, %zu elements\n", off);
+   return off == (size_t)n*n && off > 4294967296ULL ? 0 : 1;
+}
+EOF
+$CC -std=gnu99 -O2 -w -DMATMUL_LIB -DMATMUL_BLOCK_SIZE=$BSIZE -DMATMUL_BLOCK_II=1 -DMATMUL_NUM_ACCS=1 \
+  -DFPGA_MEMORY_PORT_WIDTH=128 -I$SRC_DIR $TMP_DIR/offsets.c -o $TMP_DIR/offsets -lm
+MATMUL=$TMP_DIR/offsets expect 0 "Block offsets are OK"
+
+echo "=== ${LARGE}x${LARGE}x${BSIZE} out of core in ${TMP_DIR} ==="
+expect 0 "Output matrix is OK!" -s ${LARGE}x${LARGE}x${BSIZE} -O $TMP_DIR -W $WINDOW -w 0 -c 4
+
+# Runs the product <size> in memory if its <bytes> fit in the available memory
+in_memory() {
+  local size=$1
+  local bytes=$2
+  local avail=$(( $(awk '/^MemAvailable:/ { print $2 }' /proc/meminfo)*1024 ))
+  echo "=== ${size} in memory ==="
+  if [ $bytes -gt $avail ]; then
+    echo "skipped: needs $(( bytes >> 20 )) MiB, $(( avail >> 20 )) MiB available"
+  else
+    expect 0 "Output matrix is OK!" -s $size -w 0 -c 4
+  fi
+}
+
+# The large matrix is C, and then A, whose block rows go beyond 2^32 elements
+SMALL=$(( LARGE*BSIZE ))
+in_memory ${LARGE}x${LARGE}x${BSIZE} $(( LARGE*LARGE*ACC_BYTES + 2*SMALL*ELEM_BYTES ))
+in_memory ${LARGE}x${BSIZE}x${LARGE} $(( LARGE*LARGE*ELEM_BYTES + SMALL*(ELEM_BYTES + ACC_BYTES) ))
+
+echo "=== ${FAILED} failed ==="
+[ $FAILED -eq 0 ]
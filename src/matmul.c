@@ -30,108 +30,712 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <getopt.h>
 
 // General definitions
 #include "matmul.h"
 #include "matmul.fpga.h"
+#include "matmul_gemm.h"
+#include "matmul_smp.h"
+#include "matmul_order.h"
+#include "matmul_affinity.h"
+#include "matmul_ref.h"
+#include "matmul_trace.h"
+#include "matmul_mem.h"
+#include "matmul_layout.h"
+#include "matmul_dist.h"
+#include "matmul_ooc.h"
 
 const unsigned int BSIZE = MATMUL_BLOCK_SIZE;
 const unsigned int MBLOCK_II = MATMUL_BLOCK_II;
 const unsigned int MBLOCK_FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
 const unsigned int MBLOCK_NUM_ACCS = MATMUL_NUM_ACCS;
 
+#if defined(MATMUL_EMU)
+#  include "matmul_emu.h"
+#endif
+
+// Maximum number of values of each option in a sweep
+#define SWEEP_MAX_VALUES 64
+
+// Random vectors used by the reference-free check, and the scale of its tolerance.
+// The measured residuals of the correct products stay below 0.6 of the tolerance
+#ifndef FREIVALDS_TRIALS
+#  define FREIVALDS_TRIALS 2
+#endif
+#ifndef FREIVALDS_TOLERANCE
+#  define FREIVALDS_TOLERANCE 1.0
+#endif
+
+#if !defined(MATMUL_LIB)
 void usage (char* argv0) {
-   fprintf(stderr, "USAGE:\t%s <matrix size> <check> <create from>\n", argv0);
+   fprintf(stderr, "USAGE:\t%s -s <matrix size> [-c <check>] [-f <create from>] [-o <order>] [-w <warm up>] [-r <reps>] [-t <min time>] [-L <layout>] [-H <pages>] [-N <policy>] [-S <cutoff>] [-g <grain>] [-b <count>] [-P <grid>] [-O <dir>] [-W <window>] [-G <generator>] [-I <dir>] [-a <affinity>] [-j <file>]\n", argv0);
+   fprintf(stderr, "      \t-s, --size <matrix size> is either <n> for square matrices or <m>x<n>x<k>\n");
+   fprintf(stderr, "      \t  for C[m x n] = A[m x k] * B[k x n]\n");
    fprintf(stderr, "      \t<block size> is fixed to %u\n", BSIZE);
-   fprintf(stderr, "      \t<check> values:\n");
+   fprintf(stderr, "      \t-c, --check <check> values (default: 0):\n");
    fprintf(stderr, "      \t  - 0 to disable checking\n");
    fprintf(stderr, "      \t  - 1 to enable checking\n");
    fprintf(stderr, "      \t  - 2 to generate checking reference\n");
-   fprintf(stderr, "      \t<create from> values:\n");
+   fprintf(stderr, "      \t  - 3 to check only the reference checksums, comparing the data of mismatching blocks\n");
+   fprintf(stderr, "      \t  - 4 to check without reference using %u random vectors (Freivalds)\n", FREIVALDS_TRIALS);
+   fprintf(stderr, "      \t-f, --create-from <create from> values (default: 0):\n");
    fprintf(stderr, "      \t  - 0 to create block tasks in FPGA\n");
    fprintf(stderr, "      \t  - 1 to create block tasks in SMP\n");
+   fprintf(stderr, "      \t  - 2 to split C block rows between FPGA and SMP by their measured throughput\n");
+   fprintf(stderr, "      \t-o, --order <order> values (traversal of C blocks when creating tasks):\n");
+   fprintf(stderr, "      \t  - default (0): i-k-j from SMP, groups of %u row-major blocks from FPGA\n", MBLOCK_NUM_ACCS);
+   fprintf(stderr, "      \t  - ijk (1): row-major\n");
+   fprintf(stderr, "      \t  - kij (2): k outer\n");
+   fprintf(stderr, "      \t  - morton (3): Z-order curve\n");
+   fprintf(stderr, "      \t  - hilbert (4): Hilbert curve\n");
+   fprintf(stderr, "      \t  - groups (5): groups of %u row-major blocks, from SMP too\n", MBLOCK_NUM_ACCS);
+   fprintf(stderr, "      \t-w, --warmup <warm up> untimed executions before the timed ones (default: 1)\n");
+   fprintf(stderr, "      \t-r, --reps <reps> minimum number of timed executions (default: 1)\n");
+   fprintf(stderr, "      \t-t, --min-time <min time> minimum seconds of timed executions, more are run until reached (default: 0)\n");
+   fprintf(stderr, "      \tThe result accumulates all executions, C = (<warm up> + <reps>)*A*B\n");
+   fprintf(stderr, "      \t-L, --layout <layout> of the input and output matrices: blocked (default), or row (row-major) and\n");
+   fprintf(stderr, "      \t  col (column-major), multiplied in place through the ompss_gemm library call (create from 0 or 1,\n");
+   fprintf(stderr, "      \t  no -S, -g or -b)\n");
+   fprintf(stderr, "      \t-H, --huge <pages> backing the matrices: none, thp (default) or explicit (reserved, thp if not available)\n");
+   fprintf(stderr, "      \t-N, --numa <policy> placing the matrices: local (first touch, default), interleave or bind (block rows to nodes)\n");
+   fprintf(stderr, "      \t-S, --strassen <cutoff> splits the product with Strassen-Winograd levels while all the dimensions are\n");
+   fprintf(stderr, "      \t  larger than <cutoff> and split in full block quadrants (default: 0, disabled). Not with create from 2\n");
+   fprintf(stderr, "      \t-g, --grain <grain> C blocks per task (default: 0): 0 creates one task per block product, and a\n");
+   fprintf(stderr, "      \t  positive value one task per <grain> C blocks of a block row running their whole k loop\n");
+   fprintf(stderr, "      \t  (one per C block from the FPGA, which needs MATMUL_KCHAIN). Not with create from 2\n");
+   fprintf(stderr, "      \t-b, --batch <count> runs <count> independent products per launch, taking the <matrix size> values in turn\n");
+   fprintf(stderr, "      \t  (default: 0, one product per launch). Only checks 0 and 4, and create from 0 and 1 are supported\n");
+   fprintf(stderr, "      \t-P, --grid <p>x<q> distributes the product over a grid of processes, which must be all the MPI processes,\n");
+   fprintf(stderr, "      \t  with the SUMMA algorithm (default: the most square grid when there are several processes).\n");
+   fprintf(stderr, "      \t  Only create from 0 and 1, the default order, the blocked layout, and no -S, -g or -b\n");
+   fprintf(stderr, "      \t-O, --ooc <dir> keeps the matrices in files of <dir>, streaming them through a bounded window to compute\n");
+   fprintf(stderr, "      \t  products larger than the host memory. The A and B files are reused when they have the product size.\n");
+   fprintf(stderr, "      \t  Only create from 0 and 1, the default order, the blocked layout, a single process, and no -S, -g or -b\n");
+   fprintf(stderr, "      \t-W, --window <window> MiB of the matrices in memory out of core (default: 1024)\n");
+   fprintf(stderr, "      \t-G, --generator <generator> of the input matrices:\n");
+   fprintf(stderr, "      \t  - lcg (default): one sequence per block seeded in block order, depends on the block size\n");
+   fprintf(stderr, "      \t  - counter: hash of the position of each element, independent of the block size and the tasks\n");
+   fprintf(stderr, "      \t-I, --inputs <dir> maps A and B from the files matmul_<type>_<matrix size>_{A,B}.bin of <dir>,\n");
+   fprintf(stderr, "      \t  in the blocked layout, instead of generating them. Only the blocked layout, a single process,\n");
+   fprintf(stderr, "      \t  and no -b or -O\n");
+   fprintf(stderr, "      \t-a, --affinity <affinity> of the k-chain of each C block to one FPGA instance, so C can stay in it:\n");
+   fprintf(stderr, "      \t  - none: any instance, chosen by the runtime\n");
+   fprintf(stderr, "      \t  - rr (default): instances in round robin across the C blocks and the products\n");
+   fprintf(stderr, "      \t  - load: round robin from the instance with the fewest block products assigned\n");
+   fprintf(stderr, "      \t-j, --jsonl <file> appends the results of each configuration as a line of <file>\n");
+   fprintf(stderr, "      \t  (default: test_results.jsonl when sweeping, test_result.json otherwise)\n");
+   fprintf(stderr, "      \t<matrix size>, <create from>, <order>, <reps> and <grain> accept comma separated lists of up to %u values,\n", SWEEP_MAX_VALUES);
+   fprintf(stderr, "      \t  and all their combinations are run in the same process\n");
 }
+#endif // !defined(MATMUL_LIB)
 
 #pragma oss task in([m2size]data)
-void flushData(float *data, int m2size) {
+void flushData(acc_t *data, const size_t m2size) {
     //dummy task to pull data from fpga
 }
 
+// Rows (or columns) of block <i> along a dimension of <n> elements
+unsigned int blockDim(const unsigned int n, const unsigned int i) {
+   return n - i*BSIZE < BSIZE ? n - i*BSIZE : BSIZE;
+}
+
+// Number of blocks along a dimension of <n> elements, including the edge one
+unsigned int numBlocks(const unsigned int n) {
+   return (n + BSIZE - 1)/BSIZE;
+}
+
+// Offset of block (i,j) in a blocked <rows>x<cols> matrix. Each block is stored
+// contiguously in row-major order; edge blocks are not padded. Offsets are
+// 64-bit, as matrices may have more than 2^32 elements
+size_t blockOffset(const unsigned int rows, const unsigned int cols, const unsigned int i, const unsigned int j) {
+   return (size_t)i*BSIZE*cols + (size_t)j*BSIZE*blockDim(rows, i);
+}
+
 #pragma oss task
-void setBlock(elem_t* v, const elem_t val) {
-   for (unsigned int i = 0; i < BSIZE*BSIZE; ++i) {
+void setBlock(acc_t* v, const acc_t val, const unsigned int n) {
+   for (unsigned int i = 0; i < n; ++i) {
       v[i] = val;
    }
 }
 
 #pragma oss task
-void setBlockSeq(elem_t* v, int base) {
-   for (unsigned int i = 0; i < BSIZE*BSIZE; ++i) {
-      v[i] = ((elem_t)((base/1024)%2)) - 1.0 + ((elem_t)(base%512))/1000;
+void setBlockSeq(elem_t* v, int base, const unsigned int n) {
+   TRACE_START(TRACE_SET_BLOCK, v, NULL);
+   for (unsigned int i = 0; i < n; ++i) {
+#if defined(USE_INT8)
+      v[i] = ELEM_SET((base%255) - 127);
+#else
+      v[i] = ELEM_SET(((acc_t)((base/1024)%2)) - 1.0 + ((acc_t)(base%512))/1000);
+#endif
       base = (base*97 + 89)%65536;
    }
+   TRACE_END(TRACE_SET_BLOCK, v, NULL);
+}
+
+// Counter-based input generator. Element (r,c) of input matrix <mat> is the
+// SplitMix64 hash of its position in the Weyl sequence of the matrix key, so
+// the blocks are filled independently of each other, of the block size and
+// of the number of tasks or threads
+#define GEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+static inline uint64_t genMix(uint64_t x) {
+   x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27))*0x94D049BB133111EBULL;
+   return x ^ (x >> 31);
+}
+
+uint64_t genKey(const unsigned int mat) {
+   return genMix(2019 + (mat + 1)*GEN_GAMMA);
 }
 
+// Fills block (i,j) of a <rows>x<cols> matrix with the generator keyed by <key>.
+// The element loop carries no state, so it is vectorized
 #pragma oss task
-void checkBlock(unsigned int* check_ok, const elem_t* res, const elem_t* ref, const float threshold)
+void setBlockCounter(elem_t* v, const uint64_t key, const unsigned int rows, const unsigned int cols, const unsigned int i,
+   const unsigned int j)
 {
-   for (unsigned int i = 0; i < BSIZE*BSIZE && ( *check_ok ); ++i) {
-      const elem_t res_val = res[i];
-      const elem_t ref_val = ref[i];
-      const elem_t maxv = ref_val * (1.0 + (ref_val < 0 ? -threshold : threshold));
-      const elem_t minv = ref_val * (1.0 - (ref_val < 0 ? -threshold : threshold));
-      if (res_val > maxv || res_val < minv) {
-         *check_ok = 0;
-         fprintf(stderr, "ERROR:\t Expected a %lf but found %lf.\n", (double)ref_val, (double)res_val);
+   TRACE_START(TRACE_SET_BLOCK, v, NULL);
+   const unsigned int bm = blockDim(rows, i), bn = blockDim(cols, j);
+   for (unsigned int r = 0; r < bm; ++r) {
+      const uint64_t pos = ((uint64_t)i*BSIZE + r)*cols + (uint64_t)j*BSIZE;
+      elem_t *row = v + r*bn;
+      for (unsigned int c = 0; c < bn; ++c) {
+         const uint64_t x = genMix(key + (pos + c)*GEN_GAMMA);
+#if defined(USE_INT8)
+         row[c] = ELEM_SET((int)((x >> 32)%255) - 127);
+#else
+         row[c] = ELEM_SET((acc_t)(x >> 40)*(acc_t)(1.0/8388608) - 1);
+#endif
       }
    }
+   TRACE_END(TRACE_SET_BLOCK, v, NULL);
 }
 
-unsigned int matmulCheck(const unsigned int check, const elem_t* c, const unsigned int msize)
+// Creates the task filling block (i,j) of the <rows>x<cols> input matrix <mat>
+// (0 for A and 1 for B, 2*l more for the products of a batch) with generator
+// <gen>. <seed> is the block seed of the LCG one, drawn in block order
+void genBlock(elem_t* v, const unsigned int gen, const int seed, const unsigned int mat, const unsigned int rows,
+   const unsigned int cols, const unsigned int i, const unsigned int j)
 {
-   const unsigned int m2size = msize*msize;
-   const unsigned int b2size = BSIZE*BSIZE;
+   if (gen == REF_GEN_COUNTER) {
+      setBlockCounter(v, genKey(mat), rows, cols, i, j);
+   } else {
+      setBlockSeq(v, seed, blockDim(rows, i)*blockDim(cols, j));
+   }
+}
+
+// Number of independent accumulators (vector lanes) used by checkBlock
+#define CHECK_LANES 16
+#ifndef CHECK_MAX_COORDS
+#  define CHECK_MAX_COORDS 8
+#endif
+// Scale of the rounding error bound allowed by the reference checks
+#ifndef CHECK_ABS_TOLERANCE
+#  define CHECK_ABS_TOLERANCE 1.0
+#endif
+
+// Error statistics of a checked region
+typedef struct {
+   double maxAbsErr;
+   double maxRelErr;
+   unsigned long long maxUlp;
+   unsigned long long mismatches;
+   unsigned long long checksumBlocks;          // Blocks verified only by their checksum
+   unsigned int numCoords;                     // First mismatches found (row-major)
+   unsigned int coords[CHECK_MAX_COORDS][2];
+   double boundRatio;                          // Max. error over the error bound of the classic product
+} check_stats_t;
+
+// Maps the bits of a C element to an integer whose order matches the element order,
+// so the difference of two of them is their distance in ULPs. Integer elements
+// are their own distance
+static long long elemOrdered(const acc_t v) {
+#if defined(USE_INT8)
+   return v;
+#else
+   if (sizeof(acc_t) == sizeof(int)) {
+      int i;
+      memcpy(&i, &v, sizeof(i));
+      return i < 0 ? (long long)INT_MIN - i : i;
+   } else {
+      long long i;
+      memcpy(&i, &v, sizeof(i));
+      return i < 0 ? LLONG_MIN - i : i;
+   }
+#endif
+}
+
+void checkStatsInit(check_stats_t *stats) {
+   memset(stats, 0, sizeof(check_stats_t));
+}
+
+// Merges <src> into <dst>, keeping the first mismatches in row-major order
+void checkStatsMerge(check_stats_t *dst, const check_stats_t *src) {
+   dst->maxAbsErr = src->maxAbsErr > dst->maxAbsErr ? src->maxAbsErr : dst->maxAbsErr;
+   dst->maxRelErr = src->maxRelErr > dst->maxRelErr ? src->maxRelErr : dst->maxRelErr;
+   dst->maxUlp = src->maxUlp > dst->maxUlp ? src->maxUlp : dst->maxUlp;
+   dst->mismatches += src->mismatches;
+   dst->checksumBlocks += src->checksumBlocks;
+   for (unsigned int s = 0; s < src->numCoords; ++s) {
+      unsigned int pos = dst->numCoords;
+      while (pos > 0 && (dst->coords[pos - 1][0] > src->coords[s][0] ||
+         (dst->coords[pos - 1][0] == src->coords[s][0] && dst->coords[pos - 1][1] > src->coords[s][1]))) {
+         --pos;
+      }
+      if (pos >= CHECK_MAX_COORDS) continue;
+      const unsigned int last = dst->numCoords < CHECK_MAX_COORDS ? dst->numCoords : CHECK_MAX_COORDS - 1;
+      memmove(dst->coords[pos + 1], dst->coords[pos], (last - pos)*sizeof(dst->coords[0]));
+      dst->coords[pos][0] = src->coords[s][0];
+      dst->coords[pos][1] = src->coords[s][1];
+      dst->numCoords = last + 1;
+   }
+}
+
+// Whether an element differs from the reference by more than the relative
+// <threshold> plus the absolute <floor> bounding its rounding error
+static inline int checkWrong(const double absErr, const double absRef, const float threshold, const double floor) {
+   return !(absErr <= threshold*absRef + floor);
+}
+
+// Computes the error statistics of a <rows>x<cols> block whose first element is
+// at (<row0>,<col0>) of the matrix. An element (r,c) is a mismatch unless
+// |res - ref| <= threshold*|ref| + absTol*rowNorm[r]*colNorm[c], where the norms
+// bound (|A|*|B|)_rc (see checkNorms), so the elements close to zero do not fail
+// when the summation order changes. Accumulation is split in CHECK_LANES
+// independent lanes so the row loop is vectorized without reassociation
+void checkBlockStats(check_stats_t* stats, const acc_t* res, const acc_t* ref, const unsigned int rows, const unsigned int cols,
+   const unsigned int row0, const unsigned int col0, const float threshold, const double *rowNorm, const double *colNorm,
+   const double absTol)
+{
+   double maxAbs[CHECK_LANES], maxRel[CHECK_LANES];
+   long long maxUlp[CHECK_LANES], count[CHECK_LANES];
+   for (unsigned int l = 0; l < CHECK_LANES; ++l) {
+      maxAbs[l] = maxRel[l] = 0;
+      maxUlp[l] = count[l] = 0;
+   }
+   for (unsigned int r = 0; r < rows; ++r) {
+      const double rowTol = absTol*rowNorm[row0 + r];
+      const acc_t *resRow = res + (size_t)r*cols, *refRow = ref + (size_t)r*cols;
+      const double *cn = colNorm + col0;
+      unsigned int c = 0;
+      for (; c + CHECK_LANES <= cols; c += CHECK_LANES) {
+         for (unsigned int l = 0; l < CHECK_LANES; ++l) {
+            const double res_val = resRow[c + l];
+            const double ref_val = refRow[c + l];
+            const double absErr = fabs(res_val - ref_val);
+            const double absRef = fabs(ref_val);
+            const double relErr = absErr/(absRef > 0 ? absRef : 1);
+            const long long ulp = llabs(elemOrdered(resRow[c + l]) - elemOrdered(refRow[c + l]));
+            maxAbs[l] = absErr > maxAbs[l] ? absErr : maxAbs[l];
+            maxRel[l] = relErr > maxRel[l] ? relErr : maxRel[l];
+            maxUlp[l] = ulp > maxUlp[l] ? ulp : maxUlp[l];
+            count[l] += checkWrong(absErr, absRef, threshold, rowTol*cn[c + l]);
+         }
+      }
+      for (; c < cols; ++c) {
+         const double absErr = fabs((double)resRow[c] - (double)refRow[c]);
+         const double absRef = fabs((double)refRow[c]);
+         const double relErr = absErr/(absRef > 0 ? absRef : 1);
+         const long long ulp = llabs(elemOrdered(resRow[c]) - elemOrdered(refRow[c]));
+         maxAbs[0] = absErr > maxAbs[0] ? absErr : maxAbs[0];
+         maxRel[0] = relErr > maxRel[0] ? relErr : maxRel[0];
+         maxUlp[0] = ulp > maxUlp[0] ? ulp : maxUlp[0];
+         count[0] += checkWrong(absErr, absRef, threshold, rowTol*cn[c]);
+      }
+   }
+
+   checkStatsInit(stats);
+   for (unsigned int l = 0; l < CHECK_LANES; ++l) {
+      stats->maxAbsErr = maxAbs[l] > stats->maxAbsErr ? maxAbs[l] : stats->maxAbsErr;
+      stats->maxRelErr = maxRel[l] > stats->maxRelErr ? maxRel[l] : stats->maxRelErr;
+      stats->maxUlp = (unsigned long long)maxUlp[l] > stats->maxUlp ? (unsigned long long)maxUlp[l] : stats->maxUlp;
+      stats->mismatches += count[l];
+   }
+
+   //Locate the first mismatches, only for wrong blocks
+   const unsigned int n = rows*cols;
+   for (unsigned int i = 0; i < n && stats->mismatches > 0 && stats->numCoords < CHECK_MAX_COORDS; ++i) {
+      const double absErr = fabs((double)res[i] - (double)ref[i]);
+      if (checkWrong(absErr, fabs((double)ref[i]), threshold, absTol*rowNorm[row0 + i/cols]*colNorm[col0 + i%cols])) {
+         stats->coords[stats->numCoords][0] = row0 + i/cols;
+         stats->coords[stats->numCoords][1] = col0 + i%cols;
+         stats->numCoords++;
+      }
+   }
+}
+
+// Euclidean norms of the block row <i> rows of the blocked <rows>x<cols> matrix
+// <x>, stored from norm[i*BSIZE]. With <cols> set, of the block column <i> columns
+#pragma oss task in([(size_t)rows*cols]x) out([blockDim(byCols ? cols : rows, i)]norm)
+void checkNormsBlock(const elem_t *x, const unsigned int rows, const unsigned int cols, const unsigned int i,
+   const unsigned int byCols, double *norm)
+{
+   const unsigned int len = blockDim(byCols ? cols : rows, i);
+   for (unsigned int r = 0; r < len; ++r) norm[r] = 0;
+   for (unsigned int l = 0; l < numBlocks(byCols ? rows : cols); ++l) {
+      const unsigned int bi = byCols ? l : i, bj = byCols ? i : l;
+      const unsigned int bn = blockDim(cols, bj);
+      const elem_t *blk = x + blockOffset(rows, cols, bi, bj);
+      for (unsigned int r = 0; r < blockDim(rows, bi); ++r) {
+         for (unsigned int c = 0; c < bn; ++c) {
+            const double v = ELEM_ACC(blk[r*bn + c]);
+            norm[byCols ? c : r] += v*v;
+         }
+      }
+   }
+   for (unsigned int r = 0; r < len; ++r) norm[r] = sqrt(norm[r]);
+}
+
+// Norms of the rows of A (<m>) and of the columns of B (<n>). By Cauchy-Schwarz,
+// (|A|*|B|)_ij <= rowNorm[i]*colNorm[j], which bounds the rounding error of C_ij
+void checkNorms(const elem_t *a, const elem_t *b, const unsigned int m, const unsigned int n, const unsigned int k,
+   double *rowNorm, double *colNorm)
+{
+   for (unsigned int i = 0; i < numBlocks(m); ++i) {
+      checkNormsBlock(a, m, k, i, 0, rowNorm + (size_t)i*BSIZE);
+   }
+   for (unsigned int j = 0; j < numBlocks(n); ++j) {
+      checkNormsBlock(b, k, n, j, 1, colNorm + (size_t)j*BSIZE);
+   }
+   #pragma oss taskwait
+}
+
+#pragma oss task in([rows*cols]res, [rows*cols]ref) out(*stats)
+void checkBlock(check_stats_t* stats, const acc_t* res, const acc_t* ref, const unsigned int rows, const unsigned int cols,
+   const unsigned int row0, const unsigned int col0, const float threshold, const double *rowNorm, const double *colNorm,
+   const double absTol)
+{
+   TRACE_START_AT(TRACE_CHECK_BLOCK, 2, row0/BSIZE, col0/BSIZE, 0);
+   checkBlockStats(stats, res, ref, rows, cols, row0, col0, threshold, rowNorm, colNorm, absTol);
+   TRACE_END_AT(TRACE_CHECK_BLOCK, 2, row0/BSIZE, col0/BSIZE, 0);
+}
+
+// Checks block (i,j) against a reference file with a different block size
+#pragma oss task in([rows*cols]res) out(*stats)
+void checkBlockReblock(check_stats_t* stats, const acc_t* res, const ref_file_t *ref, const unsigned int rows, const unsigned int cols,
+   const unsigned int row0, const unsigned int col0, const float threshold, const double *rowNorm, const double *colNorm,
+   const double absTol)
+{
+   TRACE_START_AT(TRACE_CHECK_BLOCK, 2, row0/BSIZE, col0/BSIZE, 0);
+   acc_t *buf = (acc_t *)malloc((size_t)rows*cols*sizeof(acc_t));
+   if (buf == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the checking\n");
+      exit(1);
+   }
+   refGather(ref, row0, col0, rows, cols, buf);
+   checkBlockStats(stats, res, buf, rows, cols, row0, col0, threshold, rowNorm, colNorm, absTol);
+   free(buf);
+   TRACE_END_AT(TRACE_CHECK_BLOCK, 2, row0/BSIZE, col0/BSIZE, 0);
+}
+
+// Checks reference block <blk> only by its checksum. The reference data is
+// read only if the checksum does not match
+#pragma oss task out(*stats)
+void checkBlockChecksum(check_stats_t* stats, const ref_file_t *res, const ref_file_t *ref, const ref_block_t *blk,
+   const unsigned int row0, const unsigned int col0, const float threshold, const double *rowNorm, const double *colNorm,
+   const double absTol)
+{
+   TRACE_START_AT(TRACE_CHECK_BLOCK, 2, row0/BSIZE, col0/BSIZE, 0);
+   acc_t *buf = (acc_t *)malloc((size_t)blk->rows*blk->cols*sizeof(acc_t));
+   if (buf == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the checking\n");
+      exit(1);
+   }
+   refGather(res, row0, col0, blk->rows, blk->cols, buf);
+   if (refChecksum(buf, (size_t)blk->rows*blk->cols, REF_CHECKSUM_INIT) == blk->checksum) {
+      checkStatsInit(stats);
+      stats->checksumBlocks = 1;
+   } else {
+      checkBlockStats(stats, buf, ref->data + blk->offset, blk->rows, blk->cols, row0, col0, threshold, rowNorm, colNorm,
+         absTol);
+   }
+   free(buf);
+   TRACE_END_AT(TRACE_CHECK_BLOCK, 2, row0/BSIZE, col0/BSIZE, 0);
+}
+
+void checkStatsPrint(const check_stats_t *stats) {
+   printf( "  Max. absolute error:   %e\n", stats->maxAbsErr );
+   printf( "  Max. relative error:   %e\n", stats->maxRelErr );
+   printf( "  Max. ULP distance:     %llu\n", stats->maxUlp );
+   printf( "  Mismatches:            %llu\n", stats->mismatches );
+   for (unsigned int i = 0; i < stats->numCoords; ++i) {
+      printf( "  Mismatch at:           (%u, %u)\n", stats->coords[i][0], stats->coords[i][1] );
+   }
+}
+
+// Writes the matrix dimensions as used in file names and reports
+void dimsString(char *str, const unsigned int m, const unsigned int n, const unsigned int k) {
+   if (m == n && n == k) {
+      sprintf(str, "%u", m);
+   } else {
+      sprintf(str, "%ux%ux%u", m, n, k);
+   }
+}
+
+// Writes the name of the file of matrix <mat> ('A', 'B' or 'C'), used by the
+// out-of-core products and the input files. The ones generated with other
+// generators than the LCG one are named after them
+char *matrixFileName(char *name, const char *dimsStr, const unsigned int gen, const char mat) {
+   if (gen == REF_GEN_COUNTER) {
+      sprintf(name, "matmul_%s_%s_%s_%c.bin", ELEM_T_STR, dimsStr, REF_GEN_STR[gen], mat);
+   } else {
+      sprintf(name, "matmul_%s_%s_%c.bin", ELEM_T_STR, dimsStr, mat);
+   }
+   return name;
+}
+
+// Element <l> of <x>, a matrix of C elements if <isC> is set or of A and B elements otherwise
+static double freivaldsElem(const char *x, const size_t l, const unsigned int isC) {
+   return isC ? (double)((const acc_t *)x)[l] : (double)ELEM_ACC(((const elem_t *)x)[l]);
+}
+
+// Multiplies the block row <i> of the blocked <rows>x<cols> matrix <x> by the
+// <t> dense vectors in <v> (stored [cols][t]), and |x| by |v|. Results are
+// stored in <y> and <w> ([rows][t]) starting at row i*BSIZE
+#pragma oss task in([(size_t)blockDim(rows, i)*cols*(isC ? sizeof(acc_t) : sizeof(elem_t))]x) in([cols*t]v) out([blockDim(rows, i)*t]y, [blockDim(rows, i)*t]w)
+void freivaldsBlockRow(const char *x, const unsigned int isC, const unsigned int rows, const unsigned int cols, const unsigned int i,
+   const double *v, double *y, double *w, const unsigned int t)
+{
+   const size_t size = isC ? sizeof(acc_t) : sizeof(elem_t);
+   const unsigned int bm = blockDim(rows, i);
+   for (unsigned int l = 0; l < bm*t; ++l) {
+      y[l] = w[l] = 0;
+   }
+   for (unsigned int j = 0; j < numBlocks(cols); ++j) {
+      const unsigned int bn = blockDim(cols, j);
+      const char *blk = x + (blockOffset(rows, cols, i, j) - blockOffset(rows, cols, i, 0))*size;
+      const double *vb = v + (size_t)j*BSIZE*t;
+      for (unsigned int r = 0; r < bm; ++r) {
+         for (unsigned int c = 0; c < bn; ++c) {
+            const double xv = freivaldsElem(blk, r*bn + c, isC);
+            for (unsigned int q = 0; q < t; ++q) {
+               y[r*t + q] += xv*vb[c*t + q];
+               w[r*t + q] += fabs(xv)*fabs(vb[c*t + q]);
+            }
+         }
+      }
+   }
+}
+
+// Multiplies all block rows of <x> by the vectors in <v>
+void freivaldsProduct(const void *x, const unsigned int isC, const unsigned int rows, const unsigned int cols, const double *v,
+   double *y, double *w, const unsigned int t)
+{
+   const size_t size = isC ? sizeof(acc_t) : sizeof(elem_t);
+   for (unsigned int i = 0; i < numBlocks(rows); ++i) {
+      freivaldsBlockRow((const char *)x + blockOffset(rows, cols, i, 0)*size, isC, rows, cols, i, v,
+         y + (size_t)i*BSIZE*t, w + (size_t)i*BSIZE*t, t);
+   }
+}
+
+// Checks C = reps*A*B comparing C*r with reps*A*(B*r) for FREIVALDS_TRIALS random
+// vectors r drawn from <seed>. The rounding errors of one product are not
+// correlated, so they grow with the square root of the terms of the sums: the
+// error of (C*r)_i is about sqrt(k)*eps*sqrt(sum_j ((|A|*|B|)_ij*r_j)^2), and
+// (|A|*|B|)_ij <= rowNorm[i]*colNorm[j] (see checkNorms). The <reps> products
+// accumulated in C repeat the same sums, so their errors add up linearly. A row
+// is wrong if the difference exceeds
+// FREIVALDS_TOLERANCE*reps*sqrt(k+n)*eps*(reps*rowNorm[i]*|colNorm.*r|), where n
+// covers the error of the check itself, scaled by <tolScale> for algorithms with
+// a larger bound. Returns the tolerance
+double matmulCheckFreivalds(const elem_t *a, const elem_t *b, const acc_t *c, const unsigned int m, const unsigned int n,
+   const unsigned int k, const unsigned int reps, const double tolScale, unsigned int seed, check_stats_t *stats)
+{
+   const unsigned int t = FREIVALDS_TRIALS;
+   double *r = (double *)malloc(((size_t)n*t + (size_t)k*t*2 + (size_t)m*t*4 + m + n + t)*sizeof(double));
+   if (r == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the checking\n");
+      exit(1);
+   }
+   double *x = r + (size_t)n*t, *xw = x + (size_t)k*t;
+   double *y = xw + (size_t)k*t, *yw = y + (size_t)m*t;
+   double *z = yw + (size_t)m*t, *zw = z + (size_t)m*t;
+   double *rowNorm = zw + (size_t)m*t, *colNorm = rowNorm + m, *rNorm = colNorm + n;
+
+   for (size_t l = 0; l < (size_t)n*t; ++l) {
+      r[l] = 2.0*rand_r(&seed)/RAND_MAX - 1.0;
+   }
+
+   freivaldsProduct(b, 0, k, n, r, x, xw, t);
+   freivaldsProduct(c, 1, m, n, r, z, zw, t);
+   #pragma oss taskwait
+   freivaldsProduct(a, 0, m, k, x, y, yw, t);
+   checkNorms(a, b, m, n, k, rowNorm, colNorm);
+   //Norm of the columns of B weighted by each vector, |colNorm.*r|
+   for (unsigned int q = 0; q < t; ++q) {
+      rNorm[q] = 0;
+      for (unsigned int j = 0; j < n; ++j) {
+         rNorm[q] += colNorm[j]*colNorm[j]*r[(size_t)j*t + q]*r[(size_t)j*t + q];
+      }
+      rNorm[q] = sqrt(rNorm[q]);
+   }
+
+   const double eps = ACC_T_EPSILON;
+   const double tol = tolScale*FREIVALDS_TOLERANCE*reps*sqrt(k + (double)n)*eps;
+   checkStatsInit(stats);
+   for (unsigned int i = 0; i < m; ++i) {
+      unsigned int wrong = 0;
+      for (unsigned int q = 0; q < t; ++q) {
+         const double res = fabs(z[(size_t)i*t + q] - reps*y[(size_t)i*t + q]);
+         const double bound = reps*rowNorm[i]*rNorm[q];
+         const double rel = res/(bound > 0 ? bound : 1);
+         stats->maxAbsErr = res > stats->maxAbsErr ? res : stats->maxAbsErr;
+         stats->maxRelErr = rel > stats->maxRelErr ? rel : stats->maxRelErr;
+         if (!(res <= tol*bound) && !wrong) {
+            wrong = 1;
+            stats->mismatches++;
+            if (stats->numCoords < CHECK_MAX_COORDS) {
+               stats->coords[stats->numCoords][0] = i;
+               stats->coords[stats->numCoords][1] = q;
+               stats->numCoords++;
+            }
+         }
+      }
+   }
+   free(r);
+   stats->boundRatio = stats->maxRelErr*tolScale/tol;
+   return tol;
+}
+
+void freivaldsPrint(const check_stats_t *stats, const double tol) {
+   printf( "  Trials:                %u\n", FREIVALDS_TRIALS );
+   printf( "  Tolerance:             %e\n", tol );
+   printf( "  Max. residual:         %e\n", stats->maxAbsErr );
+   printf( "  Max. scaled residual:  %e\n", stats->maxRelErr );
+   printf( "  Wrong rows:            %llu\n", stats->mismatches );
+   for (unsigned int i = 0; i < stats->numCoords; ++i) {
+      printf( "  Wrong row:             %u (trial %u)\n", stats->coords[i][0], stats->coords[i][1] );
+   }
+}
+
+// Checks C = reps*A*B with the <check> method. <tolScale> scales the tolerances
+// of the classic product for algorithms with a larger error bound
+unsigned int matmulCheck(const unsigned int check, const elem_t* a, const elem_t* b, const acc_t* c,
+   const unsigned int m, const unsigned int n, const unsigned int k, const unsigned int reps, const unsigned int gen,
+   const double tolScale, check_stats_t *stats)
+{
+   const float threshold = THRESHOLD*tolScale;
    unsigned int check_ok = 1;
+   char dims_str[48], gen_str[16] = "";
+   dimsString(dims_str, m, n, k);
+   checkStatsInit(stats);
+   //References of the other generators are named after them
+   if (gen != REF_GEN_BLOCK_LCG) {
+      sprintf(gen_str, "_%s", REF_GEN_STR[gen]);
+   }
 
-   if (check == 1) {
+   if (check == 1 || check == 3) {
       //Check the result matrix against the reference solution
       printf( "=================== CHECKING ===================== \n" );
-      char ref_filename[64];
-      sprintf(ref_filename, "ref/matmul_%s_%u_%u_%u.ref", ELEM_T_STR, msize, BSIZE, 2 /*numReps*/);
-      int ref_file = open(ref_filename, O_RDONLY);
-      if (ref_file == -1) {
+      char ref_filename[96];
+      ref_file_t ref;
+      sprintf(ref_filename, "ref/matmul_%s_%s_%u%s.ref", ELEM_T_STR, dims_str, reps, gen_str);
+      int ref_status = refOpen(ref_filename, &ref);
+      if (ref_status != 0 && check == 1 && gen == REF_GEN_BLOCK_LCG) {
+         //Legacy reference, only valid for the same block size
+         sprintf(ref_filename, "ref/matmul_%s_%s_%u_%u.ref", ELEM_T_STR, dims_str, BSIZE, reps);
+         ref_status = refOpenLegacy(ref_filename, &ref, m, n, BSIZE);
+      }
+      if (ref_status != 0) {
          fprintf(stderr, "Cannot open '%s' as a reference solution\n", ref_filename);
          check_ok = 0;
+      } else if (ref.m != m || ref.n != n) {
+         fprintf(stderr, "Reference solution '%s' has a different size\n", ref_filename);
+         refClose(&ref);
+         check_ok = 0;
+      } else if (ref.generator != gen) {
+         fprintf(stderr, "Reference solution '%s' was generated with the %s inputs\n", ref_filename,
+            ref.generator < REF_GEN_NUM ? REF_GEN_STR[ref.generator] : "unknown");
+         refClose(&ref);
+         check_ok = 0;
       } else {
-         const elem_t* c_ref = (const elem_t *)mmap(NULL, m2size*sizeof(elem_t), PROT_READ, MAP_SHARED, ref_file, 0);
-         if (c_ref == (const elem_t *)-1) {
-            fprintf(stderr, "Cannot map '%s' as a reference solution\n", ref_filename);
-            check_ok = 0;
-         } else {
-            for (unsigned int i = 0; i < msize/BSIZE && check_ok; i++) {
-               for (unsigned int j = 0; j < msize/BSIZE && check_ok; j++) {
-                  unsigned int const ci = j*b2size + i*BSIZE*msize;
-                  checkBlock(&check_ok, &c[ci], &c_ref[ci], THRESHOLD);
+         if (ref.bsize != BSIZE && ref.generator == REF_GEN_BLOCK_LCG) {
+            fprintf(stderr, "WARNING:\tReference solution '%s' was generated with %u block size, and the inputs depend on it\n",
+               ref_filename, ref.bsize);
+         }
+         //Each block task writes its own statistics, reduced afterwards
+         const unsigned int nblocks = check == 1 ? numBlocks(m)*numBlocks(n) :
+            ((m + ref.bsize - 1)/ref.bsize)*((n + ref.bsize - 1)/ref.bsize);
+         check_stats_t *blockStats = (check_stats_t *)malloc(nblocks*sizeof(check_stats_t));
+         double *rowNorm = (double *)malloc(((size_t)m + n)*sizeof(double));
+         if (blockStats == NULL || rowNorm == NULL) {
+            fprintf(stderr, "ERROR:\tCannot allocate memory for the checking\n");
+            exit(1);
+         }
+         //Worst case rounding error bound of each element, reps*(k+2)*eps*(reps*|A|*|B|),
+         //0 for the exact integer products
+         double *colNorm = rowNorm + m;
+         const double absTol = THRESHOLD > 0 ? tolScale*CHECK_ABS_TOLERANCE*reps*(k + 2.0)*ACC_T_EPSILON*reps : 0;
+         checkNorms(a, b, m, n, k, rowNorm, colNorm);
+         if (check == 1) {
+            for (unsigned int i = 0; i < numBlocks(m); i++) {
+               for (unsigned int j = 0; j < numBlocks(n); j++) {
+                  size_t const ci = blockOffset(m, n, i, j);
+                  TRACE_CREATE(TRACE_CHECK_BLOCK, 2, i, j, 0);
+                  if (ref.bsize == BSIZE) {
+                     checkBlock(&blockStats[i*numBlocks(n) + j], &c[ci], &ref.data[ci], blockDim(m, i), blockDim(n, j),
+                        i*BSIZE, j*BSIZE, threshold, rowNorm, colNorm, absTol);
+                  } else {
+                     checkBlockReblock(&blockStats[i*numBlocks(n) + j], &c[ci], &ref, blockDim(m, i), blockDim(n, j),
+                        i*BSIZE, j*BSIZE, threshold, rowNorm, colNorm, absTol);
+                  }
                }
             }
-            #pragma oss taskwait
-            munmap((void *)c_ref, m2size*sizeof(elem_t));
-            close(ref_file);
+         } else {
+            //Blocks are verified following the reference blocking
+            const ref_file_t res = { -1, 0, NULL, m, n, BSIZE, gen, NULL, c };
+            const unsigned int bcols = (n + ref.bsize - 1)/ref.bsize;
+            for (unsigned int l = 0; l < nblocks; l++) {
+               TRACE_CREATE(TRACE_CHECK_BLOCK, 2, (l/bcols)*ref.bsize/BSIZE, (l%bcols)*ref.bsize/BSIZE, 0);
+               checkBlockChecksum(&blockStats[l], &res, &ref, &ref.index[l], (l/bcols)*ref.bsize, (l%bcols)*ref.bsize, threshold,
+                  rowNorm, colNorm, absTol);
+            }
+         }
+         #pragma oss taskwait
+         for (unsigned int l = 0; l < nblocks; l++) {
+            checkStatsMerge(stats, &blockStats[l]);
+         }
+         free(blockStats);
+         free(rowNorm);
+         refClose(&ref);
+         check_ok = stats->mismatches == 0;
+         stats->boundRatio = THRESHOLD > 0 ? stats->maxRelErr/THRESHOLD : 0;
+         checkStatsPrint(stats);
+         if (tolScale > 1) {
+            printf( "  Error vs classic bound: %f (%.0f allowed)\n", stats->boundRatio, tolScale );
          }
+         if (check == 3) {
+            printf( "  Checksum matches:      %llu of %u blocks\n", stats->checksumBlocks, nblocks );
+         }
+      }
+      printf( "Output matrix is %s!\n", (check_ok ? "OK" : "WRONG") );
+      printf( "================================================== \n" );
+   } else if (check == 4) {
+      //Check the result matrix without reference
+      printf( "============ CHECKING (FREIVALDS) ================ \n" );
+      const unsigned int seed = (unsigned int)(wall_time()*1e6);
+      printf( "  Random vectors seed:   %u\n", seed );
+      freivaldsPrint(stats, matmulCheckFreivalds(a, b, c, m, n, k, reps, tolScale, seed, stats));
+      if (tolScale > 1) {
+         printf( "  Error vs classic bound: %f (%.0f allowed)\n", stats->boundRatio, tolScale );
       }
+      check_ok = stats->mismatches == 0;
       printf( "Output matrix is %s!\n", (check_ok ? "OK" : "WRONG") );
       printf( "================================================== \n" );
    } else if (check == 2) {
      //Write the reference file
       printf( "============= GENERATING REFERENCE =============== \n" );
-      char ref_filename[64];
-      sprintf(ref_filename, "matmul_%s_%u_%u_%u.ref", ELEM_T_STR, msize, BSIZE, 2 /*numReps*/);
-      FILE *ref_file = fopen(ref_filename, "w+");
-      if (fwrite(c, sizeof(elem_t), m2size, ref_file) != m2size) {
+      char ref_filename[96];
+      sprintf(ref_filename, "matmul_%s_%s_%u%s.ref", ELEM_T_STR, dims_str, reps, gen_str);
+      if (refWrite(ref_filename, c, m, n, k, BSIZE, 2019 /*seed*/, gen, reps) != 0) {
          fprintf(stderr, "Error writing reference file\n");
          check_ok = 0;
       }
-      fclose(ref_file);
       printf( "Output wrote to '%s'\n", ref_filename );
       printf( "Move the file inside the 'ref' folder to use it as a reference\n" );
       printf( "================================================== \n" );
@@ -139,8 +743,101 @@ unsigned int matmulCheck(const unsigned int check, const elem_t* c, const unsign
    return check_ok;
 }
 
+// Flat compute core: kij loop nest, the j loop is unrolled in the pipelined i
+// loop and uses BSIZE/MBLOCK_II multipliers
+void matmulBlockCompute(const elem_t a[BSIZE*BSIZE], const elem_t b[BSIZE*BSIZE], acc_t c[BSIZE*BSIZE]) {
+   #pragma HLS INLINE
+   for (int k = 0; k < BSIZE; ++k) {
+      for (int i = 0; i < BSIZE; ++i) {
+         #pragma HLS pipeline II=MBLOCK_II
+         for (int j = 0; j < BSIZE; ++j) {
+            c[i*BSIZE + j] += ELEM_ACC(a[i*BSIZE + k]) * ELEM_ACC(b[k*BSIZE + j]);
+         }
+      }
+   }
+}
+
+#if defined(MATMUL_CORE_SYSTOLIC)
+// Systolic compute core: a grid of MATMUL_PE_ROWS x MATMUL_PE_COLS processing
+// elements that goes over the C block in tiles of the grid size. Each PE keeps
+// one C element of the tile (output stationary), A elements move right along
+// the PE rows and B elements move down along the PE columns, so a PE only talks
+// to its neighbours. A and B enter skewed, PE (r,s) gets the k-th pair at step
+// k + r + s. Each C element accumulates its products in increasing k, in the
+// same order and types as matmulBlockCompute
+void matmulBlockSystolic(const elem_t a[BSIZE*BSIZE], const elem_t b[BSIZE*BSIZE], acc_t c[BSIZE*BSIZE]) {
+   #pragma HLS INLINE
+   elem_t aFeed[MATMUL_PE_ROWS][MATMUL_BLOCK_SIZE];
+   elem_t aReg[MATMUL_PE_ROWS][MATMUL_PE_COLS];
+   elem_t bReg[MATMUL_PE_ROWS][MATMUL_PE_COLS];
+   acc_t acc[MATMUL_PE_ROWS][MATMUL_PE_COLS];
+   #pragma HLS array_partition variable=aFeed complete dim=1
+   #pragma HLS array_partition variable=aReg complete dim=0
+   #pragma HLS array_partition variable=bReg complete dim=0
+   #pragma HLS array_partition variable=acc complete dim=0
+
+   for (int ti = 0; ti < BSIZE; ti += MATMUL_PE_ROWS) {
+      //The A rows of a tile row are in the same partitions of a, so they are copied to one feeder per PE row
+      for (int x = 0; x < MATMUL_PE_ROWS*BSIZE; ++x) {
+         #pragma HLS pipeline II=1
+         #pragma HLS unroll factor=MBLOCK_FPGA_PWIDTH/32
+         aFeed[x/BSIZE][x%BSIZE] = a[ti*BSIZE + x];
+      }
+      for (int tj = 0; tj < BSIZE; tj += MATMUL_PE_COLS) {
+         for (int r = 0; r < MATMUL_PE_ROWS; ++r) {
+            #pragma HLS pipeline II=1
+            for (int s = 0; s < MATMUL_PE_COLS; ++s) {
+               acc[r][s] = c[(ti + r)*BSIZE + tj + s];
+            }
+         }
+         //The B elements entering the PE columns in a step are in different partitions of b, they are read directly
+         for (int t = 0; t < BSIZE + MATMUL_PE_ROWS + MATMUL_PE_COLS - 2; ++t) {
+            #pragma HLS pipeline II=1
+            //From the last PE backwards, so each PE reads the registers of its neighbours of the previous step
+            for (int r = MATMUL_PE_ROWS - 1; r >= 0; --r) {
+               for (int s = MATMUL_PE_COLS - 1; s >= 0; --s) {
+                  const int k = t - r - s;
+                  const int valid = k >= 0 && k < BSIZE;
+                  const elem_t av = s > 0 ? aReg[r][s - 1] : (valid ? aFeed[r][k] : ELEM_SET(0));
+                  const elem_t bv = r > 0 ? bReg[r - 1][s] : (valid ? b[k*BSIZE + tj + s] : ELEM_SET(0));
+                  if (valid) {
+                     acc[r][s] += ELEM_ACC(av) * ELEM_ACC(bv);
+                  }
+                  aReg[r][s] = av;
+                  bReg[r][s] = bv;
+               }
+            }
+         }
+         for (int r = 0; r < MATMUL_PE_ROWS; ++r) {
+            #pragma HLS pipeline II=1
+            for (int s = 0; s < MATMUL_PE_COLS; ++s) {
+               c[(ti + r)*BSIZE + tj + s] = acc[r][s];
+            }
+         }
+      }
+   }
+}
+#endif // defined(MATMUL_CORE_SYSTOLIC)
+
+#if defined(MATMUL_CORE_SYSTOLIC) && defined(MATMUL_EMU)
+// Host testbench of the systolic core: also runs the flat core on a copy of
+// <c> and compares both results bit by bit
+void matmulBlockSystolicTest(const elem_t a[BSIZE*BSIZE], const elem_t b[BSIZE*BSIZE], acc_t c[BSIZE*BSIZE]) {
+   static acc_t ref[MATMUL_BLOCK_SIZE*MATMUL_BLOCK_SIZE];
+   memcpy(ref, c, sizeof(ref));
+   matmulBlockCompute(a, b, ref);
+   matmulBlockSystolic(a, b, c);
+   emuCoreCheck(c, ref, MATMUL_BLOCK_SIZE*MATMUL_BLOCK_SIZE);
+}
+#  define matmulBlockCore matmulBlockSystolicTest
+#elif defined(MATMUL_CORE_SYSTOLIC)
+#  define matmulBlockCore matmulBlockSystolic
+#else
+#  define matmulBlockCore matmulBlockCompute
+#endif
+
 #pragma oss task device(fpga) num_instances(MATMUL_NUM_ACCS) copy_deps in([BSIZE*BSIZE]a, [BSIZE*BSIZE]b) inout([BSIZE*BSIZE]c) affinity(af)
-void matmulBlock(const elem_t a[BSIZE*BSIZE], const elem_t b[BSIZE*BSIZE], elem_t c[BSIZE*BSIZE], int af)
+void matmulBlock(const elem_t a[BSIZE*BSIZE], const elem_t b[BSIZE*BSIZE], acc_t c[BSIZE*BSIZE], int af)
 {
    #pragma HLS INLINE
    #pragma HLS array_partition variable=a cyclic factor=MBLOCK_FPGA_PWIDTH/64
@@ -155,202 +852,2693 @@ void matmulBlock(const elem_t a[BSIZE*BSIZE], const elem_t b[BSIZE*BSIZE], elem_
       #pragma HLS resource variable=B core=XPM_MEMORY uram
    #endif
 #endif
+#if defined(MATMUL_EMU)
+   TRACE_START(TRACE_MATMUL_BLOCK, c, a);
+#endif
 
-   for (int k = 0; k < BSIZE; ++k) {
-      for (int i = 0; i < BSIZE; ++i) {
-         #pragma HLS pipeline II=MBLOCK_II
-         for (int j = 0; j < BSIZE; ++j) {
-            c[i*BSIZE + j] += a[i*BSIZE + k] * b[k*BSIZE + j];
-         }
-      }
-   }
+   matmulBlockCore(a, b, c);
+#if defined(MATMUL_EMU)
+   TRACE_END(TRACE_MATMUL_BLOCK, c, a);
+   emuBlockTask(a, c, af);
+#endif
 }
 
 #if defined(USE_IMPLEMENTS)
 //#pragma omp target device(smp) copy_deps implements(matmulBlock)
 #pragma omp target device(smp) no_copy_deps implements(matmulBlock) copy_inout([BSIZE*BSIZE]c)
 #pragma omp task in([BSIZE*BSIZE]a, [BSIZE*BSIZE]b) inout([BSIZE*BSIZE]c)
-void matmulBlockSmp(elem_t *a, elem_t *b, elem_t *c) {
-#if defined(USE_MKL)
+void matmulBlockSmp(elem_t *a, elem_t *b, acc_t *c) {
+   TRACE_START(TRACE_MATMUL_BLOCK, c, a);
+#if defined(USE_MKL) && defined(ELEM_T_BLAS)
    elem_t const alpha = 1.0;
    elem_t const beta = 1.0;
    char const transa = 'n';
    char const transb = 'n';
    GEMM(&transa, &transb, &BSIZE, &BSIZE, &BSIZE, &alpha, a,
          &BSIZE, b, &BSIZE, &beta, c, &BSIZE);
-#elif defined(USE_OPENBLAS)
+#elif defined(USE_OPENBLAS) && defined(ELEM_T_BLAS)
    elem_t const alpha = 1.0;
    elem_t const beta = 1.0;
    cblas_gemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, BSIZE, BSIZE,
       BSIZE, alpha, a, BSIZE, b, BSIZE, beta, c, BSIZE);
 #else
-   for (unsigned int i = 0; i < BSIZE; ++i) {
-      for (unsigned int j = 0; j < BSIZE; ++j) {
-         elem_t l = 0;
-         for (unsigned int k = 0; k < BSIZE; ++k) {
-            l += a[i*BSIZE + k] * b[k*BSIZE + j];
+   smpGemm(BSIZE, BSIZE, BSIZE, a, BSIZE, b, BSIZE, c, BSIZE);
+#endif
+   TRACE_END(TRACE_MATMUL_BLOCK, c, a);
+}
+#endif // defined(USE_IMPLEMENTS)
+
+// SMP block task for any block product. Used for the edge blocks, where any of
+// the dimensions is smaller than BSIZE, and for the SMP part of co-execution
+#pragma oss task in([m*k]a, [k*n]b) inout([m*n]c)
+void matmulBlockHost(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int k) {
+   TRACE_START(TRACE_MATMUL_BLOCK, c, a);
+   smpGemm(m, n, k, a, k, b, n, c, n);
+   TRACE_END(TRACE_MATMUL_BLOCK, c, a);
+}
+
+// SMP task updating the C blocks <j0> to <j1>-1 of block row <i> with their
+// whole k-chains, instead of one task per block product. <a> is the A block
+// row and <c> the first C block, and the C blocks stay in cache along the chain
+#pragma oss task in([(size_t)blockDim(m, i)*kdim]a, [(size_t)kdim*n]b) inout([clen]c)
+void matmulChainHost(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n,
+   const unsigned int kdim, const unsigned int i, const unsigned int j0, const unsigned int j1, const size_t clen)
+{
+   //Only the span of the dependency on C
+   (void)clen;
+   TRACE_START(TRACE_MATMUL_BLOCK, c, a);
+   const unsigned int bm = blockDim(m, i);
+   for (unsigned int j = j0; j < j1; j++) {
+      const unsigned int bn = blockDim(n, j);
+      acc_t *cb = c + (blockOffset(m, n, i, j) - blockOffset(m, n, i, j0));
+      for (unsigned int k = 0; k < numBlocks(kdim); k++) {
+         const unsigned int bk = blockDim(kdim, k);
+         smpGemm(bm, bn, bk, a + (blockOffset(m, kdim, i, k) - blockOffset(m, kdim, i, 0)), bk,
+            b + blockOffset(kdim, n, k, j), bn, cb, bn);
+      }
+   }
+   TRACE_END(TRACE_MATMUL_BLOCK, c, a);
+}
+
+// Loads the <rows>x<cols> tile at <src>, whose rows are <ld> elements apart, into
+// the local <dst> with rows of <cols> elements. With <trans> the tile is read
+// transposed, element (r,l) being src[l*ld + r]
+void matmulTileLoad(const elem_t *src, const size_t ld, const unsigned int trans, elem_t *dst,
+   const unsigned int rows, const unsigned int cols)
+{
+   if (trans) {
+      for (unsigned int l = 0; l < cols; ++l) {
+         for (unsigned int r = 0; r < rows; ++r) {
+            dst[r*cols + l] = src[l*ld + r];
          }
-         c[i*BSIZE + j] += l;
       }
+   } else {
+      for (unsigned int r = 0; r < rows; ++r) {
+         memcpy(dst + r*cols, src + r*ld, cols*sizeof(elem_t));
+      }
+   }
+}
+
+// Writes the local <rows>x<cols> product <acc> into the tile at <c>, whose rows
+// are <ldc> elements apart, as alpha*acc + beta*c. C is not read when beta is 0
+void matmulTileStore(const acc_t *acc, acc_t *c, const size_t ldc, const acc_t alpha, const acc_t beta,
+   const unsigned int rows, const unsigned int cols)
+{
+   for (unsigned int r = 0; r < rows; ++r) {
+      for (unsigned int l = 0; l < cols; ++l) {
+         c[r*ldc + l] = beta == 0 ? alpha*acc[r*cols + l] : alpha*acc[r*cols + l] + beta*c[r*ldc + l];
+      }
+   }
+}
+
+// SMP task computing the <bm>x<bn> tile at <c>, whose rows are <ldc> elements
+// apart, as alpha*op(A)*op(B) + beta*C with its whole k-chain of <kdim>
+// elements. The k-th A tile is at a + k*aStep, with rows <lda> elements apart,
+// or transposed with <ta>, and likewise for B (see matmulChain). Tiles read as
+// they are stored are multiplied in place, the transposed ones are first loaded
+// into local tiles. A and B are only read, so they are accessed without dependency
+#pragma oss task inout(([bm][ldc]c)[0;bm][0;bn])
+void matmulTileHost(const elem_t *a, const size_t aStep, const unsigned int lda, const unsigned int ta,
+   const elem_t *b, const size_t bStep, const unsigned int ldb, const unsigned int tb,
+   acc_t *c, const unsigned int ldc, const unsigned int bm, const unsigned int bn, const unsigned int kdim,
+   const acc_t alpha, const acc_t beta)
+{
+   TRACE_START(TRACE_MATMUL_BLOCK, c, a);
+   smp_bufs_t *bufs = smpThreadBufs();
+   if (bufs != NULL && bufs->tileAcc == NULL) {
+      bufs->tileAcc = (acc_t *)(malloc(BSIZE*BSIZE*sizeof(acc_t)));
+      bufs->tileAB = (elem_t *)(malloc(2*BSIZE*BSIZE*sizeof(elem_t)));
+   }
+   if (bufs == NULL || bufs->tileAcc == NULL || bufs->tileAB == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the local tiles\n");
+      exit(1);
+   }
+   acc_t *tileAcc = bufs->tileAcc;
+   elem_t *tileAB = bufs->tileAB;
+   memset(tileAcc, 0, (size_t)bm*bn*sizeof(acc_t));
+   for (unsigned int k = 0; k < numBlocks(kdim); k++) {
+      const unsigned int bk = blockDim(kdim, k);
+      const elem_t *at = a + k*aStep, *bt = b + k*bStep;
+      unsigned int atLd = lda, btLd = ldb;
+      if (ta) {
+         matmulTileLoad(at, lda, 1, tileAB, bm, bk);
+         at = tileAB;
+         atLd = bk;
+      }
+      if (tb) {
+         matmulTileLoad(bt, ldb, 1, tileAB + BSIZE*BSIZE, bk, bn);
+         bt = tileAB + BSIZE*BSIZE;
+         btLd = bn;
+      }
+      smpGemm(bm, bn, bk, at, atLd, bt, btLd, tileAcc, bn);
+   }
+   matmulTileStore(tileAcc, c, ldc, alpha, beta, bm, bn);
+   TRACE_END(TRACE_MATMUL_BLOCK, c, a);
+}
+
+#if defined(MATMUL_KCHAIN)
+// Loads the A and B tiles of step <kb> of a matmulChain into local memory,
+// unless it is past the last step <nk>
+void matmulChainLoad(const elem_t *a, const size_t aStep, const unsigned int lda, const unsigned int ta,
+   const elem_t *b, const size_t bStep, const unsigned int ldb, const unsigned int tb,
+   elem_t al[BSIZE*BSIZE], elem_t bl[BSIZE*BSIZE], const unsigned int kb, const unsigned int nk)
+{
+   #pragma HLS inline off
+   if (kb < nk) {
+      matmulTileLoad(a + kb*aStep, lda, ta, al, BSIZE, BSIZE);
+      matmulTileLoad(b + kb*bStep, ldb, tb, bl, BSIZE, BSIZE);
    }
+}
+
+// Accumulates the product of the local A and B blocks in the local C block
+void matmulChainCompute(const elem_t al[BSIZE*BSIZE], const elem_t bl[BSIZE*BSIZE], acc_t c[BSIZE*BSIZE]) {
+   #pragma HLS inline off
+   matmulBlockCore(al, bl, c);
+}
+
+// Step <kb> of a matmulChain as a dataflow region: the product of the local
+// tiles <ac> and <bc> is accumulated in <c> while the tiles of step <kb> + 1
+// are loaded into <an> and <bn>, the other buffers of the ping-pong pair. The
+// load is always called, with nothing to do past the last step, so that the
+// region keeps the canonical form of HLS dataflow
+void matmulChainStep(const elem_t *a, const size_t aStep, const unsigned int lda, const unsigned int ta,
+   const elem_t *b, const size_t bStep, const unsigned int ldb, const unsigned int tb,
+   const elem_t ac[BSIZE*BSIZE], const elem_t bc[BSIZE*BSIZE], elem_t an[BSIZE*BSIZE], elem_t bn[BSIZE*BSIZE],
+   acc_t c[BSIZE*BSIZE], const unsigned int kb, const unsigned int nk)
+{
+   #pragma HLS inline off
+   #pragma HLS dataflow
+   matmulChainLoad(a, aStep, lda, ta, b, bStep, ldb, tb, an, bn, kb + 1, nk);
+   matmulChainCompute(ac, bc, c);
+}
+
+// Output-stationary kernel: computes the full C tile at <c>, whose rows are
+// <ldc> elements apart, as alpha*op(A)*op(B) + beta*C with the chain of
+// kdim/BSIZE A and B tiles, accumulating the product in local memory for the
+// whole chain. The k-th A tile is at a + k*aStep, with rows <lda> elements
+// apart, or transposed with <ta>, and likewise for B, so the blocked matrices
+// of the benchmark (aStep BSIZE*BSIZE, lda BSIZE) and the row-major ones of the
+// library (see ompss_gemm) are read in place. C is read once, when the product
+// is written back, and not at all when beta is 0. The A and B tiles are double
+// buffered, each step is a dataflow region that loads the next ones while
+// computing the current ones (see matmulChainStep). A and B are only read
+// during the product, so they are accessed without dependency
+#pragma oss task device(fpga) num_instances(MATMUL_NUM_ACCS) inout(([BSIZE][ldc]c)[0;BSIZE][0;BSIZE])
+void matmulChain(const elem_t *a, const size_t aStep, const unsigned int lda, const unsigned int ta,
+   const elem_t *b, const size_t bStep, const unsigned int ldb, const unsigned int tb,
+   acc_t *c, const unsigned int ldc, const unsigned int kdim, const acc_t alpha, const acc_t beta)
+{
+   acc_t cl[BSIZE*BSIZE];
+   elem_t a0[BSIZE*BSIZE], a1[BSIZE*BSIZE];
+   elem_t b0[BSIZE*BSIZE], b1[BSIZE*BSIZE];
+   #pragma HLS array_partition variable=cl cyclic factor=BSIZE/MBLOCK_II
+   #pragma HLS array_partition variable=a0 cyclic factor=MBLOCK_FPGA_PWIDTH/64
+   #pragma HLS array_partition variable=a1 cyclic factor=MBLOCK_FPGA_PWIDTH/64
+   #pragma HLS array_partition variable=b0 cyclic factor=BSIZE/(MBLOCK_II*2)
+   #pragma HLS array_partition variable=b1 cyclic factor=BSIZE/(MBLOCK_II*2)
+#if defined(MATMUL_EMU)
+   TRACE_START(TRACE_MATMUL_BLOCK, c, a);
+#endif
+
+   const unsigned int nk = kdim/BSIZE;
+   memset(cl, 0, sizeof(cl));
+   matmulChainLoad(a, aStep, lda, ta, b, bStep, ldb, tb, a0, b0, 0, nk);
+   for (unsigned int kb = 0; kb < nk; kb += 2) {
+      //Ping-pong buffers, the even steps compute on a0 and b0 while loading a1 and b1, the odd ones the other way
+      matmulChainStep(a, aStep, lda, ta, b, bStep, ldb, tb, a0, b0, a1, b1, cl, kb, nk);
+      if (kb + 1 < nk) matmulChainStep(a, aStep, lda, ta, b, bStep, ldb, tb, a1, b1, a0, b0, cl, kb + 1, nk);
+   }
+   matmulTileStore(cl, c, ldc, alpha, beta, BSIZE, BSIZE);
+#if defined(MATMUL_EMU)
+   TRACE_END(TRACE_MATMUL_BLOCK, c, a);
+   emuChainTask(a, c, nk);
 #endif
 }
-#endif // defined(USE_IMPLEMENTS)
+#endif // defined(MATMUL_KCHAIN)
 
-#pragma oss task device(fpga) in([msize*msize]a, [msize*msize]b) inout([msize*msize]c)
-void matmulFPGA(const elem_t *a, const elem_t *b, elem_t *c, const unsigned int msize) {
+// Creates the block tasks of the interior of C, i.e. full blocks of C updated
+// with full blocks of A and B. Edges are handled by matmulEdges.
+// C blocks are visited in the sequence given by <blocks>, either k-outer or in
+// groups of MBLOCK_NUM_ACCS blocks with the k loop inside. With <chain>, one
+// matmulChain task per C block runs its whole k loop. Otherwise the k-chain of
+// the <l>-th C block of the sequence has the affinity of instance
+// (<first> + l)%MBLOCK_NUM_ACCS, see matmul_affinity.h
+#pragma oss task device(fpga) in([(size_t)m*kdim]a, [(size_t)kdim*n]b, [(m/BSIZE)*(n/BSIZE)]blocks) inout([(size_t)m*n]c)
+void matmulFPGA(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const unsigned int *blocks, const unsigned int kOuter, const unsigned int chain, const unsigned int first)
+{
 #pragma HLS inline
    const unsigned int factor = MBLOCK_NUM_ACCS;
    const unsigned int b2size = BSIZE*BSIZE;
-   const unsigned int num_blocks_side = msize/BSIZE;
-   const unsigned int num_blocks_matrix = msize*msize/b2size;
-   const unsigned int num_blocks_loop = num_blocks_matrix - num_blocks_matrix%factor;
-   const unsigned int max_created_count = 8*MBLOCK_NUM_ACCS;
+   const unsigned int num_blocks_k = kdim/BSIZE;
+   const unsigned int num_blocks_cols = n/BSIZE;
+   const unsigned int num_blocks_matrix = (m/BSIZE)*num_blocks_cols;
+#if defined(MATMUL_KCHAIN)
+   if (chain) {
+      for (unsigned int l = 0; l < num_blocks_matrix; l++) {
+         const unsigned int i = blocks[l]/num_blocks_cols;
+         const unsigned int j = blocks[l]%num_blocks_cols;
+         matmulChain(a + (size_t)i*BSIZE*kdim, b2size, BSIZE, 0, b + (size_t)j*b2size, (size_t)BSIZE*n, BSIZE, 0,
+            c + (size_t)j*b2size + (size_t)i*BSIZE*n, BSIZE, kdim, 1, 1);
+      }
+      return;
+   }
+#else
+   //Without the matmulChain kernel, the k-chains are created as block products
+   (void)chain;
+#endif
+   const unsigned int num_blocks_loop = kOuter ? 0 : num_blocks_matrix - num_blocks_matrix%factor;
    for (unsigned int l = 0; l < num_blocks_loop; l+=factor) {
-      for (unsigned int k = 0; k < msize/BSIZE; k++) {
+      for (unsigned int k = 0; k < num_blocks_k; k++) {
 #pragma HLS loop_flatten off
          for (unsigned int ll = l; ll < (l+factor); ll++) {
-            const unsigned int i = ll/num_blocks_side;
-            const unsigned int j = ll%num_blocks_side;
-            const unsigned int ai = k*b2size + i*BSIZE*msize;
-            const unsigned int bi = j*b2size + k*BSIZE*msize;
-            const unsigned int ci = ll*b2size;
-	    //Not implemented yet
-            //#pragma oss taskcall affinity(ll-l)
-            matmulBlock(a + ai, b + bi, c + ci, ll-l);
+            const unsigned int i = blocks[ll]/num_blocks_cols;
+            const unsigned int j = blocks[ll]%num_blocks_cols;
+            const size_t ai = (size_t)k*b2size + (size_t)i*BSIZE*kdim;
+            const size_t bi = (size_t)j*b2size + (size_t)k*BSIZE*n;
+            const size_t ci = (size_t)j*b2size + (size_t)i*BSIZE*n;
+            matmulBlock(a + ai, b + bi, c + ci, affInstance(first, ll));
          }
       }
    }
-   for (unsigned int k = 0; k < msize/BSIZE; k++) {
+   for (unsigned int k = 0; k < num_blocks_k; k++) {
       for (unsigned int l = num_blocks_loop; l < num_blocks_matrix; l++) {
-         const unsigned int i = l/num_blocks_side;
-         const unsigned int j = l%num_blocks_side;
-         const unsigned int ai = k*b2size + i*BSIZE*msize;
-         const unsigned int bi = j*b2size + k*BSIZE*msize;
-         const unsigned int ci = l*b2size;
-         matmulBlock(a + ai, b + bi, c + ci, 0xFF);
+         const unsigned int i = blocks[l]/num_blocks_cols;
+         const unsigned int j = blocks[l]%num_blocks_cols;
+         const size_t ai = (size_t)k*b2size + (size_t)i*BSIZE*kdim;
+         const size_t bi = (size_t)j*b2size + (size_t)k*BSIZE*n;
+         const size_t ci = (size_t)j*b2size + (size_t)i*BSIZE*n;
+         matmulBlock(a + ai, b + bi, c + ci, affInstance(first, l));
+      }
+      if (!kOuter) {
+         #pragma oss taskwait
       }
-      #pragma oss taskwait
    }
 }
 
-void matmulSMP(const elem_t *a, const elem_t *b, elem_t *c, const unsigned int msize) {
-   const unsigned int b2size = BSIZE*BSIZE;
-   for (unsigned int i = 0; i < msize/BSIZE; i++) {
-      for (unsigned int k = 0; k < msize/BSIZE; k++) {
-         unsigned int const ai = k*b2size + i*BSIZE*msize;
-         for (unsigned int j = 0; j < msize/BSIZE; j++) {
-            unsigned int const bi = j*b2size + k*BSIZE*msize;
-            unsigned int const ci = j*b2size + i*BSIZE*msize;
-            matmulBlock(a + ai, b + bi, c + ci, 0xFF);
+// Creates the edge block tasks left out by matmulFPGA. When <interior> is
+// set, only the ones updating full C blocks (with the last, narrow, k block),
+// otherwise only the ones updating the C edge blocks, one k-chain task per
+// block with <chain>
+void matmulEdges(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const unsigned int interior, const unsigned int chain)
+{
+   for (unsigned int i = 0; i < numBlocks(m); i++) {
+      const unsigned int bm = blockDim(m, i);
+      for (unsigned int j = 0; j < numBlocks(n); j++) {
+         const unsigned int bn = blockDim(n, j);
+         const unsigned int full = bm == BSIZE && bn == BSIZE;
+         if (full != interior) continue;
+         if (chain && !full) {
+            TRACE_CREATE(TRACE_MATMUL_BLOCK, 2, i, j, 0);
+            matmulChainHost(a + blockOffset(m, kdim, i, 0), b, c + blockOffset(m, n, i, j), m, n, kdim, i, j, j + 1, bm*bn);
+            continue;
+         }
+         for (unsigned int k = full ? kdim/BSIZE : 0; k < numBlocks(kdim); k++) {
+            const unsigned int bk = blockDim(kdim, k);
+            TRACE_CREATE(TRACE_MATMUL_BLOCK, 2, i, j, k);
+            matmulBlockHost(a + blockOffset(m, kdim, i, k), b + blockOffset(kdim, n, k, j),
+               c + blockOffset(m, n, i, j), bm, bn, bk);
          }
       }
    }
 }
 
-int main(int argc, char** argv) {
-   if (argc != 4) {
-      usage(argv[0]);
-      exit(1);
+// Creates the task updating C block (i,j) with A block (i,k) and B block (k,j).
+// Full blocks use matmulBlock unless <hostOnly> is set, with the affinity of
+// the k-chain of the C block, the (i*(n/BSIZE) + j)-th one of the product
+void matmulBlockTask(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const unsigned int i, const unsigned int j, const unsigned int k, const unsigned int hostOnly, const unsigned int first)
+{
+   const unsigned int bm = blockDim(m, i);
+   const unsigned int bn = blockDim(n, j);
+   const unsigned int bk = blockDim(kdim, k);
+   size_t const ai = blockOffset(m, kdim, i, k);
+   size_t const bi = blockOffset(kdim, n, k, j);
+   size_t const ci = blockOffset(m, n, i, j);
+   TRACE_CREATE(TRACE_MATMUL_BLOCK, 2, i, j, k);
+   if (bm == BSIZE && bn == BSIZE && bk == BSIZE && !hostOnly) {
+      matmulBlock(a + ai, b + bi, c + ci, affInstance(first, i*(n/BSIZE) + j));
+   } else {
+      matmulBlockHost(a + ai, b + bi, c + ci, bm, bn, bk);
    }
+}
 
-   unsigned int const b2size = BSIZE*BSIZE;
-   unsigned int const msize = atoi(argv[1]);
-   unsigned int const m2size = msize*msize;
-   unsigned char const check = atoi(argv[2]);
-   unsigned char const createFrom = atoi(argv[3]);
-   char const * createFromStr = createFrom == 0 ? "cFPGA" : "cHOST";
-   if (msize%BSIZE != 0) {
-      fprintf(stderr, "ERROR:\t<matrix size> must be multiple of <block size>\n");
-      usage(argv[0]);
-      exit(1);
-   } else if (createFrom > 1) {
-      fprintf(stderr, "ERROR:\tUnsupported value in <create from>\n");
-      usage(argv[0]);
-      exit(1);
+// Creates all block tasks from the host. <blocks> holds the sequence of C blocks
+// for the orders other than the default, which is i-k-j. The groups order
+// creates groups of MBLOCK_NUM_ACCS row-major blocks with the k loop inside,
+// as from the FPGA, so the k steps of each C block reach its instance one after
+// the other. With <grain>, one k-chain task per <grain> consecutive C blocks of
+// a block row is created instead, row by row
+void matmulSMP(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const order_t order, const unsigned int *blocks, const unsigned int hostOnly, const unsigned int grain)
+{
+   const unsigned int num_blocks_cols = numBlocks(n);
+   const unsigned int num_blocks_matrix = numBlocks(m)*num_blocks_cols;
+   const unsigned int first = hostOnly || grain > 0 ? AFF_ANY : affFirst((m/BSIZE)*(n/BSIZE), kdim/BSIZE);
+   if (grain > 0) {
+      for (unsigned int i = 0; i < numBlocks(m); i++) {
+         for (unsigned int j = 0; j < num_blocks_cols; j += grain) {
+            const unsigned int j1 = j + grain < num_blocks_cols ? j + grain : num_blocks_cols;
+            const size_t clen = (size_t)blockDim(m, i)*((j1*BSIZE < n ? j1*BSIZE : n) - j*BSIZE);
+            TRACE_CREATE(TRACE_MATMUL_BLOCK, 2, i, j, 0);
+            matmulChainHost(a + blockOffset(m, kdim, i, 0), b, c + blockOffset(m, n, i, j), m, n, kdim, i, j, j1, clen);
+         }
+      }
+   } else if (order == ORDER_GROUPS) {
+      const unsigned int factor = MBLOCK_NUM_ACCS;
+      for (unsigned int l = 0; l < num_blocks_matrix; l += factor) {
+         const unsigned int l1 = l + factor < num_blocks_matrix ? l + factor : num_blocks_matrix;
+         for (unsigned int k = 0; k < numBlocks(kdim); k++) {
+            for (unsigned int ll = l; ll < l1; ll++) {
+               matmulBlockTask(a, b, c, m, n, kdim, ll/num_blocks_cols, ll%num_blocks_cols, k, hostOnly, first);
+            }
+         }
+      }
+   } else if (order == ORDER_DEFAULT) {
+      for (unsigned int i = 0; i < numBlocks(m); i++) {
+         for (unsigned int k = 0; k < numBlocks(kdim); k++) {
+            for (unsigned int j = 0; j < num_blocks_cols; j++) {
+               matmulBlockTask(a, b, c, m, n, kdim, i, j, k, hostOnly, first);
+            }
+         }
+      }
+   } else if (order == ORDER_KIJ) {
+      for (unsigned int k = 0; k < numBlocks(kdim); k++) {
+         for (unsigned int l = 0; l < num_blocks_matrix; l++) {
+            matmulBlockTask(a, b, c, m, n, kdim, blocks[l]/num_blocks_cols, blocks[l]%num_blocks_cols, k, hostOnly, first);
+         }
+      }
+   } else {
+      for (unsigned int l = 0; l < num_blocks_matrix; l++) {
+         for (unsigned int k = 0; k < numBlocks(kdim); k++) {
+            matmulBlockTask(a, b, c, m, n, kdim, blocks[l]/num_blocks_cols, blocks[l]%num_blocks_cols, k, hostOnly, first);
+         }
+      }
    }
+}
 
-   unsigned int s = m2size*sizeof(elem_t);
-   elem_t* a = (elem_t *)(malloc(s));
-   elem_t* b = (elem_t *)(malloc(s));
-   elem_t* c = (elem_t *)(malloc(s));
-   if (a == NULL || b == NULL || c == NULL) {
-      fprintf(stderr, "ERROR:\tCannot allocate memory for the matrices\n");
-      exit(1);
+// Whether the block products are run as k-chain tasks: with <grain>, and
+// always from the FPGA with the output-stationary kernel
+unsigned int matmulChained(const unsigned char createFrom, const unsigned int grain) {
+#if defined(MATMUL_KERNEL_OS)
+   return grain > 0 || createFrom == 0;
+#else
+   return grain > 0 && createFrom <= 1;
+#endif
+}
+
+// Fraction of the steps of the systolic array where its PEs compute, as each
+// tile fills and drains the array. 1 for the flat core
+double matmulCoreFillUtilization() {
+#if defined(MATMUL_CORE_SYSTOLIC)
+   return (double)BSIZE/(BSIZE + MATMUL_PE_ROWS + MATMUL_PE_COLS - 2);
+#else
+   return 1;
+#endif
+}
+
+// Interior blocks are created from the FPGA and edge blocks from the host.
+// As k-chain tasks (one per C block from the FPGA) when chained
+void matmulFPGAEdges(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const order_t order, const unsigned int *blocks, const unsigned int grain)
+{
+   const unsigned int chain = matmulChained(0, grain);
+   //The narrow k updates of full C blocks must not overlap with matmulFPGA
+   if (kdim%BSIZE != 0) {
+      matmulEdges(a, b, c, m, n, kdim, 1, 0);
+      #pragma oss taskwait
+   }
+   //C edge blocks are disjoint from the ones updated by matmulFPGA
+   matmulEdges(a, b, c, m, n, kdim, 0, chain);
+   matmulFPGA(a, b, c, m, n, kdim, blocks, order == ORDER_KIJ, chain,
+      chain ? AFF_ANY : affFirst((m/BSIZE)*(n/BSIZE), kdim/BSIZE));
+}
+
+// Block product tasks of one run: one per block triple, or one per k-chain of
+// <grain> C blocks (from the FPGA, one per C block and per narrow k block)
+unsigned long long matmulTaskCount(const unsigned char createFrom, const unsigned int grain, const unsigned int m,
+   const unsigned int n, const unsigned int k)
+{
+   const unsigned long long cblocks = (unsigned long long)numBlocks(m)*numBlocks(n);
+   if (!matmulChained(createFrom, grain)) {
+      return cblocks*numBlocks(k);
+   } else if (createFrom == 0) {
+      return cblocks + (k%BSIZE != 0 ? (unsigned long long)(m/BSIZE)*(n/BSIZE) : 0);
+   }
+   return (unsigned long long)numBlocks(m)*((numBlocks(n) + grain - 1)/grain);
+}
+
+// Bytes moved through the accelerator memory ports by the interior C blocks of
+// one run created from the FPGA. A block product task moves its A and B blocks
+// and moves its C block in and out, a k-chain task moves C only once
+void matmulFPGATraffic(const unsigned int grain, const unsigned int m, const unsigned int n, const unsigned int k,
+   double *abBytes, double *cBytes)
+{
+   const unsigned int chain = matmulChained(0, grain);
+   const double b2size = (double)BSIZE*BSIZE;
+   const double cblocks = (double)(m/BSIZE)*(n/BSIZE);
+   *abBytes = cblocks*(k/BSIZE)*2*b2size*sizeof(elem_t);
+   *cBytes = cblocks*(chain ? 1 : k/BSIZE)*2*b2size*sizeof(acc_t);
+}
+
+// Co-execution state. The C block rows are split between the FPGA, which gets
+// the first ones, and the SMP workers, which get the rest
+typedef struct {
+   double fpgaRate;          // Block rows per second of each part, 0 if unknown
+   double smpRate;
+   unsigned int fpgaRows;    // C block rows assigned to the FPGA in the last run
+   unsigned int rows;        // Total C block rows
+   double tStart;            // Start and completion times of each part in the last run
+   double tFPGA;
+   double tSMP;
+   unsigned int *fpgaBlocks; // C block sequences of each part
+   unsigned int *smpBlocks;
+} het_state_t;
+
+#pragma oss task in([(size_t)m*kdim]a, [(size_t)kdim*n]b) inout([(size_t)m*n]c)
+void matmulHetFPGAPart(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const order_t order, const unsigned int *blocks, double *tEnd)
+{
+   matmulFPGAEdges(a, b, c, m, n, kdim, order, blocks, 0);
+   #pragma oss taskwait
+   *tEnd = wall_time();
+}
+
+#pragma oss task in([(size_t)m*kdim]a, [(size_t)kdim*n]b) inout([(size_t)m*n]c)
+void matmulHetSMPPart(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const order_t order, const unsigned int *blocks, double *tEnd)
+{
+   matmulSMP(a, b, c, m, n, kdim, order, blocks, 1, 0);
+   #pragma oss taskwait
+   *tEnd = wall_time();
+}
+
+// Number of C block rows for the FPGA, in proportion to the measured rates.
+// Only full block rows can go to the FPGA
+unsigned int hetSplit(const het_state_t *het, const unsigned int m) {
+   const unsigned int fullRows = m/BSIZE;
+   unsigned int fpgaRows;
+   if (het->fpgaRate == 0 && het->smpRate == 0) {
+      fpgaRows = het->rows/2;
+   } else if (het->fpgaRate == 0) {
+      fpgaRows = 1;
+   } else if (het->smpRate == 0) {
+      fpgaRows = het->rows - 1;
+   } else {
+      fpgaRows = (unsigned int)(het->rows*het->fpgaRate/(het->fpgaRate + het->smpRate) + 0.5);
+   }
+   return fpgaRows < fullRows ? fpgaRows : fullRows;
+}
+
+void hetInit(het_state_t *het, const unsigned int m, const unsigned int n) {
+   het->fpgaRate = het->smpRate = 0;
+   het->rows = numBlocks(m);
+   het->fpgaRows = 0;
+   het->tStart = het->tFPGA = het->tSMP = 0;
+   het->fpgaBlocks = (unsigned int *)(malloc(((m/BSIZE)*(n/BSIZE) + 1)*sizeof(unsigned int)));
+   het->smpBlocks = (unsigned int *)(malloc((het->rows*numBlocks(n) + 1)*sizeof(unsigned int)));
+   if (het->fpgaBlocks == NULL || het->smpBlocks == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the co-execution\n");
+      exit(1);
+   }
+}
+
+void hetFini(het_state_t *het) {
+   free(het->fpgaBlocks);
+   free(het->smpBlocks);
+}
+
+// Creates both parts of a co-execution run. hetUpdate must be called once
+// they have finished
+void matmulHet(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int kdim,
+   const order_t order, het_state_t *het)
+{
+   const unsigned int r = hetSplit(het, m);
+   het->fpgaRows = r;
+   het->tStart = wall_time();
+   het->tFPGA = het->tSMP = het->tStart;
+   if (r > 0) {
+      blockOrder(order, r, n/BSIZE, het->fpgaBlocks);
+      matmulHetFPGAPart(a, b, c, r*BSIZE, n, kdim, order, het->fpgaBlocks, &het->tFPGA);
+   }
+   if (r < het->rows) {
+      blockOrder(order, het->rows - r, numBlocks(n), het->smpBlocks);
+      matmulHetSMPPart(a + (size_t)r*BSIZE*kdim, b, c + (size_t)r*BSIZE*n, m - r*BSIZE, n, kdim, order, het->smpBlocks, &het->tSMP);
+   }
+}
+
+// Refines the rates of each part with the last run. The first measure is
+// taken as is, the later ones are averaged with the current estimation
+void hetUpdate(het_state_t *het) {
+   const unsigned int smpRows = het->rows - het->fpgaRows;
+   if (het->fpgaRows > 0 && het->tFPGA > het->tStart) {
+      const double rate = het->fpgaRows/(het->tFPGA - het->tStart);
+      het->fpgaRate = het->fpgaRate == 0 ? rate : (het->fpgaRate + rate)/2;
+   }
+   if (smpRows > 0 && het->tSMP > het->tStart) {
+      const double rate = smpRows/(het->tSMP - het->tStart);
+      het->smpRate = het->smpRate == 0 ? rate : (het->smpRate + rate)/2;
+   }
+}
+
+// Statistics of the timed executions
+typedef struct {
+   double min, median, mean, stddev, p95;
+} rep_stats_t;
+
+static int cmpDouble(const void *x, const void *y) {
+   const double a = *(const double *)x, b = *(const double *)y;
+   return (a > b) - (a < b);
+}
+
+// Computes the statistics of the <n> values in <v>, which are sorted in place.
+// The percentile uses the nearest rank
+void repStats(double *v, const unsigned int n, rep_stats_t *stats) {
+   qsort(v, n, sizeof(double), cmpDouble);
+   double sum = 0, sq = 0;
+   for (unsigned int i = 0; i < n; ++i) sum += v[i];
+   stats->mean = sum/n;
+   for (unsigned int i = 0; i < n; ++i) sq += (v[i] - stats->mean)*(v[i] - stats->mean);
+   stats->stddev = n > 1 ? sqrt(sq/(n - 1)) : 0;
+   stats->min = v[0];
+   stats->median = n%2 ? v[n/2] : (v[n/2 - 1] + v[n/2])/2;
+   stats->p95 = v[(unsigned int)ceil(0.95*n) - 1];
+}
+
+// Parses a non-negative integer option value. Returns 0 on success
+int parseUInt(const char *str, unsigned int *val) {
+   char *end;
+   errno = 0;
+   const unsigned long long v = strtoull(str, &end, 10);
+   if (*end != '\0' || end == str || *str < '0' || *str > '9' || errno == ERANGE || v > UINT_MAX) return -1;
+   *val = v;
+   return 0;
+}
+
+// Parses a matrix size, <n> or <m>x<n>x<k>, into <dims>. The dimensions must
+// be positive and fit in 32 bits, and the block counts of each matrix in the
+// (32-bit) block indices; element offsets are 64-bit. Returns 0 on success
+int parseDims(const char *str, unsigned int dims[3]) {
+   unsigned int n = 0;
+   const char *p = str;
+   for (;;) {
+      char *end;
+      errno = 0;
+      const unsigned long long v = strtoull(p, &end, 10);
+      if (n == 3 || *p < '0' || *p > '9' || errno == ERANGE || v == 0 || v > UINT_MAX - BSIZE + 1) return -1;
+      dims[n++] = v;
+      if (*end == '\0') break;
+      if (*end != 'x') return -1;
+      p = end + 1;
+   }
+   if (n == 1) {
+      dims[1] = dims[2] = dims[0];
+   } else if (n != 3) {
+      return -1;
+   }
+   const unsigned long long mb = numBlocks(dims[0]), nb = numBlocks(dims[1]), kb = numBlocks(dims[2]);
+   return mb*kb <= UINT_MAX && kb*nb <= UINT_MAX && mb*nb <= UINT_MAX ? 0 : -1;
+}
+
+// Converts block (i,j) of a <rows>x<cols> matrix of <size> byte elements from
+// the external <layout> (with leading dimension <ld>) to the blocked layout
+#pragma oss task out([blockDim(rows, i)*blockDim(cols, j)*size]blk)
+void ingestBlock(const char *ext, const layout_t layout, const size_t ld, char *blk, const unsigned int rows,
+   const unsigned int cols, const unsigned int i, const unsigned int j, const size_t size)
+{
+   const unsigned int bm = blockDim(rows, i);
+   const unsigned int bn = blockDim(cols, j);
+   if (layout == LAYOUT_ROW) {
+      layoutCopy(ext + ((size_t)i*BSIZE*ld + j*BSIZE)*size, ld, blk, bn, bm, bn, size);
+   } else {
+      layoutTranspose(ext + ((size_t)j*BSIZE*ld + i*BSIZE)*size, ld, blk, bn, bm, bn, size);
+   }
+}
+
+// Converts block (i,j) of a <rows>x<cols> matrix of <size> byte elements from
+// the blocked layout to the external <layout>
+#pragma oss task in([blockDim(rows, i)*blockDim(cols, j)*size]blk)
+void egestBlock(const char *blk, char *ext, const layout_t layout, const size_t ld, const unsigned int rows,
+   const unsigned int cols, const unsigned int i, const unsigned int j, const size_t size)
+{
+   const unsigned int bm = blockDim(rows, i);
+   const unsigned int bn = blockDim(cols, j);
+   if (layout == LAYOUT_ROW) {
+      layoutCopy(blk, bn, ext + ((size_t)i*BSIZE*ld + j*BSIZE)*size, ld, bm, bn, size);
+   } else {
+      layoutTranspose(blk, bn, ext + ((size_t)j*BSIZE*ld + i*BSIZE)*size, ld, bn, bm, size);
+   }
+}
+
+// Leading dimension of a <rows>x<cols> matrix in the external <layout>
+size_t layoutLd(const layout_t layout, const unsigned int rows, const unsigned int cols) {
+   return layout == LAYOUT_ROW ? cols : rows;
+}
+
+// Creates the tasks converting the <rows>x<cols> matrix <ext>, of <size> byte
+// elements and leading dimension <ld>, to the blocked matrix <blocked>.
+// Nothing is done for blocked inputs
+void layoutIngest(const void *ext, const layout_t layout, const size_t ld, const unsigned int rows, const unsigned int cols,
+   void *blocked, const size_t size)
+{
+   if (layout == LAYOUT_BLOCKED) return;
+   for (unsigned int i = 0; i < numBlocks(rows); ++i) {
+      for (unsigned int j = 0; j < numBlocks(cols); ++j) {
+         ingestBlock((const char *)ext, layout, ld, (char *)blocked + (size_t)blockOffset(rows, cols, i, j)*size,
+            rows, cols, i, j, size);
+      }
+   }
+}
+
+// Creates the tasks converting the blocked <rows>x<cols> matrix <blocked> to <ext>
+void layoutEgest(const void *blocked, const unsigned int rows, const unsigned int cols, const layout_t layout,
+   const size_t ld, void *ext, const size_t size)
+{
+   if (layout == LAYOUT_BLOCKED) return;
+   for (unsigned int i = 0; i < numBlocks(rows); ++i) {
+      for (unsigned int j = 0; j < numBlocks(cols); ++j) {
+         egestBlock((const char *)blocked + (size_t)blockOffset(rows, cols, i, j)*size, (char *)ext, layout, ld,
+            rows, cols, i, j, size);
+      }
+   }
+}
+
+// Strassen-Winograd layer over the block tasks. Each recursion level splits
+// the full-block matrices in quadrants and computes their product with 7
+// quadrant products instead of 8. The quadrant sums run as SMP tasks, one per
+// quadrant block row, and the products of the last level are block tasks
+#define STRASSEN_MAX_LEVELS 8
+// Growth of the rounding error per recursion level (Winograd variant), and
+// scale of the error of the quadrant sums rounded to the elements type, see
+// strassenTolScale
+#ifndef STRASSEN_ERROR_GROWTH
+#  define STRASSEN_ERROR_GROWTH 3.0
+#endif
+#ifndef STRASSEN_SUMS_ERROR
+#  define STRASSEN_SUMS_ERROR 0.25
+#endif
+
+typedef struct {
+   unsigned int levels;
+   unsigned char createFrom;
+   order_t order;
+   unsigned int grain;
+   elem_t *sums[STRASSEN_MAX_LEVELS];   // S1..S4, X11, X12, X22, then T1..T4, Y11, Y21, Y22 of each level
+   acc_t *prods[STRASSEN_MAX_LEVELS];   // P1..P7 of each level
+   size_t sumsBytes[STRASSEN_MAX_LEVELS];
+   size_t prodsBytes[STRASSEN_MAX_LEVELS];
+   unsigned int *blocks;                // Sequence of C blocks of the last level products
+} strassen_state_t;
+
+// Recursion levels of a <m>x<n>x<k> product: the dimensions are halved while
+// all of them are larger than <cutoff> and split in full block quadrants
+unsigned int strassenLevels(unsigned int m, unsigned int n, unsigned int k, const unsigned int cutoff) {
+   unsigned int levels = 0;
+   while (cutoff > 0 && levels < STRASSEN_MAX_LEVELS && m > cutoff && n > cutoff && k > cutoff &&
+      m%(2*BSIZE) == 0 && n%(2*BSIZE) == 0 && k%(2*BSIZE) == 0)
+   {
+      m /= 2;
+      n /= 2;
+      k /= 2;
+      levels++;
+   }
+   return levels;
+}
+
+// Scale of the check tolerances of a product with <levels> recursion levels
+// over the ones of the classic product, which grow with sqrt(k+n) (see
+// matmulCheckFreivalds). The worst case bound grows by 18 per level, but the
+// measured errors grow by 1.6 to 2.5 per level (float and double, up to 6
+// levels at size 4096). The quadrant sums are also rounded to the elements
+// type, an error of about ELEM_T_EPSILON*|A_i|*|B_j| that does not grow with k
+// (measured up to 0.1 of it for half and bfloat16 at the first level)
+double strassenTolScale(const unsigned int levels, const unsigned int n, const unsigned int k) {
+   if (levels == 0) return 1;
+   return pow(STRASSEN_ERROR_GROWTH, levels)*
+      (1 + STRASSEN_SUMS_ERROR*ELEM_T_EPSILON/(ACC_T_EPSILON*sqrt(k + (double)n)));
+}
+
+// Block products (block tasks) of a product with <levels> recursion levels
+unsigned long long strassenBlockProducts(const unsigned int m, const unsigned int n, const unsigned int k,
+   const unsigned int levels)
+{
+   unsigned long long products = (unsigned long long)numBlocks(m >> levels)*numBlocks(n >> levels)*numBlocks(k >> levels);
+   for (unsigned int l = 0; l < levels; ++l) {
+      products *= 7;
+   }
+   return products;
+}
+
+void strassenInit(strassen_state_t *st, const unsigned int m, const unsigned int n, const unsigned int k,
+   const unsigned int levels, const unsigned char createFrom, const order_t order, const unsigned int grain)
+{
+   st->levels = levels;
+   st->createFrom = createFrom;
+   st->order = order;
+   st->grain = grain;
+   for (unsigned int l = 0; l < levels; ++l) {
+      const size_t mq = m >> (l + 1), nq = n >> (l + 1), kq = k >> (l + 1);
+      st->sumsBytes[l] = 7*(mq*kq + kq*nq)*sizeof(elem_t);
+      st->prodsBytes[l] = 7*mq*nq*sizeof(acc_t);
+      st->sums[l] = (elem_t *)memAlloc(st->sumsBytes[l]);
+      st->prods[l] = (acc_t *)memAlloc(st->prodsBytes[l]);
+      if (st->sums[l] == NULL || st->prods[l] == NULL) {
+         fprintf(stderr, "ERROR:\tCannot allocate memory for the Strassen temporaries\n");
+         exit(1);
+      }
+   }
+   const unsigned int rows = (m >> levels)/BSIZE, cols = (n >> levels)/BSIZE;
+   st->blocks = (unsigned int *)malloc(((size_t)rows*cols + 1)*sizeof(unsigned int));
+   if (st->blocks == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the Strassen temporaries\n");
+      exit(1);
+   }
+   blockOrder(order, rows, cols, st->blocks);
+}
+
+void strassenFini(strassen_state_t *st) {
+   for (unsigned int l = 0; l < st->levels; ++l) {
+      memFree(st->sums[l], st->sumsBytes[l]);
+      memFree(st->prods[l], st->prodsBytes[l]);
+   }
+   free(st->blocks);
+}
+
+// Sums of one block row of the X quadrants: S1 = X21 + X22, S2 = S1 - X11,
+// S3 = X11 - X21, S4 = X12 - S2, and the packed copies of X11, X12 and X22
+#pragma oss task in([len]x11, [len]x12, [len]x21, [len]x22) out([len]s1, [len]s2, [len]s3, [len]s4, [len]p11, [len]p12, [len]p22)
+void strassenSumsX(const elem_t *x11, const elem_t *x12, const elem_t *x21, const elem_t *x22, elem_t *s1, elem_t *s2,
+   elem_t *s3, elem_t *s4, elem_t *p11, elem_t *p12, elem_t *p22, const size_t len)
+{
+   for (size_t l = 0; l < len; ++l) {
+      const acc_t v1 = ELEM_ACC(x21[l]) + ELEM_ACC(x22[l]);
+      const acc_t v2 = v1 - ELEM_ACC(x11[l]);
+      s1[l] = ELEM_SET(v1);
+      s2[l] = ELEM_SET(v2);
+      s3[l] = ELEM_SET(ELEM_ACC(x11[l]) - ELEM_ACC(x21[l]));
+      s4[l] = ELEM_SET(ELEM_ACC(x12[l]) - v2);
+      p11[l] = x11[l];
+      p12[l] = x12[l];
+      p22[l] = x22[l];
+   }
+}
+
+// Sums of one block row of the Y quadrants: T1 = Y12 - Y11, T2 = Y22 - T1,
+// T3 = Y22 - Y12, T4 = T2 - Y21, and the packed copies of Y11, Y21 and Y22
+#pragma oss task in([len]y11, [len]y12, [len]y21, [len]y22) out([len]t1, [len]t2, [len]t3, [len]t4, [len]p11, [len]p21, [len]p22)
+void strassenSumsY(const elem_t *y11, const elem_t *y12, const elem_t *y21, const elem_t *y22, elem_t *t1, elem_t *t2,
+   elem_t *t3, elem_t *t4, elem_t *p11, elem_t *p21, elem_t *p22, const size_t len)
+{
+   for (size_t l = 0; l < len; ++l) {
+      const acc_t v1 = ELEM_ACC(y12[l]) - ELEM_ACC(y11[l]);
+      const acc_t v2 = ELEM_ACC(y22[l]) - v1;
+      t1[l] = ELEM_SET(v1);
+      t2[l] = ELEM_SET(v2);
+      t3[l] = ELEM_SET(ELEM_ACC(y22[l]) - ELEM_ACC(y12[l]));
+      t4[l] = ELEM_SET(v2 - ELEM_ACC(y21[l]));
+      p11[l] = y11[l];
+      p21[l] = y21[l];
+      p22[l] = y22[l];
+   }
+}
+
+// Accumulates the quadrant products in one block row of the Z quadrants:
+// Z11 += P1 + P2, Z12 += U4 + P3, Z21 += U3 - P4 and Z22 += U3 + P5, with
+// U2 = P1 + P6, U3 = U2 + P7 and U4 = U2 + P5
+#pragma oss task in([len]p1, [len]p2, [len]p3, [len]p4, [len]p5, [len]p6, [len]p7) inout([len]z11, [len]z12, [len]z21, [len]z22)
+void strassenCombine(const acc_t *p1, const acc_t *p2, const acc_t *p3, const acc_t *p4, const acc_t *p5, const acc_t *p6,
+   const acc_t *p7, acc_t *z11, acc_t *z12, acc_t *z21, acc_t *z22, const size_t len)
+{
+   for (size_t l = 0; l < len; ++l) {
+      const acc_t u2 = p1[l] + p6[l];
+      const acc_t u3 = u2 + p7[l];
+      z11[l] += p1[l] + p2[l];
+      z12[l] += u2 + p5[l] + p3[l];
+      z21[l] += u3 - p4[l];
+      z22[l] += u3 + p5[l];
+   }
+}
+
+#if defined(CHECK_FAULT)
+// Fault injection for the check regressions (scripts/checks.sh): undoes the
+// product of the first blocks of <a> and <b> in the first block of <c>, as if
+// that block task had been lost
+void checkFault(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n,
+   const unsigned int k)
+{
+   const unsigned int bm = blockDim(m, 0), bn = blockDim(n, 0), bk = blockDim(k, 0);
+   for (unsigned int i = 0; i < bm; ++i) {
+      for (unsigned int j = 0; j < bn; ++j) {
+         acc_t s = 0;
+         for (unsigned int l = 0; l < bk; ++l) {
+            s += ELEM_ACC(a[i*bk + l])*ELEM_ACC(b[l*bn + j]);
+         }
+         c[i*bn + j] -= s;
+      }
+   }
+}
+#endif
+
+// Accumulates the product of the <m>x<k> <x> and the <k>x<n> <y> in <z>, all
+// of them full-block matrices, from recursion level <level>, and waits for it
+void strassenMul(const strassen_state_t *st, const elem_t *x, const elem_t *y, acc_t *z, const unsigned int m,
+   const unsigned int n, const unsigned int k, const unsigned int level)
+{
+   const unsigned int mq = m/2, nq = n/2, kq = k/2;
+   const size_t xq = (size_t)mq*kq, yq = (size_t)kq*nq, zq = (size_t)mq*nq;
+   elem_t *const s = st->sums[level];
+   elem_t *const t = s + 7*xq;
+   acc_t *const p = st->prods[level];
+
+   //Quadrant sums and zeroed products
+   for (unsigned int i = 0; i < mq/BSIZE; ++i) {
+      const size_t len = (size_t)BSIZE*kq, r = i*len;
+      const elem_t *x11 = x + (size_t)i*BSIZE*k;
+      const elem_t *x21 = x11 + (size_t)mq*k;
+      strassenSumsX(x11, x11 + len, x21, x21 + len, s + r, s + xq + r, s + 2*xq + r, s + 3*xq + r,
+         s + 4*xq + r, s + 5*xq + r, s + 6*xq + r, len);
+   }
+   for (unsigned int i = 0; i < kq/BSIZE; ++i) {
+      const size_t len = (size_t)BSIZE*nq, r = i*len;
+      const elem_t *y11 = y + (size_t)i*BSIZE*n;
+      const elem_t *y21 = y11 + (size_t)kq*n;
+      strassenSumsY(y11, y11 + len, y21, y21 + len, t + r, t + yq + r, t + 2*yq + r, t + 3*yq + r,
+         t + 4*yq + r, t + 5*yq + r, t + 6*yq + r, len);
+   }
+   for (unsigned int i = 0; i < mq/BSIZE; ++i) {
+      for (unsigned int l = 0; l < 7; ++l) {
+         setBlock(p + l*zq + (size_t)i*BSIZE*nq, 0, BSIZE*nq);
+      }
+   }
+   #pragma oss taskwait
+
+   //P1 = X11*Y11, P2 = X12*Y21, P3 = S4*Y22, P4 = X22*T4, P5 = S1*T1, P6 = S2*T2, P7 = S3*T3.
+   //The last level products run concurrently, the inner levels one after the other to share their temporaries
+   const elem_t *const px[7] = { s + 4*xq, s + 5*xq, s + 3*xq, s + 6*xq, s, s + xq, s + 2*xq };
+   const elem_t *const py[7] = { t + 4*yq, t + 5*yq, t + 6*yq, t + 3*yq, t, t + yq, t + 2*yq };
+   for (unsigned int l = 0; l < 7; ++l) {
+      if (level + 1 < st->levels) {
+         strassenMul(st, px[l], py[l], p + l*zq, mq, nq, kq, level + 1);
+      } else if (st->createFrom == 0) {
+         matmulFPGAEdges(px[l], py[l], p + l*zq, mq, nq, kq, st->order, st->blocks, st->grain);
+      } else {
+         matmulSMP(px[l], py[l], p + l*zq, mq, nq, kq, st->order, st->blocks, 0, st->grain);
+      }
+   }
+   #pragma oss taskwait
+#if defined(CHECK_FAULT)
+   //Corrupts all the quadrants of C through P1
+   if (level == 0) {
+      checkFault(px[0], py[0], p, mq, nq, kq);
+   }
+#endif
+
+   for (unsigned int i = 0; i < mq/BSIZE; ++i) {
+      const size_t len = (size_t)BSIZE*nq, r = i*len;
+      acc_t *z11 = z + (size_t)i*BSIZE*n;
+      acc_t *z21 = z11 + (size_t)mq*n;
+      strassenCombine(p + r, p + zq + r, p + 2*zq + r, p + 3*zq + r, p + 4*zq + r, p + 5*zq + r, p + 6*zq + r,
+         z11, z11 + len, z21, z21 + len, len);
+   }
+   #pragma oss taskwait
+}
+
+// Runs one full product, C += A*B, and waits for it. With <strassen>, through
+// its recursion levels. <grain> selects k-chain tasks, see matmulSMP
+void matmulRun(const unsigned char createFrom, const elem_t *a, const elem_t *b, acc_t *c, const unsigned int msize,
+   const unsigned int nsize, const unsigned int ksize, const order_t order, const unsigned int *blocks, het_state_t *het,
+   const strassen_state_t *strassen, const unsigned int grain)
+{
+   if (strassen != NULL && strassen->levels > 0) {
+     strassenMul(strassen, a, b, c, msize, nsize, ksize, 0);
+   } else if (createFrom == 0) {
+     matmulFPGAEdges(a, b, c, msize, nsize, ksize, order, blocks, grain);
+   } else if (createFrom == 1) {
+     matmulSMP(a, b, c, msize, nsize, ksize, order, blocks, 0, grain);
+   } else if (createFrom == 2) {
+     matmulHet(a, b, c, msize, nsize, ksize, order, het);
+   }
+
+   //Noflush is not yet implemented
+   #pragma oss taskwait noflush([(size_t)msize*ksize]a, [(size_t)ksize*nsize]b, [(size_t)msize*nsize]c)
+   if (createFrom == 2) {
+      hetUpdate(het);
+   }
+#if defined(CHECK_FAULT)
+   if (strassen == NULL || strassen->levels == 0) {
+      checkFault(a, b, c, msize, nsize, ksize);
+   }
+#endif
+}
+
+// Library API, see matmul_gemm.h. Each C tile is computed by one k-chain task
+// reading op(A) and op(B) in place from the caller's matrices: matmulChain for
+// the full k steps of the full tiles when the bitstream has it, and
+// matmulTileHost for the rest. Without it, the full k steps of the full tiles
+// created from the FPGA run in matmulBlock tasks on blocked copies
+typedef struct {
+   unsigned int createFrom;
+   order_t order;
+   unsigned int *blocks;
+   size_t blocksLen;
+   elem_t *stageAB;          // Blocked copies of the full tiles of op(A) and op(B), for matmulBlock
+   acc_t *stageC;            // Blocked product of the full tiles
+   size_t stageABBytes, stageCBytes;
+} gemm_state_t;
+
+static gemm_state_t gemm = { 0, ORDER_DEFAULT, NULL, 0, NULL, NULL, 0, 0 };
+
+// Operands of one ompss_gemm call. The A row panel of tile row i starts at
+// a + i*aRow and its k-th tile aStep elements later, and likewise the B column
+// panel of tile column j at b + j*bCol
+typedef struct {
+   const elem_t *a, *b;
+   acc_t *c;
+   size_t aRow, aStep, bCol, bStep;
+   unsigned int lda, ldb, ldc, ta, tb;
+   unsigned int m, n, k;
+   acc_t alpha, beta;
+} gemm_args_t;
+
+#if defined(MATMUL_KCHAIN)
+// Creates from the FPGA the matmulChain tasks of the <tiles> full C tiles, in
+// the sequence given by <blocks> over the <cols> full tile columns, with the
+// operands of gemm_args_t. <aLen>, <bLen> and <cLen> are the spans of the matrices
+#pragma oss task device(fpga) in([aLen]a, [bLen]b, [tiles]blocks) inout([cLen]c)
+void gemmFPGA(const elem_t *a, const size_t aLen, const unsigned int lda, const unsigned int ta,
+   const elem_t *b, const size_t bLen, const unsigned int ldb, const unsigned int tb,
+   acc_t *c, const size_t cLen, const unsigned int ldc, const unsigned int kdim, const acc_t alpha, const acc_t beta,
+   const unsigned int *blocks, const unsigned int tiles, const unsigned int cols)
+{
+#pragma HLS inline
+   //Only the spans of the dependencies
+   (void)aLen;
+   (void)bLen;
+   (void)cLen;
+   const size_t aRow = ta ? BSIZE : (size_t)BSIZE*lda, aStep = ta ? (size_t)BSIZE*lda : BSIZE;
+   const size_t bCol = tb ? (size_t)BSIZE*ldb : BSIZE, bStep = tb ? BSIZE : (size_t)BSIZE*ldb;
+   for (unsigned int l = 0; l < tiles; l++) {
+      const unsigned int i = blocks[l]/cols;
+      const unsigned int j = blocks[l]%cols;
+      matmulChain(a + i*aRow, aStep, lda, ta, b + j*bCol, bStep, ldb, tb, c + (size_t)i*BSIZE*ldc + (size_t)j*BSIZE, ldc,
+         kdim, alpha, beta);
+   }
+}
+#endif
+
+#if !defined(MATMUL_KCHAIN)
+// Copies the <tiles> full tiles of a panel of op(A) or op(B), the l-th one at
+// src + l*step with rows <ld> elements apart, or transposed with <trans>, into
+// the consecutive blocks at <dst>. A and B are only read, so they are accessed
+// without dependency
+#pragma oss task out([(size_t)tiles*BSIZE*BSIZE]dst)
+void gemmPack(const elem_t *src, const size_t step, const unsigned int ld, const unsigned int trans, elem_t *dst,
+   const unsigned int tiles)
+{
+   for (unsigned int l = 0; l < tiles; ++l) {
+      matmulTileLoad(src + l*step, ld, trans, dst + (size_t)l*BSIZE*BSIZE, BSIZE, BSIZE);
+   }
+}
+
+// Writes the product block <acc> into the full C tile at <c>, whose rows are
+// <ldc> elements apart, as alpha*acc + beta*C
+#pragma oss task in([BSIZE*BSIZE]acc) inout(([BSIZE][ldc]c)[0;BSIZE][0;BSIZE])
+void gemmUnpack(const acc_t *acc, acc_t *c, const unsigned int ldc, const acc_t alpha, const acc_t beta) {
+   matmulTileStore(acc, c, ldc, alpha, beta, BSIZE, BSIZE);
+}
+
+// Grows the blocked copies of the full tiles to <abBytes> and <cBytes>.
+// Returns 0, or -1 if the memory cannot be allocated
+static int gemmStage(const size_t abBytes, const size_t cBytes) {
+   if (abBytes > gemm.stageABBytes) {
+      memFree(gemm.stageAB, gemm.stageABBytes);
+      gemm.stageAB = (elem_t *)memAlloc(abBytes);
+      gemm.stageABBytes = gemm.stageAB == NULL ? 0 : abBytes;
+   }
+   if (cBytes > gemm.stageCBytes) {
+      memFree(gemm.stageC, gemm.stageCBytes);
+      gemm.stageC = (acc_t *)memAlloc(cBytes);
+      gemm.stageCBytes = gemm.stageC == NULL ? 0 : cBytes;
+   }
+   return gemm.stageAB == NULL || gemm.stageC == NULL ? -1 : 0;
+}
+#endif
+
+// Creates the tasks of C tile (i,j). The full k steps of the full tiles run
+// in a matmulChain task, unless <chained> is set because they have already
+// been created from the FPGA, and the narrow k step or the whole chain of the
+// edge tiles in a matmulTileHost one
+static void gemmTile(const gemm_args_t *g, const unsigned int i, const unsigned int j, const unsigned int chained) {
+   const unsigned int bm = blockDim(g->m, i);
+   const unsigned int bn = blockDim(g->n, j);
+   const elem_t *a = g->a + i*g->aRow;
+   const elem_t *b = g->b + j*g->bCol;
+   acc_t *c = g->c + (size_t)i*BSIZE*g->ldc + (size_t)j*BSIZE;
+   unsigned int kb = 0;
+   acc_t beta = g->beta;
+   if (bm == BSIZE && bn == BSIZE && g->k >= BSIZE) {
+#if defined(MATMUL_KCHAIN)
+      if (!chained) {
+         TRACE_CREATE(TRACE_MATMUL_BLOCK, 2, i, j, 0);
+         matmulChain(a, g->aStep, g->lda, g->ta, b, g->bStep, g->ldb, g->tb, c, g->ldc, g->k - g->k%BSIZE, g->alpha, beta);
+      }
+      kb = g->k/BSIZE;
+      beta = 1;
+#else
+      if (chained) {
+         kb = g->k/BSIZE;
+         beta = 1;
+      }
+#endif
+   }
+   if (kb*BSIZE < g->k) {
+      TRACE_CREATE(TRACE_MATMUL_BLOCK, 2, i, j, kb);
+      matmulTileHost(a + kb*g->aStep, g->aStep, g->lda, g->ta, b + kb*g->bStep, g->bStep, g->ldb, g->tb, c, g->ldc,
+         bm, bn, g->k - kb*BSIZE, g->alpha, beta);
+   }
+}
+
+void ompss_gemm_set(const unsigned int createFrom, const unsigned int order) {
+   gemm.createFrom = createFrom <= 1 ? createFrom : 0;
+   gemm.order = order < ORDER_NUM ? (order_t)order : ORDER_DEFAULT;
+}
+
+int ompss_gemm(const char transA, const char transB, const unsigned int M, const unsigned int N, const unsigned int K,
+   const acc_t alpha, const elem_t *A, const unsigned int lda, const elem_t *B, const unsigned int ldb, const acc_t beta,
+   acc_t *C, const unsigned int ldc)
+{
+   const unsigned int ta = transA == 'T' || transA == 't' || transA == 'C' || transA == 'c';
+   const unsigned int tb = transB == 'T' || transB == 't' || transB == 'C' || transB == 'c';
+   if (!ta && transA != 'N' && transA != 'n') return 1;
+   if (!tb && transB != 'N' && transB != 'n') return 2;
+   if (lda < (ta ? M : K) || lda == 0) return 8;
+   if (ldb < (tb ? K : N) || ldb == 0) return 10;
+   if (ldc < N || ldc == 0) return 13;
+   if (M == 0 || N == 0) return 0;
+   if (K == 0 || alpha == 0) {
+      for (unsigned int i = 0; i < M; ++i) {
+         for (unsigned int j = 0; j < N; ++j) {
+            C[(size_t)i*ldc + j] = beta == 0 ? 0 : beta*C[(size_t)i*ldc + j];
+         }
+      }
+      return 0;
+   }
+
+   //First call
+   if (mem.numNodes == 0) {
+      memInit(MEM_HUGE_THP, MEM_NUMA_LOCAL);
+      smpKernelInit();
+   }
+   const size_t ntiles = (size_t)numBlocks(M)*numBlocks(N);
+#if defined(MATMUL_EMU)
+   if (emu.tableSize < 2*ntiles) {
+      emuFini();
+      emuInit(BSIZE, ntiles);
+   }
+   emuForget();
+#endif
+   if (ntiles + 1 > gemm.blocksLen) {
+      free(gemm.blocks);
+      gemm.blocks = (unsigned int *)(malloc((ntiles + 1)*sizeof(unsigned int)));
+      gemm.blocksLen = gemm.blocks == NULL ? 0 : ntiles + 1;
+   }
+   if (gemm.blocks == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the block sequence\n");
+      return -1;
+   }
+
+   //A transposed row-major matrix is read by columns, its tiles are then one
+   //below the other along k and next to each other along M, and likewise for B
+   gemm_args_t g;
+   g.a = A;
+   g.b = B;
+   g.c = C;
+   g.aRow = ta ? BSIZE : (size_t)BSIZE*lda;
+   g.aStep = ta ? (size_t)BSIZE*lda : BSIZE;
+   g.bCol = tb ? (size_t)BSIZE*ldb : BSIZE;
+   g.bStep = tb ? BSIZE : (size_t)BSIZE*ldb;
+   g.lda = lda;
+   g.ldb = ldb;
+   g.ldc = ldc;
+   g.ta = ta;
+   g.tb = tb;
+   g.m = M;
+   g.n = N;
+   g.k = K;
+   g.alpha = alpha;
+   g.beta = beta;
+
+   //Created from the FPGA, the full tiles are sequenced there and the rest of
+   //the tiles from SMP
+   const unsigned int chained = gemm.createFrom == 0 && M >= BSIZE && N >= BSIZE && K >= BSIZE;
+#if defined(MATMUL_KCHAIN)
+   if (chained) {
+      //C edge tiles are disjoint from the full ones updated by gemmFPGA
+      for (unsigned int i = 0; i < numBlocks(M); ++i) {
+         for (unsigned int j = 0; j < numBlocks(N); ++j) {
+            if (blockDim(M, i) < BSIZE || blockDim(N, j) < BSIZE) gemmTile(&g, i, j, 1);
+         }
+      }
+      blockOrder(gemm.order, M/BSIZE, N/BSIZE, gemm.blocks);
+      gemmFPGA(A, (size_t)((ta ? K : M) - 1)*lda + (ta ? M : K), lda, ta, B, (size_t)((tb ? N : K) - 1)*ldb + (tb ? K : N),
+         ldb, tb, C, (size_t)(M - 1)*ldc + N, ldc, K - K%BSIZE, alpha, beta, gemm.blocks, (M/BSIZE)*(N/BSIZE), N/BSIZE);
+      //The narrow k steps of the full tiles must not overlap with their chains,
+      //and the dependence of gemmFPGA only matches the first tile
+      if (K%BSIZE != 0) {
+         #pragma oss taskwait
+         for (unsigned int i = 0; i < M/BSIZE; ++i) {
+            for (unsigned int j = 0; j < N/BSIZE; ++j) {
+               gemmTile(&g, i, j, 1);
+            }
+         }
+      }
+   }
+#else
+   if (chained) {
+      //The matmulBlock accelerator only moves contiguous blocks: the full tiles
+      //of op(A) and op(B) are copied into blocked matrices, multiplied by the
+      //matmulBlock tasks of matmulFPGA, and the product is written into C
+      const unsigned int mb = M/BSIZE, nb = N/BSIZE, kb = K/BSIZE;
+      const size_t b2size = BSIZE*BSIZE;
+      if (gemmStage(((size_t)mb + nb)*kb*b2size*sizeof(elem_t), (size_t)mb*nb*b2size*sizeof(acc_t)) != 0) {
+         fprintf(stderr, "ERROR:\tCannot allocate memory for the blocked copies\n");
+         return -1;
+      }
+      elem_t *a = gemm.stageAB, *b = a + (size_t)mb*kb*b2size;
+      acc_t *c = gemm.stageC;
+      for (unsigned int i = 0; i < mb; ++i) {
+         gemmPack(A + i*g.aRow, g.aStep, lda, ta, a + (size_t)i*kb*b2size, kb);
+         setBlock(c + (size_t)i*nb*b2size, 0, nb*b2size);
+      }
+      for (unsigned int l = 0; l < kb; ++l) {
+         gemmPack(B + l*g.bStep, g.bCol, ldb, tb, b + (size_t)l*nb*b2size, nb);
+      }
+      //The dependences of matmulFPGA only match the first blocks of the copies
+      #pragma oss taskwait
+      //C edge tiles are disjoint from the full ones
+      for (unsigned int i = 0; i < numBlocks(M); ++i) {
+         for (unsigned int j = 0; j < numBlocks(N); ++j) {
+            if (blockDim(M, i) < BSIZE || blockDim(N, j) < BSIZE) gemmTile(&g, i, j, 1);
+         }
+      }
+      blockOrder(gemm.order, mb, nb, gemm.blocks);
+      matmulFPGA(a, b, c, mb*BSIZE, nb*BSIZE, kb*BSIZE, gemm.blocks, gemm.order == ORDER_KIJ, 0, affFirst(mb*nb, kb));
+      #pragma oss taskwait
+      for (unsigned int i = 0; i < mb; ++i) {
+         for (unsigned int j = 0; j < nb; ++j) {
+            gemmUnpack(c + (size_t)(i*nb + j)*b2size, C + (size_t)i*BSIZE*ldc + (size_t)j*BSIZE, ldc, alpha, beta);
+            gemmTile(&g, i, j, 1);
+         }
+      }
+   }
+#endif
+   if (!chained) {
+      blockOrder(gemm.order, numBlocks(M), numBlocks(N), gemm.blocks);
+      for (size_t l = 0; l < ntiles; ++l) {
+         gemmTile(&g, gemm.blocks[l]/numBlocks(N), gemm.blocks[l]%numBlocks(N), 0);
+      }
+   }
+   #pragma oss taskwait
+   return 0;
+}
+
+void ompss_gemm_fini() {
+   free(gemm.blocks);
+   gemm.blocks = NULL;
+   gemm.blocksLen = 0;
+   memFree(gemm.stageAB, gemm.stageABBytes);
+   memFree(gemm.stageC, gemm.stageCBytes);
+   gemm.stageAB = NULL;
+   gemm.stageC = NULL;
+   gemm.stageABBytes = gemm.stageCBytes = 0;
+   smpFreeBuffers();
+}
+
+#if !defined(MATMUL_LIB)
+// Parameters of one benchmark configuration
+typedef struct {
+   unsigned int msize, nsize, ksize;
+   unsigned int check;
+   unsigned int createFrom;
+   order_t order;
+   layout_t layout;
+   unsigned int warmup;
+   unsigned int minReps;
+   double minTime;
+   unsigned int api;         // Products run through ompss_gemm on the external layout matrices (not blocked)
+   unsigned int strassenCutoff; // Strassen-Winograd recursion while all dimensions are larger, 0 to disable it
+   unsigned int grain;       // C blocks per k-chain task, 0 for one task per block product
+   const char *oocDir;       // Directory of the matrix files of the out-of-core products, NULL in memory
+   size_t oocWindow;         // Bytes of the matrices in memory when out of core
+   unsigned int gen;         // Input generator (REF_GEN_*)
+   const char *inputDir;     // Directory of the A and B input files (REF_GEN_FILE), mapped instead of generated
+} bench_config_t;
+
+// Buffers shared by all the configurations of a sweep, sized for the largest one
+typedef struct {
+   elem_t *a, *b;
+   acc_t *c;
+   size_t aBytes, bBytes, cBytes;
+   elem_t *extA, *extB;         // External layout matrices, only when converting
+   acc_t *extC;
+   unsigned int *blocks;
+   double *repTimes;
+   unsigned int repsCap;
+   const smp_kernel_t *smpKernel;
+   double smpGflopsNaive, smpGflopsKernel;
+} bench_pool_t;
+
+// Runs one product through the library API on the external layout matrices.
+// A column-major product is computed as the row-major C^T = B^T*A^T
+void matmulApiRun(const bench_config_t *cfg, const bench_pool_t *pool) {
+   unsigned int const msize = cfg->msize, nsize = cfg->nsize, ksize = cfg->ksize;
+   if (cfg->layout == LAYOUT_ROW) {
+      ompss_gemm('N', 'N', msize, nsize, ksize, 1, pool->extA, ksize, pool->extB, nsize, 1, pool->extC, nsize);
+   } else {
+      ompss_gemm('N', 'N', nsize, msize, ksize, 1, pool->extB, ksize, pool->extA, msize, 1, pool->extC, msize);
+   }
+}
+
+// Runs and reports the configuration <cfg> with the buffers in <pool>, writing
+// its results as one JSON object into <res_file>. Returns the check result
+unsigned int matmulBench(const bench_config_t *cfg, bench_pool_t *pool, FILE *res_file) {
+   unsigned int const msize = cfg->msize, nsize = cfg->nsize, ksize = cfg->ksize;
+   unsigned int const check = cfg->check, createFrom = cfg->createFrom;
+   unsigned int const warmup = cfg->warmup, minReps = cfg->minReps;
+   double const minTime = cfg->minTime;
+   order_t const order = cfg->order;
+   layout_t const layout = cfg->layout;
+   size_t const asize = (size_t)msize*ksize;
+   size_t const bsize = (size_t)ksize*nsize;
+   size_t const m2size = (size_t)msize*nsize;
+   char const * createFromStr = createFrom == 0 ? "cFPGA" : (createFrom == 1 ? "cHOST" : "cHET");
+   char dimsStr[48];
+   dimsString(dimsStr, msize, nsize, ksize);
+   //Input files are mapped in place of the generated A and B
+   char aName[96], bName[96];
+   unsigned int const mapped = cfg->inputDir != NULL;
+   elem_t* const a = mapped ? (elem_t *)oocMapInput(cfg->inputDir, matrixFileName(aName, dimsStr, cfg->gen, 'A'),
+      asize*sizeof(elem_t)) : pool->a;
+   elem_t* const b = mapped ? (elem_t *)oocMapInput(cfg->inputDir, matrixFileName(bName, dimsStr, cfg->gen, 'B'),
+      bsize*sizeof(elem_t)) : pool->b;
+   acc_t* const c = pool->c;
+   unsigned int* const blocks = pool->blocks;
+   const smp_kernel_t *smpKernel = pool->smpKernel;
+   double const smpGflopsNaive = pool->smpGflopsNaive, smpGflopsKernel = pool->smpGflopsKernel;
+
+   //Sequence of C blocks, only the interior ones when created from FPGA
+   unsigned int const orderRows = createFrom == 0 ? msize/BSIZE : numBlocks(msize);
+   unsigned int const orderCols = createFrom == 0 ? nsize/BSIZE : numBlocks(nsize);
+   het_state_t het;
+   blockOrder(order, orderRows, orderCols, blocks);
+   TRACE_MATRICES(a, b, c, msize, nsize, ksize);
+   //Pages are placed before being touched by the initialization tasks. B is used by all block rows.
+   //Mapped inputs are placed by the page cache
+   if (!mapped) {
+      memPlace(a, numBlocks(msize), (size_t)BSIZE*ksize*sizeof(elem_t), (size_t)msize*ksize*sizeof(elem_t), 0);
+      memPlace(b, numBlocks(ksize), (size_t)BSIZE*nsize*sizeof(elem_t), (size_t)ksize*nsize*sizeof(elem_t), 1);
+   }
+   memPlace(c, numBlocks(msize), (size_t)BSIZE*nsize*sizeof(acc_t), (size_t)m2size*sizeof(acc_t), 0);
+   if (createFrom == 2) {
+      hetInit(&het, msize, nsize);
+   }
+   //Strassen-Winograd recursion, none if the dimensions cannot be split in full block quadrants
+   strassen_state_t strassen;
+   strassen.levels = strassenLevels(msize, nsize, ksize, cfg->strassenCutoff);
+   if (strassen.levels > 0) {
+      strassenInit(&strassen, msize, nsize, ksize, strassen.levels, createFrom, order, cfg->grain);
+   }
+
+   double tIniStart = wall_time();
+
+   //Blocks are initialized in row-major order, interleaving the three matrices
+   srand(2019);
+   unsigned int const ablocks = mapped ? 0 : numBlocks(msize)*numBlocks(ksize);
+   unsigned int const bblocks = mapped ? 0 : numBlocks(ksize)*numBlocks(nsize);
+   unsigned int const cblocks = numBlocks(msize)*numBlocks(nsize);
+   for (unsigned int l = 0; l < ablocks || l < bblocks || l < cblocks; l++) {
+      if (l < ablocks) {
+         unsigned int const i = l/numBlocks(ksize), j = l%numBlocks(ksize);
+         TRACE_CREATE(TRACE_SET_BLOCK, 0, i, j, 0);
+         genBlock(&a[blockOffset(msize, ksize, i, j)], cfg->gen, rand(), 0, msize, ksize, i, j);
+      }
+      if (l < bblocks) {
+         unsigned int const i = l/numBlocks(nsize), j = l%numBlocks(nsize);
+         TRACE_CREATE(TRACE_SET_BLOCK, 1, i, j, 0);
+         genBlock(&b[blockOffset(ksize, nsize, i, j)], cfg->gen, rand(), 1, ksize, nsize, i, j);
+      }
+      if (l < cblocks) {
+         unsigned int const i = l/numBlocks(nsize), j = l%numBlocks(nsize);
+         setBlock(&c[blockOffset(msize, nsize, i, j)], 0, blockDim(msize, i)*blockDim(nsize, j));
+      }
+   }
+
+   #pragma oss taskwait
+   const double tEndStart = wall_time();
+
+   //The generated inputs are stored in the external layout (not timed), which
+   //is multiplied in place through the library API, as a client would do, and
+   //converted back to the blocked A and B only for the checks
+   layoutEgest(a, msize, ksize, layout, layoutLd(layout, msize, ksize), pool->extA, sizeof(elem_t));
+   layoutEgest(b, ksize, nsize, layout, layoutLd(layout, ksize, nsize), pool->extB, sizeof(elem_t));
+   if (cfg->api) {
+      memset(pool->extC, 0, (size_t)m2size*sizeof(acc_t));
+      ompss_gemm_set(createFrom, order);
+   }
+   #pragma oss taskwait
+   const double tIniIngest = wall_time();
+   layoutIngest(pool->extA, layout, layoutLd(layout, msize, ksize), msize, ksize, a, sizeof(elem_t));
+   layoutIngest(pool->extB, layout, layoutLd(layout, ksize, nsize), ksize, nsize, b, sizeof(elem_t));
+   #pragma oss taskwait
+   const double tEndIngest = wall_time();
+   const double tIniWarm = tEndIngest;
+
+   //Warm up executions
+   for (unsigned int r = 0; r < warmup; ++r) {
+      if (cfg->api) {
+         matmulApiRun(cfg, pool);
+      } else {
+         matmulRun(createFrom, a, b, c, msize, nsize, ksize, order, blocks, &het, &strassen, cfg->grain);
+      }
+   }
+   const double tEndWarm = wall_time();
+   const double tIniExec = tEndWarm;
+
+   //Performance executions
+   mem_counters_t memCounters;
+   memCountersStart();
+   unsigned int reps = 0;
+   double tExecSum = 0;
+   while (reps < minReps || tExecSum < minTime) {
+      if (reps == pool->repsCap) {
+         pool->repsCap *= 2;
+         pool->repTimes = (double *)(realloc(pool->repTimes, pool->repsCap*sizeof(double)));
+         if (pool->repTimes == NULL) {
+            fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+            exit(1);
+         }
+      }
+#if defined(MATMUL_EMU)
+      emuReset();
+#endif
+      const double tRep = wall_time();
+      if (cfg->api) {
+         matmulApiRun(cfg, pool);
+      } else {
+         matmulRun(createFrom, a, b, c, msize, nsize, ksize, order, blocks, &het, &strassen, cfg->grain);
+      }
+      pool->repTimes[reps] = wall_time() - tRep;
+      tExecSum += pool->repTimes[reps++];
+   }
+   memCountersStop(&memCounters);
+   if (createFrom == 2) {
+      hetFini(&het);
+   }
+   if (strassen.levels > 0) {
+      strassenFini(&strassen);
+   }
+   const double tEndExec = wall_time();
+   const double tIniFlush = tEndExec;
+
+   //This would be needed in case of using noflush
+   //flushData(c, m2size);
+   //#pragma oss taskwait
+   const double tEndFlush = wall_time();
+   const double tIniEgest = tEndFlush;
+
+   //The result of the API is converted to the blocked C to be checked
+   layoutIngest(pool->extC, layout, layoutLd(layout, msize, nsize), msize, nsize, c, sizeof(acc_t));
+   #pragma oss taskwait
+   const double tEndEgest = wall_time();
+   const double tIniCheck = tEndEgest;
+
+   //Check the output matrix
+   check_stats_t checkStats;
+   const double tolScale = strassenTolScale(strassen.levels, nsize, ksize);
+   unsigned int check_ok = matmulCheck(check, a, b, c, msize, nsize, ksize, warmup + reps, cfg->gen, tolScale, &checkStats);
+#if defined(MATMUL_CORE_SYSTOLIC) && defined(MATMUL_EMU)
+   if (emu.coreMismatches > 0) {
+      printf( "Systolic core differs from the flat core in %llu elements\n", (unsigned long long)emu.coreMismatches );
+      check_ok = 0;
+   }
+#endif
+
+   const double tEndCheck = wall_time();
+
+   //Statistics of the timed executions, GFLOPS of each one computed before sorting the times
+   rep_stats_t timeStats, gflopsStats;
+   double* repGflops = (double *)(malloc(reps*sizeof(double)));
+   if (repGflops == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+      exit(1);
+   }
+   for (unsigned int r = 0; r < reps; ++r) {
+      repGflops[r] = m2size/1000.0*ksize/1000.0*2.0/1000.0/pool->repTimes[r];
+   }
+   repStats(repGflops, reps, &gflopsStats);
+   repStats(pool->repTimes, reps, &timeStats);
+   free(repGflops);
+
+   //Placement of the matrices
+   size_t pagesPerNode[MEM_MAX_NODES] = { 0 };
+   const size_t matBytes = ((size_t)msize*ksize + (size_t)ksize*nsize)*sizeof(elem_t) + (size_t)m2size*sizeof(acc_t);
+   size_t pagesFound = memPagesPerNode(a, (size_t)msize*ksize*sizeof(elem_t), pagesPerNode);
+   pagesFound += memPagesPerNode(b, (size_t)ksize*nsize*sizeof(elem_t), pagesPerNode);
+   pagesFound += memPagesPerNode(c, (size_t)m2size*sizeof(acc_t), pagesPerNode);
+   const size_t hugeBytes = memHugeBytes(a, (size_t)msize*ksize*sizeof(elem_t)) +
+      memHugeBytes(b, (size_t)ksize*nsize*sizeof(elem_t)) + memHugeBytes(c, (size_t)m2size*sizeof(acc_t));
+
+   //Block product tasks created by each run, at the last Strassen level if any
+   unsigned long long tasks = matmulTaskCount(createFrom, cfg->grain, msize >> strassen.levels, nsize >> strassen.levels,
+      ksize >> strassen.levels);
+   //Accelerator memory traffic of each run, for the interior C blocks
+   double fpgaAB, fpgaC;
+   matmulFPGATraffic(cfg->grain, msize >> strassen.levels, nsize >> strassen.levels, ksize >> strassen.levels, &fpgaAB, &fpgaC);
+   for (unsigned int l = 0; l < strassen.levels; ++l) {
+      tasks *= 7;
+      fpgaAB *= 7;
+      fpgaC *= 7;
+   }
+
+   //Print the execution report
+   const double gflops = gflopsStats.median;
+   printf( "==================== RESULTS ===================== \n" );
+   printf( "  Benchmark: %s (%s)\n", "Matmul", "OmpSs" );
+   printf( "  Elements type: %s\n", ELEM_T_STR );
+   printf( "  Matrix size: %s\n", dimsStr );
+   printf( "  Create from: %s\n", createFromStr );
+   printf( "  Inputs:                %s\n", REF_GEN_STR[cfg->gen] );
+   printf( "  Affinity:              %s\n", AFF_STR[aff.policy] );
+   printf( "  Block order: %s\n", ORDER_STR[order] );
+   printf( "  FPGA kernel:           %s\n", MATMUL_KERNEL_STR );
+   printf( "  FPGA core:             %s (%u MAC units)\n", MATMUL_CORE_STR, MATMUL_CORE_UNITS );
+#if defined(MATMUL_CORE_SYSTOLIC)
+   printf( "  PE array:              %ux%u, fill and drain bound utilization %f\n", MATMUL_PE_ROWS, MATMUL_PE_COLS,
+      matmulCoreFillUtilization() );
+#endif
+   printf( "  Task granularity:      %s\n", matmulChained(createFrom, cfg->grain) ? "k-chains" : "block products" );
+   if (matmulChained(createFrom, cfg->grain)) {
+      printf( "  C blocks per task:     %u\n", createFrom == 0 ? 1 : cfg->grain );
+   }
+   printf( "  Tasks per run:         %llu\n", tasks );
+   printf( "  Task rate (tasks/s):   %f\n", tasks/timeStats.median );
+   if (createFrom == 0) {
+      printf( "  FPGA traffic (MiB):    %f (A and B %f, C %f)\n", (fpgaAB + fpgaC)/1048576.0, fpgaAB/1048576.0,
+         fpgaC/1048576.0 );
+   }
+   if (createFrom == 2) {
+      printf( "  FPGA block rows:       %u of %u\n", het.fpgaRows, het.rows );
+      printf( "  FPGA part time (secs): %f\n", het.tFPGA - het.tStart );
+      printf( "  SMP part time (secs):  %f\n", het.tSMP - het.tStart );
+   }
+   printf( "  Init. time (secs):     %f\n", tEndStart  - tIniStart );
+   printf( "  Input layout:          %s\n", LAYOUT_STR[layout] );
+   printf( "  Library API:           %s\n", cfg->api ? "ompss_gemm" : "no" );
+   if (cfg->strassenCutoff > 0) {
+      printf( "  Strassen levels:       %u (cutoff %u)\n", strassen.levels, cfg->strassenCutoff );
+      printf( "  Block products:        %llu (classic %llu)\n",
+         strassenBlockProducts(msize, nsize, ksize, strassen.levels), strassenBlockProducts(msize, nsize, ksize, 0) );
+      printf( "  Error bound growth:    %.0f\n", tolScale );
+   }
+   if (layout != LAYOUT_BLOCKED) {
+      printf( "  Ingest time (secs):    %f (%f GB/s)\n", tEndIngest - tIniIngest,
+         2.0*(asize + bsize)*sizeof(elem_t)/1e9/(tEndIngest - tIniIngest) );
+      printf( "  Egest time (secs):     %f (%f GB/s)\n", tEndEgest - tIniEgest,
+         2.0*m2size*sizeof(acc_t)/1e9/(tEndEgest - tIniEgest) );
+   }
+   printf( "  Warm up runs:          %u\n", warmup );
+   printf( "  Warm up time (secs):   %f\n", tEndWarm   - tIniWarm );
+   printf( "  Timed runs:            %u\n", reps );
+   printf( "  Exec. total (secs):    %f\n", tEndExec   - tIniExec );
+   printf( "  Execution time (secs): %f\n", timeStats.median );
+   printf( "  Flush time (secs):     %f\n", tEndFlush  - tIniFlush );
+   printf( "  Checking time (secs):  %f\n", tEndCheck  - tIniCheck );
+   printf( "  Performance (GFLOPS):  %f\n", gflops );
+   printf( "  Timed runs     Time (secs)     GFLOPS\n" );
+   printf( "    min          %-15f %f\n", timeStats.min, gflopsStats.min );
+   printf( "    median       %-15f %f\n", timeStats.median, gflopsStats.median );
+   printf( "    mean         %-15f %f\n", timeStats.mean, gflopsStats.mean );
+   printf( "    stddev       %-15f %f\n", timeStats.stddev, gflopsStats.stddev );
+   printf( "    p95          %-15f %f\n", timeStats.p95, gflopsStats.p95 );
+   printf( "  SMP block kernel:      %s %f GFLOPS (naive %f GFLOPS)\n", smpKernel->name, smpGflopsKernel, smpGflopsNaive );
+   printf( "  Memory:                %s huge pages%s, %s NUMA policy%s\n", MEM_HUGE_STR[mem.huge],
+      mem.hugeFallback ? " (explicit not available, thp used)" : "", MEM_NUMA_STR[mem.numa],
+      mem.mbindFailed ? " (not supported)" : "" );
+   printf( "  Huge pages:            backed %.1f MiB / requested %.1f MiB\n", hugeBytes/1048576.0, matBytes/1048576.0 );
+   printf( "  Pages per node:       " );
+   for (unsigned int n = 0; n < mem.numNodes; ++n) {
+      printf( " %u:%.1f%%", mem.nodes[n], pagesFound > 0 ? 100.0*pagesPerNode[n]/pagesFound : 0 );
+   }
+   printf( "\n" );
+   if (memCounters.valid) {
+      printf( "  dTLB load misses:      %llu\n", (unsigned long long)memCounters.dtlbMisses );
+   }
+   if (memCounters.nodeValid) {
+      printf( "  Remote node loads:     %llu\n", (unsigned long long)memCounters.nodeMisses );
+   }
+#if defined(MATMUL_EMU)
+   emuReport(m2size*2.0*ksize);
+#endif
+   printf( "================================================== \n" );
+
+   fprintf(res_file,
+      "{ \
+         \"benchmark\": \"%s\", \
+         \"toolchain\": \"%s\", \
+         \"board\": \"%s\", \
+         \"version\": \"%uaccs %uBS kij memport_128 noflush\", \
+         \"exectype\": \"%s\", \
+         \"argv\": \"%s %d %s\", \
+         \"order\": \"%s\", \
+         \"warmup\": \"%u\", \
+         \"reps\": \"%u\", \
+         \"exectime\": \"%f\", \
+         \"performance\": \"%f\", \
+         \"exectime_min\": \"%f\", \"exectime_median\": \"%f\", \"exectime_mean\": \"%f\", \"exectime_stddev\": \"%f\", \"exectime_p95\": \"%f\", \
+         \"performance_min\": \"%f\", \"performance_median\": \"%f\", \"performance_mean\": \"%f\", \"performance_stddev\": \"%f\", \"performance_p95\": \"%f\", \
+         \"smp_kernel\": \"%s %f naive %f\", \
+         \"layout\": \"%s\", \
+         \"api\": \"%u\", \
+         \"kernel\": \"%s\", \"grain\": \"%u\", \"tasks\": \"%llu\", \
+         \"core\": \"%s\", \"core_units\": \"%u\", \"pe_fill_utilization\": \"%f\", \
+         \"fpga_traffic_ab\": \"%.0f\", \"fpga_traffic_c\": \"%.0f\", \
+         \"strassen_levels\": \"%u\", \"block_products\": \"%llu\", \"error_bound_ratio\": \"%f\", \
+         \"ingest_time\": \"%f\", \"ingest_bandwidth\": \"%f\", \"egest_time\": \"%f\", \"egest_bandwidth\": \"%f\", \
+         \"note\": \"datatype %s, init %f, convert %f, warm %f, exec %f, flush %f, check %f\"",
+      "matmul",
+      "ompss-2",
+      BOARD,
+      MBLOCK_NUM_ACCS, BSIZE,
+      RUNTIME_MODE,
+      dimsStr, BSIZE, createFromStr,
+      ORDER_STR[order],
+      warmup,
+      reps,
+      timeStats.median,
+      gflops,
+      timeStats.min, timeStats.median, timeStats.mean, timeStats.stddev, timeStats.p95,
+      gflopsStats.min, gflopsStats.median, gflopsStats.mean, gflopsStats.stddev, gflopsStats.p95,
+      smpKernel->name, smpGflopsKernel, smpGflopsNaive,
+      LAYOUT_STR[layout],
+      cfg->api,
+      MATMUL_KERNEL_STR, cfg->grain, tasks,
+      MATMUL_CORE_STR, MATMUL_CORE_UNITS, matmulCoreFillUtilization(),
+      createFrom == 0 ? fpgaAB : 0, createFrom == 0 ? fpgaC : 0,
+      strassen.levels, strassenBlockProducts(msize, nsize, ksize, strassen.levels), checkStats.boundRatio,
+      tEndIngest - tIniIngest,
+      layout != LAYOUT_BLOCKED ? 2.0*(asize + bsize)*sizeof(elem_t)/1e9/(tEndIngest - tIniIngest) : 0,
+      tEndEgest - tIniEgest,
+      layout != LAYOUT_BLOCKED ? 2.0*m2size*sizeof(acc_t)/1e9/(tEndEgest - tIniEgest) : 0,
+      ELEM_T_STR,
+      tEndStart - tIniStart,
+      (tEndIngest - tIniIngest) + (tEndEgest - tIniEgest),
+      tEndWarm - tIniWarm,
+      timeStats.median,
+      tEndFlush - tIniFlush,
+      tEndCheck - tIniCheck
+   );
+#if defined(MATMUL_EMU)
+   fprintf(res_file,
+      ", \"emu_task_cycles\": \"%llu\", \"emu_exectime\": \"%f\", \"emu_performance\": \"%f\", \"emu_traffic_ab\": \"%llu\", \"emu_traffic_c\": \"%llu\", \"emu_c_transfers\": \"%llu\", \"emu_c_avoided\": \"%llu\", \"emu_pe_utilization\": \"%f\", \"emu_core_mismatches\": \"%llu\"",
+      (unsigned long long)emu.task.total,
+      emuSeconds(emu.makespan),
+      m2size*2.0*ksize/1e9/emuSeconds(emu.makespan),
+      (unsigned long long)emu.bytesAB, (unsigned long long)emu.bytesC,
+      (unsigned long long)emu.cTransfers, (unsigned long long)emu.cAvoided,
+      emuCoreUtilization(), (unsigned long long)emu.coreMismatches
+   );
+#endif
+   if (check == 1 || check == 3 || check == 4) {
+      fprintf(res_file,
+         ", \"check_max_abs_err\": \"%e\", \"check_max_rel_err\": \"%e\", \"check_max_ulp\": \"%llu\", \"check_mismatches\": \"%llu\", \"check_checksum_blocks\": \"%llu\", \"check_mismatch_coords\": [",
+         checkStats.maxAbsErr, checkStats.maxRelErr, checkStats.maxUlp, checkStats.mismatches, checkStats.checksumBlocks
+      );
+      for (unsigned int i = 0; i < checkStats.numCoords; ++i) {
+         fprintf(res_file, "%s[%u, %u]", i == 0 ? "" : ", ", checkStats.coords[i][0], checkStats.coords[i][1]);
+      }
+      fprintf(res_file, "]");
+   }
+   fprintf(res_file,
+      ", \"mem_huge\": \"%s\", \"mem_numa\": \"%s\", \"mem_huge_bytes\": \"%zu\", \"mem_pages_per_node\": [",
+      mem.hugeFallback ? MEM_HUGE_STR[MEM_HUGE_THP] : MEM_HUGE_STR[mem.huge], MEM_NUMA_STR[mem.numa], hugeBytes
+   );
+   for (unsigned int n = 0; n < mem.numNodes; ++n) {
+      fprintf(res_file, "%s%zu", n == 0 ? "" : ", ", pagesPerNode[n]);
+   }
+   fprintf(res_file, "]");
+   if (memCounters.valid) {
+      fprintf(res_file, ", \"dtlb_load_misses\": \"%llu\"", (unsigned long long)memCounters.dtlbMisses);
+   }
+   if (memCounters.nodeValid) {
+      fprintf(res_file, ", \"remote_node_loads\": \"%llu\"", (unsigned long long)memCounters.nodeMisses);
+   }
+   if (createFrom == 2) {
+      fprintf(res_file,
+         ", \"het_fpga_rows\": \"%u\", \"het_rows\": \"%u\", \"het_fpga_time\": \"%f\", \"het_smp_time\": \"%f\"",
+         het.fpgaRows, het.rows,
+         het.tFPGA - het.tStart,
+         het.tSMP - het.tStart
+      );
+   }
+   fprintf(res_file, ", \"inputs\": \"%s\", \"affinity\": \"%s\"", REF_GEN_STR[cfg->gen], AFF_STR[aff.policy]);
+   fprintf(res_file, " }");
+   if (mapped) {
+      oocUnmap(a, asize*sizeof(elem_t));
+      oocUnmap(b, bsize*sizeof(elem_t));
+   }
+   return check_ok;
+}
+
+// One product of a batch, C[m x n] += A[m x k] * B[k x n] with blocked matrices
+typedef struct {
+   elem_t *a, *b;
+   acc_t *c;
+   unsigned int m, n, k;
+   unsigned int *blocks;     // Sequence of C blocks
+   double tEnd;              // Completion time in the last launch
+} batch_item_t;
+
+// Creates the block tasks of one batch item and records when they finish
+#pragma oss task in([(size_t)m*kdim]a, [(size_t)kdim*n]b) inout([(size_t)m*n]c)
+void matmulBatchItem(const elem_t *a, const elem_t *b, acc_t *c, const unsigned int m, const unsigned int n,
+   const unsigned int kdim, const unsigned char createFrom, const order_t order, const unsigned int *blocks, double *tEnd)
+{
+   if (createFrom == 0) {
+      matmulFPGAEdges(a, b, c, m, n, kdim, order, blocks, 0);
+   } else {
+      matmulSMP(a, b, c, m, n, kdim, order, blocks, 0, 0);
+   }
+   #pragma oss taskwait
+   *tEnd = wall_time();
+}
+
+// Runs all the products of a batch in one launch. The items are created from a
+// single loop, without waiting between them, so their block tasks fill the
+// accelerators and the SMP workers together
+void matmulBatch(batch_item_t *items, const unsigned int count, const unsigned char createFrom, const order_t order) {
+   for (unsigned int l = 0; l < count; ++l) {
+      batch_item_t *it = &items[l];
+      matmulBatchItem(it->a, it->b, it->c, it->m, it->n, it->k, createFrom, order, it->blocks, &it->tEnd);
+   }
+   #pragma oss taskwait
+}
+
+// Runs and reports the configuration <cfg> as a batch of <count> products,
+// taking the <numSizes> sizes in turn. Returns the check result
+unsigned int matmulBatchBench(const bench_config_t *cfg, const unsigned int (*sizes)[3], const unsigned int numSizes,
+   const unsigned int count, bench_pool_t *pool, FILE *res_file)
+{
+   unsigned int const check = cfg->check, createFrom = cfg->createFrom;
+   unsigned int const warmup = cfg->warmup, minReps = cfg->minReps;
+   order_t const order = cfg->order;
+   char const * createFromStr = createFrom == 0 ? "cFPGA" : "cHOST";
+   char sizesStr[SWEEP_MAX_VALUES*48];
+   sizesStr[0] = '\0';
+   for (unsigned int s = 0; s < numSizes; ++s) {
+      char dimsStr[48];
+      dimsString(dimsStr, sizes[s][0], sizes[s][1], sizes[s][2]);
+      strcat(sizesStr, s == 0 ? "" : ",");
+      strcat(sizesStr, dimsStr);
+   }
+
+   //All items are stored one after the other
+   batch_item_t *items = (batch_item_t *)(malloc(count*sizeof(batch_item_t)));
+   size_t asize = 0, bsize = 0, m2size = 0, nblocks = 0;
+   double flops = 0;
+   for (unsigned int l = 0; l < count; ++l) {
+      const unsigned int *dims = sizes[l%numSizes];
+      asize += (size_t)dims[0]*dims[2];
+      bsize += (size_t)dims[2]*dims[1];
+      m2size += (size_t)dims[0]*dims[1];
+      nblocks += (size_t)numBlocks(dims[0])*numBlocks(dims[1]);
+      flops += 2.0*dims[0]*dims[1]*dims[2];
+   }
+   elem_t *a = (elem_t *)(memAlloc(asize*sizeof(elem_t)));
+   elem_t *b = (elem_t *)(memAlloc(bsize*sizeof(elem_t)));
+   acc_t *c = (acc_t *)(memAlloc(m2size*sizeof(acc_t)));
+   unsigned int *blocks = (unsigned int *)(malloc((nblocks + 1)*sizeof(unsigned int)));
+   if (items == NULL || a == NULL || b == NULL || c == NULL || blocks == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the batch\n");
+      exit(1);
+   }
+   asize = bsize = m2size = nblocks = 0;
+   for (unsigned int l = 0; l < count; ++l) {
+      batch_item_t *it = &items[l];
+      it->m = sizes[l%numSizes][0];
+      it->n = sizes[l%numSizes][1];
+      it->k = sizes[l%numSizes][2];
+      it->a = a + asize;
+      it->b = b + bsize;
+      it->c = c + m2size;
+      it->blocks = blocks + nblocks;
+      asize += (size_t)it->m*it->k;
+      bsize += (size_t)it->k*it->n;
+      m2size += (size_t)it->m*it->n;
+      nblocks += (size_t)numBlocks(it->m)*numBlocks(it->n);
+      //Only the interior C blocks when created from FPGA
+      blockOrder(order, createFrom == 0 ? it->m/BSIZE : numBlocks(it->m), createFrom == 0 ? it->n/BSIZE : numBlocks(it->n),
+         it->blocks);
+   }
+
+   double tIniStart = wall_time();
+   srand(2019);
+   for (unsigned int l = 0; l < count; ++l) {
+      const batch_item_t *it = &items[l];
+      for (unsigned int i = 0; i < numBlocks(it->m); ++i) {
+         for (unsigned int j = 0; j < numBlocks(it->k); ++j) {
+            genBlock(&it->a[blockOffset(it->m, it->k, i, j)], cfg->gen, rand(), 2*l, it->m, it->k, i, j);
+         }
+      }
+      for (unsigned int i = 0; i < numBlocks(it->k); ++i) {
+         for (unsigned int j = 0; j < numBlocks(it->n); ++j) {
+            genBlock(&it->b[blockOffset(it->k, it->n, i, j)], cfg->gen, rand(), 2*l + 1, it->k, it->n, i, j);
+         }
+      }
+      for (unsigned int i = 0; i < numBlocks(it->m); ++i) {
+         for (unsigned int j = 0; j < numBlocks(it->n); ++j) {
+            setBlock(&it->c[blockOffset(it->m, it->n, i, j)], 0, blockDim(it->m, i)*blockDim(it->n, j));
+         }
+      }
+   }
+   #pragma oss taskwait
+   const double tEndStart = wall_time();
+
+   const double tIniWarm = tEndStart;
+   for (unsigned int r = 0; r < warmup; ++r) {
+      matmulBatch(items, count, createFrom, order);
+   }
+   const double tEndWarm = wall_time();
+
+   //Launches and latencies of the items (since their launch) of all timed launches
+   double *latencies = (double *)(malloc((size_t)count*pool->repsCap*sizeof(double)));
+   if (latencies == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+      exit(1);
+   }
+   unsigned int reps = 0;
+   double tExecSum = 0;
+   while (reps < minReps || tExecSum < cfg->minTime) {
+      if (reps == pool->repsCap) {
+         pool->repsCap *= 2;
+         pool->repTimes = (double *)(realloc(pool->repTimes, pool->repsCap*sizeof(double)));
+         latencies = (double *)(realloc(latencies, (size_t)count*pool->repsCap*sizeof(double)));
+         if (pool->repTimes == NULL || latencies == NULL) {
+            fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+            exit(1);
+         }
+      }
+#if defined(MATMUL_EMU)
+      emuReset();
+#endif
+      const double tRep = wall_time();
+      matmulBatch(items, count, createFrom, order);
+      pool->repTimes[reps] = wall_time() - tRep;
+      for (unsigned int l = 0; l < count; ++l) {
+         latencies[(size_t)reps*count + l] = items[l].tEnd - tRep;
+      }
+      tExecSum += pool->repTimes[reps++];
+   }
+   const double tEndExec = wall_time();
+
+   //Check every item without reference
+   const double tIniCheck = tEndExec;
+   check_stats_t checkStats;
+   checkStatsInit(&checkStats);
+   unsigned int check_ok = 1;
+   if (check == 4) {
+      printf( "============ CHECKING (FREIVALDS) ================ \n" );
+      const unsigned int seed = (unsigned int)(wall_time()*1e6);
+      printf( "  Random vectors seed:   %u\n", seed );
+      double tol = 0;
+      unsigned int wrongItems = 0;
+      for (unsigned int l = 0; l < count; ++l) {
+         const batch_item_t *it = &items[l];
+         check_stats_t itemStats;
+         const double itemTol = matmulCheckFreivalds(it->a, it->b, it->c, it->m, it->n, it->k, warmup + reps, 1, seed + l,
+            &itemStats);
+         tol = itemTol > tol ? itemTol : tol;
+         wrongItems += itemStats.mismatches > 0;
+         itemStats.numCoords = 0;
+         checkStatsMerge(&checkStats, &itemStats);
+      }
+      freivaldsPrint(&checkStats, tol);
+      printf( "  Wrong items:           %u of %u\n", wrongItems, count );
+      check_ok = wrongItems == 0;
+      printf( "Output matrix is %s!\n", (check_ok ? "OK" : "WRONG") );
+      printf( "================================================== \n" );
+   }
+   const double tEndCheck = wall_time();
+
+   rep_stats_t timeStats, gflopsStats, latencyStats;
+   double* repGflops = (double *)(malloc(reps*sizeof(double)));
+   if (repGflops == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+      exit(1);
+   }
+   for (unsigned int r = 0; r < reps; ++r) {
+      repGflops[r] = flops/1e9/pool->repTimes[r];
+   }
+   repStats(repGflops, reps, &gflopsStats);
+   repStats(pool->repTimes, reps, &timeStats);
+   repStats(latencies, reps*count, &latencyStats);
+   const double latencyMax = latencies[(size_t)reps*count - 1];
+   free(repGflops);
+
+   printf( "==================== RESULTS ===================== \n" );
+   printf( "  Benchmark: %s (%s)\n", "Matmul", "OmpSs" );
+   printf( "  Elements type: %s\n", ELEM_T_STR );
+   printf( "  Batch items:           %u\n", count );
+   printf( "  Item sizes:            %s\n", sizesStr );
+   printf( "  Create from: %s\n", createFromStr );
+   printf( "  Inputs:                %s\n", REF_GEN_STR[cfg->gen] );
+   printf( "  Affinity:              %s\n", AFF_STR[aff.policy] );
+   printf( "  Block order: %s\n", ORDER_STR[order] );
+   printf( "  Init. time (secs):     %f\n", tEndStart  - tIniStart );
+   printf( "  Warm up runs:          %u\n", warmup );
+   printf( "  Warm up time (secs):   %f\n", tEndWarm   - tIniWarm );
+   printf( "  Timed runs:            %u\n", reps );
+   printf( "  Execution time (secs): %f\n", timeStats.median );
+   printf( "  Checking time (secs):  %f\n", tEndCheck  - tIniCheck );
+   printf( "  Performance (GFLOPS):  %f\n", gflopsStats.median );
+   printf( "  Throughput (items/s):  %f\n", count/timeStats.median );
+   printf( "  Timed runs     Time (secs)     GFLOPS\n" );
+   printf( "    min          %-15f %f\n", timeStats.min, gflopsStats.min );
+   printf( "    median       %-15f %f\n", timeStats.median, gflopsStats.median );
+   printf( "    mean         %-15f %f\n", timeStats.mean, gflopsStats.mean );
+   printf( "    stddev       %-15f %f\n", timeStats.stddev, gflopsStats.stddev );
+   printf( "    p95          %-15f %f\n", timeStats.p95, gflopsStats.p95 );
+   printf( "  Item latency (secs):   min %f, median %f, mean %f, p95 %f, max %f\n", latencyStats.min, latencyStats.median,
+      latencyStats.mean, latencyStats.p95, latencyMax );
+   printf( "  SMP block kernel:      %s %f GFLOPS (naive %f GFLOPS)\n", pool->smpKernel->name, pool->smpGflopsKernel,
+      pool->smpGflopsNaive );
+#if defined(MATMUL_EMU)
+   emuReport(flops);
+#endif
+   printf( "================================================== \n" );
+
+   fprintf(res_file,
+      "{ \
+         \"benchmark\": \"%s\", \
+         \"toolchain\": \"%s\", \
+         \"board\": \"%s\", \
+         \"version\": \"%uaccs %uBS kij memport_128 noflush\", \
+         \"exectype\": \"%s\", \
+         \"argv\": \"batch %u %s %d %s\", \
+         \"order\": \"%s\", \
+         \"warmup\": \"%u\", \
+         \"reps\": \"%u\", \
+         \"exectime\": \"%f\", \
+         \"performance\": \"%f\", \
+         \"exectime_min\": \"%f\", \"exectime_median\": \"%f\", \"exectime_mean\": \"%f\", \"exectime_stddev\": \"%f\", \"exectime_p95\": \"%f\", \
+         \"performance_min\": \"%f\", \"performance_median\": \"%f\", \"performance_mean\": \"%f\", \"performance_stddev\": \"%f\", \"performance_p95\": \"%f\", \
+         \"batch_items\": \"%u\", \"batch_sizes\": \"%s\", \"batch_throughput\": \"%f\", \
+         \"latency_min\": \"%f\", \"latency_median\": \"%f\", \"latency_mean\": \"%f\", \"latency_p95\": \"%f\", \"latency_max\": \"%f\", \
+         \"note\": \"datatype %s, init %f, warm %f, exec %f, check %f\"",
+      "matmul",
+      "ompss-2",
+      BOARD,
+      MBLOCK_NUM_ACCS, BSIZE,
+      RUNTIME_MODE,
+      count, sizesStr, BSIZE, createFromStr,
+      ORDER_STR[order],
+      warmup,
+      reps,
+      timeStats.median,
+      gflopsStats.median,
+      timeStats.min, timeStats.median, timeStats.mean, timeStats.stddev, timeStats.p95,
+      gflopsStats.min, gflopsStats.median, gflopsStats.mean, gflopsStats.stddev, gflopsStats.p95,
+      count, sizesStr, count/timeStats.median,
+      latencyStats.min, latencyStats.median, latencyStats.mean, latencyStats.p95, latencyMax,
+      ELEM_T_STR,
+      tEndStart - tIniStart,
+      tEndWarm - tIniWarm,
+      timeStats.median,
+      tEndCheck - tIniCheck
+   );
+#if defined(MATMUL_EMU)
+   fprintf(res_file,
+      ", \"emu_task_cycles\": \"%llu\", \"emu_exectime\": \"%f\", \"emu_performance\": \"%f\", \"emu_traffic_ab\": \"%llu\", \"emu_traffic_c\": \"%llu\", \"emu_c_transfers\": \"%llu\", \"emu_c_avoided\": \"%llu\"",
+      (unsigned long long)emu.task.total,
+      emuSeconds(emu.makespan),
+      flops/1e9/emuSeconds(emu.makespan),
+      (unsigned long long)emu.bytesAB, (unsigned long long)emu.bytesC,
+      (unsigned long long)emu.cTransfers, (unsigned long long)emu.cAvoided
+   );
+#endif
+   if (check == 4) {
+      fprintf(res_file,
+         ", \"check_max_abs_err\": \"%e\", \"check_max_rel_err\": \"%e\", \"check_mismatches\": \"%llu\"",
+         checkStats.maxAbsErr, checkStats.maxRelErr, checkStats.mismatches
+      );
+   }
+   fprintf(res_file, ", \"inputs\": \"%s\", \"affinity\": \"%s\"", REF_GEN_STR[cfg->gen], AFF_STR[aff.policy]);
+   fprintf(res_file, " }");
+
+   free(latencies);
+   free(blocks);
+   free(items);
+   memFree(a, asize*sizeof(elem_t));
+   memFree(b, bsize*sizeof(elem_t));
+   memFree(c, m2size*sizeof(acc_t));
+   return check_ok;
+}
+
+// Elements of the blocks i with i%<np> == <p> along a dimension of <n>
+// elements, the local dimension of grid coordinate <p> in the block-cyclic
+// distribution. The global edge block is the last local block of its process,
+// so the local matrices are blocked matrices of the local dimensions
+unsigned int summaDim(const unsigned int n, const unsigned int p, const unsigned int np) {
+   unsigned int d = 0;
+   for (unsigned int i = p; i < numBlocks(n); i += np) {
+      d += blockDim(n, i);
+   }
+   return d;
+}
+
+// Local matrices and panels of one process of a SUMMA product
+typedef struct {
+   unsigned int m, n, k;            // Global dimensions
+   unsigned int mLoc, nLoc;         // Local rows of A and C, and local columns of B and C
+   unsigned int kaLoc, kbLoc;       // Local columns of A and local rows of B
+   unsigned int createFrom;
+   elem_t *a, *b;
+   acc_t *c;
+   elem_t *aPanel[2], *bPanel[2];   // Double buffered panels, A blocks are packed
+   const elem_t *bCur[2];           // B panels, the owner uses its block row in place
+   unsigned int *blocks;            // Sequence of the local interior C blocks
+   double compute;                  // Seconds creating and waiting for the local tasks
+   double comm;                     // Seconds packing the panels and waiting for their broadcasts
+   double received;                 // Panel bytes received from other processes
+} summa_state_t;
+
+void summaInit(summa_state_t *st, const unsigned int m, const unsigned int n, const unsigned int k,
+   const unsigned int createFrom)
+{
+   st->m = m;
+   st->n = n;
+   st->k = k;
+   st->mLoc = summaDim(m, dist.pr, dist.p);
+   st->nLoc = summaDim(n, dist.pc, dist.q);
+   st->kaLoc = summaDim(k, dist.pc, dist.q);
+   st->kbLoc = summaDim(k, dist.pr, dist.p);
+   st->createFrom = createFrom;
+   st->a = (elem_t *)(memAlloc((size_t)st->mLoc*st->kaLoc*sizeof(elem_t)));
+   st->b = (elem_t *)(memAlloc((size_t)st->kbLoc*st->nLoc*sizeof(elem_t)));
+   st->c = (acc_t *)(memAlloc((size_t)st->mLoc*st->nLoc*sizeof(acc_t)));
+   unsigned int ok = st->a != NULL && st->b != NULL && st->c != NULL;
+   for (unsigned int x = 0; x < 2; ++x) {
+      st->aPanel[x] = (elem_t *)(memAlloc((size_t)st->mLoc*BSIZE*sizeof(elem_t)));
+      st->bPanel[x] = (elem_t *)(memAlloc((size_t)BSIZE*st->nLoc*sizeof(elem_t)));
+      ok = ok && st->aPanel[x] != NULL && st->bPanel[x] != NULL;
+   }
+   st->blocks = (unsigned int *)(malloc(((st->mLoc/BSIZE)*(st->nLoc/BSIZE) + 1)*sizeof(unsigned int)));
+   if (!ok || st->blocks == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the local matrices\n");
+      exit(1);
+   }
+   blockOrder(ORDER_DEFAULT, st->mLoc/BSIZE, st->nLoc/BSIZE, st->blocks);
+   st->compute = st->comm = st->received = 0;
+}
+
+void summaFini(summa_state_t *st) {
+   memFree(st->a, (size_t)st->mLoc*st->kaLoc*sizeof(elem_t));
+   memFree(st->b, (size_t)st->kbLoc*st->nLoc*sizeof(elem_t));
+   memFree(st->c, (size_t)st->mLoc*st->nLoc*sizeof(acc_t));
+   for (unsigned int x = 0; x < 2; ++x) {
+      memFree(st->aPanel[x], (size_t)st->mLoc*BSIZE*sizeof(elem_t));
+      memFree(st->bPanel[x], (size_t)BSIZE*st->nLoc*sizeof(elem_t));
+   }
+   free(st->blocks);
+}
+
+// Initializes the local blocks of A, B and C of process (<pr>,<pc>) of a <p>x<q>
+// grid with the values of matmulBench: the seeds are drawn in the same global
+// block order and each process keeps the blocks it owns
+void summaInputs(elem_t *a, elem_t *b, acc_t *c, const unsigned int m, const unsigned int n, const unsigned int k,
+   const unsigned int pr, const unsigned int pc, const unsigned int p, const unsigned int q, const unsigned int gen)
+{
+   unsigned int const mLoc = summaDim(m, pr, p), nLoc = summaDim(n, pc, q);
+   unsigned int const kaLoc = summaDim(k, pc, q), kbLoc = summaDim(k, pr, p);
+   unsigned int const ablocks = numBlocks(m)*numBlocks(k);
+   unsigned int const bblocks = numBlocks(k)*numBlocks(n);
+   unsigned int const cblocks = numBlocks(m)*numBlocks(n);
+   srand(2019);
+   for (unsigned int l = 0; l < ablocks || l < bblocks || l < cblocks; l++) {
+      if (l < ablocks) {
+         unsigned int const i = l/numBlocks(k), j = l%numBlocks(k);
+         int const seed = rand();
+         if (i%p == pr && j%q == pc) {
+            genBlock(&a[blockOffset(mLoc, kaLoc, i/p, j/q)], gen, seed, 0, m, k, i, j);
+         }
+      }
+      if (l < bblocks) {
+         unsigned int const i = l/numBlocks(n), j = l%numBlocks(n);
+         int const seed = rand();
+         if (i%p == pr && j%q == pc) {
+            genBlock(&b[blockOffset(kbLoc, nLoc, i/p, j/q)], gen, seed, 1, k, n, i, j);
+         }
+      }
+      if (l < cblocks) {
+         unsigned int const i = l/numBlocks(n), j = l%numBlocks(n);
+         if (i%p == pr && j%q == pc) {
+            setBlock(&c[blockOffset(mLoc, nLoc, i/p, j/q)], 0, blockDim(m, i)*blockDim(n, j));
+         }
+      }
    }
+   #pragma oss taskwait
+}
 
-   double tIniStart = wall_time();
+// Starts the broadcasts of the A panel (block column <kb>) along the grid rows
+// and of the B panel (block row <kb>) along the grid columns into panels <x>.
+// The A blocks of the panel are packed by their owners, the B ones are contiguous
+void summaPanel(summa_state_t *st, const unsigned int kb, const unsigned int x, dist_req_t req[2]) {
+   unsigned int const bk = blockDim(st->k, kb);
+   unsigned int const aRoot = kb%dist.q, bRoot = kb%dist.p;
+   size_t const aBytes = (size_t)st->mLoc*bk*sizeof(elem_t);
+   size_t const bBytes = (size_t)bk*st->nLoc*sizeof(elem_t);
+   if (dist.pc == aRoot) {
+      for (unsigned int i = 0; i < numBlocks(st->mLoc); ++i) {
+         memcpy(st->aPanel[x] + (size_t)i*BSIZE*bk, st->a + blockOffset(st->mLoc, st->kaLoc, i, kb/dist.q),
+            (size_t)blockDim(st->mLoc, i)*bk*sizeof(elem_t));
+      }
+   } else {
+      st->received += aBytes;
+   }
+   if (dist.pr == bRoot) {
+      st->bCur[x] = st->b + blockOffset(st->kbLoc, st->nLoc, kb/dist.p, 0);
+   } else {
+      st->bCur[x] = st->bPanel[x];
+      st->received += bBytes;
+   }
+   distIbcast(st->aPanel[x], aBytes, aRoot, 1, &req[0]);
+   distIbcast((void *)st->bCur[x], bBytes, bRoot, 0, &req[1]);
+}
 
-   srand(2019);
-   for (unsigned int i = 0; i < m2size/b2size; i++) {
-      setBlockSeq(&a[i*b2size], rand());
-      setBlockSeq(&b[i*b2size], rand());
-      setBlock(&c[i*b2size], 0);
+// SUMMA product C += A*B over the process grid. For each k block, every
+// process updates its C blocks with the A and B panels of the k block, with
+// the tasks of the local product. The broadcasts of the next panels are
+// started before creating the tasks of the current ones, so they overlap
+void summaRun(summa_state_t *st) {
+   unsigned int const nk = numBlocks(st->k);
+   dist_req_t req[2][2];
+   double t = wall_time();
+   summaPanel(st, 0, 0, req[0]);
+   for (unsigned int kb = 0; kb < nk; ++kb) {
+      unsigned int const x = kb%2;
+      unsigned int const bk = blockDim(st->k, kb);
+      distWait(&req[x][0]);
+      distWait(&req[x][1]);
+      if (kb + 1 < nk) {
+         summaPanel(st, kb + 1, 1 - x, req[1 - x]);
+      }
+      const double tTasks = wall_time();
+      st->comm += tTasks - t;
+      if (st->mLoc > 0 && st->nLoc > 0) {
+         if (st->createFrom == 0) {
+            matmulFPGAEdges(st->aPanel[x], st->bCur[x], st->c, st->mLoc, st->nLoc, bk, ORDER_DEFAULT, st->blocks, 0);
+         } else {
+            matmulSMP(st->aPanel[x], st->bCur[x], st->c, st->mLoc, st->nLoc, bk, ORDER_DEFAULT, NULL, 0, 0);
+         }
+      }
+      #pragma oss taskwait
+      t = wall_time();
+      st->compute += t - tTasks;
    }
+}
 
-   #pragma oss taskwait
+// Collects the local C matrices into the global blocked <c> of process 0
+void summaGatherC(const summa_state_t *st, acc_t *c) {
+   if (dist.rank != 0) {
+      distSend(st->c, (size_t)st->mLoc*st->nLoc*sizeof(acc_t), 0);
+      return;
+   }
+   acc_t *buf = (acc_t *)(malloc(((size_t)summaDim(st->m, 0, dist.p)*summaDim(st->n, 0, dist.q) + 1)*sizeof(acc_t)));
+   if (buf == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the result\n");
+      exit(1);
+   }
+   for (int r = 0; r < dist.size; ++r) {
+      unsigned int const pr = r/dist.q, pc = r%dist.q;
+      unsigned int const mLoc = summaDim(st->m, pr, dist.p), nLoc = summaDim(st->n, pc, dist.q);
+      const acc_t *src = st->c;
+      if (r != 0) {
+         distRecv(buf, (size_t)mLoc*nLoc*sizeof(acc_t), r);
+         src = buf;
+      }
+      for (unsigned int i = 0; i < numBlocks(mLoc); ++i) {
+         for (unsigned int j = 0; j < numBlocks(nLoc); ++j) {
+            unsigned int const gi = i*dist.p + pr, gj = j*dist.q + pc;
+            memcpy(c + blockOffset(st->m, st->n, gi, gj), src + blockOffset(mLoc, nLoc, i, j),
+               (size_t)blockDim(st->m, gi)*blockDim(st->n, gj)*sizeof(acc_t));
+         }
+      }
+   }
+   free(buf);
+}
+
+// Runs and reports the configuration <cfg> distributed over the process grid.
+// Process 0 reports, writes the results into <res_file> and checks the result
+// with the global matrices in <pool>. Returns the check result in all processes
+unsigned int summaBench(const bench_config_t *cfg, bench_pool_t *pool, FILE *res_file) {
+   unsigned int const msize = cfg->msize, nsize = cfg->nsize, ksize = cfg->ksize;
+   unsigned int const check = cfg->check, createFrom = cfg->createFrom;
+   unsigned int const warmup = cfg->warmup, minReps = cfg->minReps;
+   char const * createFromStr = createFrom == 0 ? "cFPGA" : "cHOST";
+   char dimsStr[48];
+   dimsString(dimsStr, msize, nsize, ksize);
+   double const flops = 2.0*msize*nsize*ksize;
+
+   summa_state_t st;
+   summaInit(&st, msize, nsize, ksize, createFrom);
+   const double tIniStart = wall_time();
+   summaInputs(st.a, st.b, st.c, msize, nsize, ksize, dist.pr, dist.pc, dist.p, dist.q, cfg->gen);
+   distBarrier();
    const double tEndStart = wall_time();
    const double tIniWarm = tEndStart;
 
-   //Warm up execution
-   if (createFrom == 0) {
-     matmulFPGA(a, b, c, msize);
-   } else if (createFrom == 1) {
-     matmulSMP(a, b, c, msize);
+   //Warm up executions
+   for (unsigned int r = 0; r < warmup; ++r) {
+      summaRun(&st);
    }
-
-   //Noflush is not yet implemented
-   #pragma oss taskwait noflush([m2size]a, [m2size]b, [m2size]c)
+   distBarrier();
    const double tEndWarm = wall_time();
-   const double tIniExec = tEndWarm;
+   st.compute = st.comm = st.received = 0;
 
-   //Performance execution
-   if (createFrom == 0) {
-     matmulFPGA(a, b, c, msize);
-   } else if (createFrom == 1) {
-     matmulSMP(a, b, c, msize);
+   //Performance executions, process 0 decides when the minimum time is reached
+   unsigned int reps = 0;
+   double tExecSum = 0;
+   unsigned int done = 0;
+   while (!done) {
+      if (reps == pool->repsCap) {
+         pool->repsCap *= 2;
+         pool->repTimes = (double *)(realloc(pool->repTimes, pool->repsCap*sizeof(double)));
+         if (pool->repTimes == NULL) {
+            fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+            exit(1);
+         }
+      }
+#if defined(MATMUL_EMU)
+      emuReset();
+#endif
+      const double tRep = wall_time();
+      summaRun(&st);
+      distBarrier();
+      pool->repTimes[reps] = wall_time() - tRep;
+      tExecSum += pool->repTimes[reps++];
+      done = distBcastUInt(reps >= minReps && tExecSum >= cfg->minTime);
    }
+   const double tIniCheck = wall_time();
 
-   //taskwait is not implemented (yet)
-   #pragma oss taskwait noflush([m2size]a, [m2size]b, [m2size]c)
-   const double tEndExec = wall_time();
-   const double tIniFlush = tEndExec;
+   //Check the output matrix in process 0, with the global inputs
+   check_stats_t checkStats;
+   checkStatsInit(&checkStats);
+   unsigned int check_ok = 1;
+   if (check != 0) {
+      if (dist.rank == 0) {
+         summaInputs(pool->a, pool->b, pool->c, msize, nsize, ksize, 0, 0, 1, 1, cfg->gen);
+      }
+      summaGatherC(&st, pool->c);
+      if (dist.rank == 0) {
+         check_ok = matmulCheck(check, pool->a, pool->b, pool->c, msize, nsize, ksize, warmup + reps, cfg->gen, 1,
+            &checkStats);
+      }
+      check_ok = distBcastUInt(check_ok);
+   }
+#if defined(MATMUL_CORE_SYSTOLIC) && defined(MATMUL_EMU)
+   check_ok = check_ok && emu.coreMismatches == 0;
+#endif
+   const double tEndCheck = wall_time();
 
-   //This would be needed in case of using noflush
-   //flushData(c, m2size);
-   //#pragma oss taskwait
-   const double tEndFlush = wall_time();
-   const double tIniCheck = tEndFlush;
+   //Mean seconds and bytes of one run in each process
+   double local[3] = { st.compute/reps, st.comm/reps, st.received/reps };
+   double *ranks = (double *)(malloc(3*dist.size*sizeof(double)));
+   double* repGflops = (double *)(malloc(reps*sizeof(double)));
+   if (ranks == NULL || repGflops == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+      exit(1);
+   }
+   distGather(local, 3, ranks);
+   summaFini(&st);
+   if (dist.rank != 0) {
+      free(ranks);
+      free(repGflops);
+      return check_ok;
+   }
 
-   //Check the output matrix
-   unsigned int check_ok = matmulCheck(check, c, msize);
+   for (unsigned int r = 0; r < reps; ++r) {
+      repGflops[r] = flops/1e9/pool->repTimes[r];
+   }
+   rep_stats_t timeStats, gflopsStats;
+   repStats(repGflops, reps, &gflopsStats);
+   repStats(pool->repTimes, reps, &timeStats);
+   free(repGflops);
+   double computeMax = 0, commMax = 0, commShare = 0;
+   for (int r = 0; r < dist.size; ++r) {
+      const double *v = &ranks[3*r];
+      computeMax = v[0] > computeMax ? v[0] : computeMax;
+      commMax = v[1] > commMax ? v[1] : commMax;
+      commShare = v[0] + v[1] > 0 && v[1]/(v[0] + v[1]) > commShare ? v[1]/(v[0] + v[1]) : commShare;
+   }
+
+   printf( "==================== RESULTS ===================== \n" );
+   printf( "  Benchmark: %s (%s)\n", "Matmul", "OmpSs" );
+   printf( "  Elements type: %s\n", ELEM_T_STR );
+   printf( "  Matrix size: %s\n", dimsStr );
+   printf( "  Create from: %s\n", createFromStr );
+   printf( "  Inputs:                %s\n", REF_GEN_STR[cfg->gen] );
+   printf( "  Affinity:              %s\n", AFF_STR[aff.policy] );
+   printf( "  Process grid:          %ux%u (SUMMA, %u panels per run)\n", dist.p, dist.q, numBlocks(ksize) );
+   printf( "  Init. time (secs):     %f\n", tEndStart  - tIniStart );
+   printf( "  Warm up runs:          %u\n", warmup );
+   printf( "  Warm up time (secs):   %f\n", tEndWarm   - tIniWarm );
+   printf( "  Timed runs:            %u\n", reps );
+   printf( "  Execution time (secs): %f\n", timeStats.median );
+   printf( "  Checking time (secs):  %f\n", tEndCheck  - tIniCheck );
+   printf( "  Performance (GFLOPS):  %f\n", gflopsStats.median );
+   printf( "  Timed runs     Time (secs)     GFLOPS\n" );
+   printf( "    min          %-15f %f\n", timeStats.min, gflopsStats.min );
+   printf( "    median       %-15f %f\n", timeStats.median, gflopsStats.median );
+   printf( "    mean         %-15f %f\n", timeStats.mean, gflopsStats.mean );
+   printf( "    stddev       %-15f %f\n", timeStats.stddev, gflopsStats.stddev );
+   printf( "    p95          %-15f %f\n", timeStats.p95, gflopsStats.p95 );
+   printf( "  Per run        Compute (secs)  Comm. (secs)    Received (MiB)\n" );
+   for (int r = 0; r < dist.size; ++r) {
+      char rankStr[40];
+      sprintf(rankStr, "%d (%d,%d)", r, r/(int)dist.q, r%(int)dist.q);
+      printf( "    %-12s %-15f %-15f %f\n", rankStr, ranks[3*r], ranks[3*r + 1], ranks[3*r + 2]/1048576.0 );
+   }
+   printf( "  Comm. share (max):     %f\n", commShare );
+#if defined(MATMUL_EMU)
+   emuReport(flops/dist.size);
+#endif
+   printf( "================================================== \n" );
+
+   fprintf(res_file,
+      "{ \
+         \"benchmark\": \"%s\", \
+         \"toolchain\": \"%s\", \
+         \"board\": \"%s\", \
+         \"version\": \"%uaccs %uBS kij memport_128 noflush\", \
+         \"exectype\": \"%s\", \
+         \"argv\": \"dist %ux%u %s %d %s\", \
+         \"warmup\": \"%u\", \
+         \"reps\": \"%u\", \
+         \"exectime\": \"%f\", \
+         \"performance\": \"%f\", \
+         \"exectime_min\": \"%f\", \"exectime_median\": \"%f\", \"exectime_mean\": \"%f\", \"exectime_stddev\": \"%f\", \"exectime_p95\": \"%f\", \
+         \"performance_min\": \"%f\", \"performance_median\": \"%f\", \"performance_mean\": \"%f\", \"performance_stddev\": \"%f\", \"performance_p95\": \"%f\", \
+         \"dist_grid\": \"%ux%u\", \"dist_compute_max\": \"%f\", \"dist_comm_max\": \"%f\", \"dist_comm_share\": \"%f\", \
+         \"note\": \"datatype %s, init %f, warm %f, exec %f, check %f\"",
+      "matmul",
+      "ompss-2",
+      BOARD,
+      MBLOCK_NUM_ACCS, BSIZE,
+      RUNTIME_MODE,
+      dist.p, dist.q, dimsStr, BSIZE, createFromStr,
+      warmup,
+      reps,
+      timeStats.median,
+      gflopsStats.median,
+      timeStats.min, timeStats.median, timeStats.mean, timeStats.stddev, timeStats.p95,
+      gflopsStats.min, gflopsStats.median, gflopsStats.mean, gflopsStats.stddev, gflopsStats.p95,
+      dist.p, dist.q, computeMax, commMax, commShare,
+      ELEM_T_STR,
+      tEndStart - tIniStart,
+      tEndWarm - tIniWarm,
+      timeStats.median,
+      tEndCheck - tIniCheck
+   );
+   fprintf(res_file, ", \"dist_ranks\": [");
+   for (int r = 0; r < dist.size; ++r) {
+      fprintf(res_file, "%s{ \"compute\": \"%f\", \"comm\": \"%f\", \"received\": \"%.0f\" }", r == 0 ? "" : ", ",
+         ranks[3*r], ranks[3*r + 1], ranks[3*r + 2]);
+   }
+   fprintf(res_file, "]");
+#if defined(MATMUL_EMU)
+   fprintf(res_file,
+      ", \"emu_task_cycles\": \"%llu\", \"emu_exectime\": \"%f\", \"emu_performance\": \"%f\", \"emu_traffic_ab\": \"%llu\", \"emu_traffic_c\": \"%llu\", \"emu_c_transfers\": \"%llu\", \"emu_c_avoided\": \"%llu\"",
+      (unsigned long long)emu.task.total,
+      emuSeconds(emu.makespan),
+      flops/dist.size/1e9/emuSeconds(emu.makespan),
+      (unsigned long long)emu.bytesAB, (unsigned long long)emu.bytesC,
+      (unsigned long long)emu.cTransfers, (unsigned long long)emu.cAvoided
+   );
+#endif
+   if (check == 1 || check == 3 || check == 4) {
+      fprintf(res_file,
+         ", \"check_max_abs_err\": \"%e\", \"check_max_rel_err\": \"%e\", \"check_mismatches\": \"%llu\"",
+         checkStats.maxAbsErr, checkStats.maxRelErr, checkStats.mismatches
+      );
+   }
+   fprintf(res_file, ", \"inputs\": \"%s\", \"affinity\": \"%s\"", REF_GEN_STR[cfg->gen], AFF_STR[aff.policy]);
+   fprintf(res_file, " }");
+   free(ranks);
+   return check_ok;
+}
+
+// Out-of-core product. C is computed in passes of <rows> block rows, whose C
+// blocks stay in memory during the pass while the A blocks of the pass and the
+// B block rows are streamed from the files, one k block per step. The I/O of
+// each step (next A and B panels, and at the start of a pass, the write-behind
+// of the previous pass and the read of the next one) runs in a task next to
+// the one computing the step, so each step takes the longest of both
+typedef struct {
+   unsigned int m, n, k;
+   unsigned int createFrom;
+   int fdA, fdB, fdC;
+   unsigned int rows;               // C block rows per pass
+   unsigned int passes;
+   size_t aPanelBytes, bPanelBytes, cPassBytes;
+   elem_t *aPanel[2], *bPanel[2];   // Double buffered A and B panels of one k block
+   acc_t *cPass[2];                 // C blocks of the current pass and of the one written and read
+   unsigned int *blocks;            // Sequence of the interior C blocks of a pass
+   double compute;                  // Seconds until the compute tasks of each step end
+   double ioWait;                   // Seconds each step waits for its I/O after computing, and blocking I/O
+   double ioBusy;                   // Seconds of I/O
+   double readBytes, writtenBytes;
+   double computeEnd, ioEnd;        // End of the compute and I/O tasks of the current step
+} ooc_state_t;
+
+// C block rows per pass that fit in <window> bytes with the double buffered
+// panels, 0 if not even one does
+unsigned int oocRowsPerPass(const size_t window, const unsigned int m, const unsigned int n) {
+   const size_t fixed = 2*(size_t)BSIZE*n*sizeof(elem_t);
+   const size_t perRow = 2*((size_t)BSIZE*BSIZE*sizeof(elem_t) + (size_t)BSIZE*n*sizeof(acc_t));
+   const size_t rows = window > fixed ? (window - fixed)/perRow : 0;
+   return rows < numBlocks(m) ? rows : numBlocks(m);
+}
+
+// Rows of C in pass <p>
+static unsigned int oocPassRows(const ooc_state_t *st, const unsigned int p) {
+   const size_t r0 = (size_t)p*st->rows*BSIZE;
+   const size_t r1 = r0 + (size_t)st->rows*BSIZE;
+   return (unsigned int)((r1 < st->m ? r1 : st->m) - r0);
+}
+
+// Reads the A blocks of pass <p> and k block <kb>, packed as a blocked matrix,
+// and B block row <kb> into panels <x>
+void oocLoadPanels(ooc_state_t *st, const unsigned int p, const unsigned int kb, const unsigned int x) {
+   const unsigned int bk = blockDim(st->k, kb);
+   const unsigned int i0 = p*st->rows;
+   const unsigned int i1 = i0 + numBlocks(oocPassRows(st, p));
+   for (unsigned int i = i0; i < i1; ++i) {
+      const size_t bytes = (size_t)blockDim(st->m, i)*bk*sizeof(elem_t);
+      oocRead(st->fdA, st->aPanel[x] + (size_t)(i - i0)*BSIZE*bk, bytes,
+         ((off_t)i*BSIZE*st->k + (off_t)kb*BSIZE*blockDim(st->m, i))*sizeof(elem_t));
+      st->readBytes += bytes;
+   }
+   const size_t bytes = (size_t)bk*st->n*sizeof(elem_t);
+   oocRead(st->fdB, st->bPanel[x], bytes, (off_t)kb*BSIZE*st->n*sizeof(elem_t));
+   st->readBytes += bytes;
+}
+
+// Reads (writes) the C blocks of pass <p> into (from) their buffer
+void oocLoadC(ooc_state_t *st, const unsigned int p) {
+   const size_t bytes = (size_t)oocPassRows(st, p)*st->n*sizeof(acc_t);
+   oocRead(st->fdC, st->cPass[p%2], bytes, (off_t)p*st->rows*BSIZE*st->n*sizeof(acc_t));
+   st->readBytes += bytes;
+}
+
+void oocStoreC(ooc_state_t *st, const unsigned int p) {
+   const size_t bytes = (size_t)oocPassRows(st, p)*st->n*sizeof(acc_t);
+   oocWrite(st->fdC, st->cPass[p%2], bytes, (off_t)p*st->rows*BSIZE*st->n*sizeof(acc_t));
+   st->writtenBytes += bytes;
+}
+
+// Computes step (<p>,<kb>) with panels <x>, creating the block tasks of the
+// product of the A and B panels into the C blocks of the pass
+#pragma oss task
+void oocCompute(ooc_state_t *st, const unsigned int p, const unsigned int kb, const unsigned int x) {
+   const unsigned int pm = oocPassRows(st, p);
+   const unsigned int bk = blockDim(st->k, kb);
+   if (st->createFrom == 0) {
+      matmulFPGAEdges(st->aPanel[x], st->bPanel[x], st->cPass[p%2], pm, st->n, bk, ORDER_DEFAULT, st->blocks, 0);
+   } else {
+      matmulSMP(st->aPanel[x], st->bPanel[x], st->cPass[p%2], pm, st->n, bk, ORDER_DEFAULT, NULL, 0, 0);
+   }
+   #pragma oss taskwait
+   st->computeEnd = wall_time();
+}
+
+// I/O of step (<p>,<kb>): prefetches the panels of the next step into the
+// other buffers and, at the first step of a pass, writes behind the C blocks
+// of the previous pass and reads the ones of the next pass into their buffer
+#pragma oss task
+void oocPrefetch(ooc_state_t *st, const unsigned int p, const unsigned int kb, const unsigned int x) {
+   const double t = wall_time();
+   if (kb + 1 < numBlocks(st->k)) {
+      oocLoadPanels(st, p, kb + 1, 1 - x);
+   } else if (p + 1 < st->passes) {
+      oocLoadPanels(st, p + 1, 0, 1 - x);
+   }
+   if (kb == 0) {
+      if (p > 0) oocStoreC(st, p - 1);
+      if (p + 1 < st->passes) oocLoadC(st, p + 1);
+   }
+   st->ioEnd = wall_time();
+   st->ioBusy += st->ioEnd - t;
+}
+
+// Out-of-core product C += A*B of the files
+void oocRun(ooc_state_t *st) {
+   double t = wall_time();
+   oocLoadC(st, 0);
+   oocLoadPanels(st, 0, 0, 0);
+   double tIO = wall_time();
+   st->ioBusy += tIO - t;
+   st->ioWait += tIO - t;
+   unsigned int x = 0;
+   for (unsigned int p = 0; p < st->passes; ++p) {
+      for (unsigned int kb = 0; kb < numBlocks(st->k); ++kb) {
+         const double tStep = wall_time();
+         st->ioEnd = tStep;
+         oocCompute(st, p, kb, x);
+         oocPrefetch(st, p, kb, x);
+         #pragma oss taskwait
+         st->compute += st->computeEnd - tStep;
+         st->ioWait += st->ioEnd > st->computeEnd ? st->ioEnd - st->computeEnd : 0;
+         x = 1 - x;
+      }
+   }
+   t = wall_time();
+   oocStoreC(st, st->passes - 1);
+   tIO = wall_time();
+   st->ioBusy += tIO - t;
+   st->ioWait += tIO - t;
+}
+
+void oocInit(ooc_state_t *st, const unsigned int m, const unsigned int n, const unsigned int k,
+   const unsigned int createFrom, const unsigned int rows)
+{
+   st->m = m;
+   st->n = n;
+   st->k = k;
+   st->createFrom = createFrom;
+   st->rows = rows;
+   st->passes = (numBlocks(m) + rows - 1)/rows;
+   st->aPanelBytes = (size_t)rows*BSIZE*BSIZE*sizeof(elem_t);
+   st->bPanelBytes = (size_t)BSIZE*n*sizeof(elem_t);
+   st->cPassBytes = (size_t)rows*BSIZE*n*sizeof(acc_t);
+   unsigned int ok = 1;
+   for (unsigned int x = 0; x < 2; ++x) {
+      st->aPanel[x] = (elem_t *)(memAlloc(st->aPanelBytes));
+      st->bPanel[x] = (elem_t *)(memAlloc(st->bPanelBytes));
+      st->cPass[x] = (acc_t *)(memAlloc(st->cPassBytes));
+      ok = ok && st->aPanel[x] != NULL && st->bPanel[x] != NULL && st->cPass[x] != NULL;
+   }
+   st->blocks = (unsigned int *)(malloc(((size_t)rows*(n/BSIZE) + 1)*sizeof(unsigned int)));
+   if (!ok || st->blocks == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the out-of-core window\n");
+      exit(1);
+   }
+   blockOrder(ORDER_DEFAULT, rows, n/BSIZE, st->blocks);
+   st->compute = st->ioWait = st->ioBusy = st->readBytes = st->writtenBytes = 0;
+}
+
+void oocFini(ooc_state_t *st) {
+   for (unsigned int x = 0; x < 2; ++x) {
+      memFree(st->aPanel[x], st->aPanelBytes);
+      memFree(st->bPanel[x], st->bPanelBytes);
+      memFree(st->cPass[x], st->cPassBytes);
+   }
+   free(st->blocks);
+   close(st->fdA);
+   close(st->fdB);
+   close(st->fdC);
+}
+
+// Opens the matrix files in <dir> and generates the A and B ones, with the
+// values of matmulBench, unless they already have the size of the product.
+// C is cleared. Returns whether the inputs were generated
+unsigned int oocFiles(ooc_state_t *st, const char *dir, const unsigned int gen) {
+   const unsigned int m = st->m, n = st->n, k = st->k;
+   char dimsStr[48], name[96];
+   dimsString(dimsStr, m, n, k);
+   unsigned int existA, existB, existC;
+   st->fdA = oocOpen(dir, matrixFileName(name, dimsStr, gen, 'A'), (size_t)m*k*sizeof(elem_t), &existA);
+   st->fdB = oocOpen(dir, matrixFileName(name, dimsStr, gen, 'B'), (size_t)k*n*sizeof(elem_t), &existB);
+   st->fdC = oocOpen(dir, matrixFileName(name, dimsStr, gen, 'C'), (size_t)m*n*sizeof(acc_t), &existC);
+   oocZero(st->fdC, (size_t)m*n*sizeof(acc_t));
+   if (existA && existB) return 0;
+
+   //The seeds are drawn in the order of matmulBench, and each block row is written when complete
+   elem_t *aRow = (elem_t *)(memAlloc((size_t)BSIZE*k*sizeof(elem_t)));
+   elem_t *bRow = (elem_t *)(memAlloc((size_t)BSIZE*n*sizeof(elem_t)));
+   if (aRow == NULL || bRow == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the out-of-core inputs\n");
+      exit(1);
+   }
+   unsigned int const ablocks = numBlocks(m)*numBlocks(k);
+   unsigned int const bblocks = numBlocks(k)*numBlocks(n);
+   srand(2019);
+   for (unsigned int l = 0; l < ablocks || l < bblocks; l++) {
+      if (l < ablocks) {
+         unsigned int const i = l/numBlocks(k), j = l%numBlocks(k);
+         genBlock(aRow + (size_t)j*BSIZE*blockDim(m, i), gen, rand(), 0, m, k, i, j);
+         if (j == numBlocks(k) - 1) {
+            #pragma oss taskwait
+            oocWrite(st->fdA, aRow, (size_t)blockDim(m, i)*k*sizeof(elem_t), (off_t)i*BSIZE*k*sizeof(elem_t));
+         }
+      }
+      if (l < bblocks) {
+         unsigned int const i = l/numBlocks(n), j = l%numBlocks(n);
+         genBlock(bRow + (size_t)j*BSIZE*blockDim(k, i), gen, rand(), 1, k, n, i, j);
+         if (j == numBlocks(n) - 1) {
+            #pragma oss taskwait
+            oocWrite(st->fdB, bRow, (size_t)blockDim(k, i)*n*sizeof(elem_t), (off_t)i*BSIZE*n*sizeof(elem_t));
+         }
+      }
+   }
+   memFree(aRow, (size_t)BSIZE*k*sizeof(elem_t));
+   memFree(bRow, (size_t)BSIZE*n*sizeof(elem_t));
+   return 1;
+}
+
+// Runs and reports the configuration <cfg> out of core, with the matrices in
+// files of <cfg->oocDir> and at most <cfg->oocWindow> bytes of them in memory.
+// Writes its results as one JSON object into <res_file>. Returns the check result
+unsigned int oocBench(const bench_config_t *cfg, bench_pool_t *pool, FILE *res_file) {
+   unsigned int const msize = cfg->msize, nsize = cfg->nsize, ksize = cfg->ksize;
+   unsigned int const check = cfg->check, createFrom = cfg->createFrom;
+   unsigned int const warmup = cfg->warmup, minReps = cfg->minReps;
+   char const * createFromStr = createFrom == 0 ? "cFPGA" : "cHOST";
+   char dimsStr[48];
+   dimsString(dimsStr, msize, nsize, ksize);
+   double const flops = 2.0*msize*nsize*ksize;
+
+   unsigned int const rows = oocRowsPerPass(cfg->oocWindow, msize, nsize);
+   if (rows == 0) {
+      fprintf(stderr, "ERROR:\tThe out-of-core window must hold at least %zu bytes for %s\n",
+         2*(size_t)BSIZE*nsize*sizeof(elem_t) + 2*((size_t)BSIZE*BSIZE*sizeof(elem_t) + (size_t)BSIZE*nsize*sizeof(acc_t)),
+         dimsStr);
+      return 0;
+   }
+   ooc_state_t st;
+   oocInit(&st, msize, nsize, ksize, createFrom, rows);
+   const double tIniStart = wall_time();
+   const unsigned int generated = oocFiles(&st, cfg->oocDir, cfg->gen);
+   const double tEndStart = wall_time();
+   const double tIniWarm = tEndStart;
+
+   //Warm up executions
+   for (unsigned int r = 0; r < warmup; ++r) {
+      oocRun(&st);
+   }
+   const double tEndWarm = wall_time();
+   st.compute = st.ioWait = st.ioBusy = st.readBytes = st.writtenBytes = 0;
+
+   //Performance executions
+   unsigned int reps = 0;
+   double tExecSum = 0;
+   while (reps < minReps || tExecSum < cfg->minTime) {
+      if (reps == pool->repsCap) {
+         pool->repsCap *= 2;
+         pool->repTimes = (double *)(realloc(pool->repTimes, pool->repsCap*sizeof(double)));
+         if (pool->repTimes == NULL) {
+            fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+            exit(1);
+         }
+      }
+#if defined(MATMUL_EMU)
+      emuReset();
+#endif
+      const double tRep = wall_time();
+      oocRun(&st);
+      pool->repTimes[reps] = wall_time() - tRep;
+      tExecSum += pool->repTimes[reps++];
+   }
+   const double tIniCheck = wall_time();
 
+   //Check the output matrix, with the files mapped
+   check_stats_t checkStats;
+   checkStatsInit(&checkStats);
+   unsigned int check_ok = 1;
+   if (check != 0) {
+      const elem_t *a = (const elem_t *)oocMap(st.fdA, (size_t)msize*ksize*sizeof(elem_t));
+      const elem_t *b = (const elem_t *)oocMap(st.fdB, (size_t)ksize*nsize*sizeof(elem_t));
+      const acc_t *c = (const acc_t *)oocMap(st.fdC, (size_t)msize*nsize*sizeof(acc_t));
+      if (a == NULL || b == NULL || c == NULL) {
+         fprintf(stderr, "ERROR:\tCannot map the matrix files\n");
+         exit(1);
+      }
+      check_ok = matmulCheck(check, a, b, c, msize, nsize, ksize, warmup + reps, cfg->gen, 1, &checkStats);
+      oocUnmap(a, (size_t)msize*ksize*sizeof(elem_t));
+      oocUnmap(b, (size_t)ksize*nsize*sizeof(elem_t));
+      oocUnmap(c, (size_t)msize*nsize*sizeof(acc_t));
+   }
+#if defined(MATMUL_CORE_SYSTOLIC) && defined(MATMUL_EMU)
+   check_ok = check_ok && emu.coreMismatches == 0;
+#endif
    const double tEndCheck = wall_time();
 
-   free(a);
-   free(b);
-   free(c);
+   rep_stats_t timeStats, gflopsStats;
+   double* repGflops = (double *)(malloc(reps*sizeof(double)));
+   if (repGflops == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the timings\n");
+      exit(1);
+   }
+   for (unsigned int r = 0; r < reps; ++r) {
+      repGflops[r] = flops/1e9/pool->repTimes[r];
+   }
+   repStats(repGflops, reps, &gflopsStats);
+   repStats(pool->repTimes, reps, &timeStats);
+   free(repGflops);
+   const double window = 2.0*(st.aPanelBytes + st.bPanelBytes + st.cPassBytes);
 
-   //Print the execution report
-   const float gflops = m2size/1000.0*msize/1000.0*2.0/1000.0/(tEndExec - tIniExec);
    printf( "==================== RESULTS ===================== \n" );
    printf( "  Benchmark: %s (%s)\n", "Matmul", "OmpSs" );
    printf( "  Elements type: %s\n", ELEM_T_STR );
+   printf( "  Matrix size: %s\n", dimsStr );
    printf( "  Create from: %s\n", createFromStr );
+   printf( "  Inputs:                %s\n", REF_GEN_STR[cfg->gen] );
+   printf( "  Affinity:              %s\n", AFF_STR[aff.policy] );
+   printf( "  Out-of-core dir.:      %s (inputs %s)\n", cfg->oocDir, generated ? "generated" : "reused" );
+   printf( "  Window (MiB):          %f, %u C block rows per pass, %u passes\n", window/1048576.0, st.rows, st.passes );
    printf( "  Init. time (secs):     %f\n", tEndStart  - tIniStart );
+   printf( "  Warm up runs:          %u\n", warmup );
    printf( "  Warm up time (secs):   %f\n", tEndWarm   - tIniWarm );
-   printf( "  Execution time (secs): %f\n", tEndExec   - tIniExec );
-   printf( "  Flush time (secs):     %f\n", tEndFlush  - tIniFlush );
+   printf( "  Timed runs:            %u\n", reps );
+   printf( "  Execution time (secs): %f\n", timeStats.median );
    printf( "  Checking time (secs):  %f\n", tEndCheck  - tIniCheck );
-   printf( "  Performance (GFLOPS):  %f\n", gflops );
+   printf( "  Performance (GFLOPS):  %f\n", gflopsStats.median );
+   printf( "  Timed runs     Time (secs)     GFLOPS\n" );
+   printf( "    min          %-15f %f\n", timeStats.min, gflopsStats.min );
+   printf( "    median       %-15f %f\n", timeStats.median, gflopsStats.median );
+   printf( "    mean         %-15f %f\n", timeStats.mean, gflopsStats.mean );
+   printf( "    stddev       %-15f %f\n", timeStats.stddev, gflopsStats.stddev );
+   printf( "    p95          %-15f %f\n", timeStats.p95, gflopsStats.p95 );
+   printf( "  Per run compute (secs): %f\n", st.compute/reps );
+   printf( "  Per run I/O wait (secs): %f\n", st.ioWait/reps );
+   printf( "  Per run I/O busy (secs): %f\n", st.ioBusy/reps );
+   printf( "  Per run read (MiB):    %f\n", st.readBytes/reps/1048576.0 );
+   printf( "  Per run written (MiB): %f\n", st.writtenBytes/reps/1048576.0 );
+   printf( "  I/O bandwidth (MB/s):  %f\n", st.ioBusy > 0 ? (st.readBytes + st.writtenBytes)/1e6/st.ioBusy : 0 );
+#if defined(MATMUL_EMU)
+   emuReport(flops);
+#endif
    printf( "================================================== \n" );
 
-   //Create the JSON result file
-   FILE *res_file = fopen("test_result.json", "w+");
-   if (res_file == NULL) {
-      printf( "Cannot open 'test_result.json' file\n" );
-      exit(1);
-   }
    fprintf(res_file,
       "{ \
          \"benchmark\": \"%s\", \
@@ -358,27 +3546,412 @@ int main(int argc, char** argv) {
          \"board\": \"%s\", \
          \"version\": \"%uaccs %uBS kij memport_128 noflush\", \
          \"exectype\": \"%s\", \
-         \"argv\": \"%d %d %s\", \
+         \"argv\": \"ooc %s %d %s\", \
+         \"warmup\": \"%u\", \
+         \"reps\": \"%u\", \
          \"exectime\": \"%f\", \
          \"performance\": \"%f\", \
-         \"note\": \"datatype %s, init %f, warm %f, exec %f, flush %f, check %f\" \
-      }",
+         \"exectime_min\": \"%f\", \"exectime_median\": \"%f\", \"exectime_mean\": \"%f\", \"exectime_stddev\": \"%f\", \"exectime_p95\": \"%f\", \
+         \"performance_min\": \"%f\", \"performance_median\": \"%f\", \"performance_mean\": \"%f\", \"performance_stddev\": \"%f\", \"performance_p95\": \"%f\", \
+         \"ooc_window\": \"%.0f\", \"ooc_rows\": \"%u\", \"ooc_passes\": \"%u\", \
+         \"ooc_compute\": \"%f\", \"ooc_io_wait\": \"%f\", \"ooc_io_busy\": \"%f\", \"ooc_read\": \"%.0f\", \"ooc_written\": \"%.0f\", \
+         \"note\": \"datatype %s, init %f, warm %f, exec %f, check %f\"",
       "matmul",
       "ompss-2",
       BOARD,
       MBLOCK_NUM_ACCS, BSIZE,
       RUNTIME_MODE,
-      msize, BSIZE, createFromStr,
-      tEndExec - tIniExec,
-      gflops,
+      dimsStr, BSIZE, createFromStr,
+      warmup,
+      reps,
+      timeStats.median,
+      gflopsStats.median,
+      timeStats.min, timeStats.median, timeStats.mean, timeStats.stddev, timeStats.p95,
+      gflopsStats.min, gflopsStats.median, gflopsStats.mean, gflopsStats.stddev, gflopsStats.p95,
+      window, st.rows, st.passes,
+      st.compute/reps, st.ioWait/reps, st.ioBusy/reps, st.readBytes/reps, st.writtenBytes/reps,
       ELEM_T_STR,
       tEndStart - tIniStart,
       tEndWarm - tIniWarm,
-      tEndExec - tIniExec,
-      tEndFlush - tIniFlush,
+      timeStats.median,
       tEndCheck - tIniCheck
    );
-   fclose(res_file);
+#if defined(MATMUL_EMU)
+   fprintf(res_file,
+      ", \"emu_task_cycles\": \"%llu\", \"emu_exectime\": \"%f\", \"emu_performance\": \"%f\", \"emu_traffic_ab\": \"%llu\", \"emu_traffic_c\": \"%llu\", \"emu_c_transfers\": \"%llu\", \"emu_c_avoided\": \"%llu\"",
+      (unsigned long long)emu.task.total,
+      emuSeconds(emu.makespan),
+      flops/1e9/emuSeconds(emu.makespan),
+      (unsigned long long)emu.bytesAB, (unsigned long long)emu.bytesC,
+      (unsigned long long)emu.cTransfers, (unsigned long long)emu.cAvoided
+   );
+#endif
+   if (check == 1 || check == 3 || check == 4) {
+      fprintf(res_file,
+         ", \"check_max_abs_err\": \"%e\", \"check_max_rel_err\": \"%e\", \"check_mismatches\": \"%llu\"",
+         checkStats.maxAbsErr, checkStats.maxRelErr, checkStats.mismatches
+      );
+   }
+   fprintf(res_file, ", \"inputs\": \"%s\", \"affinity\": \"%s\"", REF_GEN_STR[cfg->gen], AFF_STR[aff.policy]);
+   fprintf(res_file, " }");
+   oocFini(&st);
+   return check_ok;
+}
+
+// Splits the comma separated list <str> into <items>. Returns the number of
+// items, or 0 if there are more than SWEEP_MAX_VALUES or some is empty
+unsigned int splitList(char *str, char **items) {
+   unsigned int n = 0;
+   for (char *item = str; item != NULL; ++n) {
+      char *next = strchr(item, ',');
+      if (next != NULL) *next++ = '\0';
+      if (n == SWEEP_MAX_VALUES || *item == '\0') return 0;
+      items[n] = item;
+      item = next;
+   }
+   return n;
+}
+
+int main(int argc, char** argv) {
+   static const struct option longOpts[] = {
+      { "size",        required_argument, NULL, 's' },
+      { "check",       required_argument, NULL, 'c' },
+      { "create-from", required_argument, NULL, 'f' },
+      { "order",       required_argument, NULL, 'o' },
+      { "warmup",      required_argument, NULL, 'w' },
+      { "reps",        required_argument, NULL, 'r' },
+      { "min-time",    required_argument, NULL, 't' },
+      { "layout",      required_argument, NULL, 'L' },
+      { "huge",        required_argument, NULL, 'H' },
+      { "numa",        required_argument, NULL, 'N' },
+      { "strassen",    required_argument, NULL, 'S' },
+      { "grain",       required_argument, NULL, 'g' },
+      { "batch",       required_argument, NULL, 'b' },
+      { "grid",        required_argument, NULL, 'P' },
+      { "ooc",         required_argument, NULL, 'O' },
+      { "window",      required_argument, NULL, 'W' },
+      { "generator",   required_argument, NULL, 'G' },
+      { "inputs",      required_argument, NULL, 'I' },
+      { "affinity",    required_argument, NULL, 'a' },
+      { "jsonl",       required_argument, NULL, 'j' },
+      { "help",        no_argument,       NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+   };
+   //Options with lists of values are swept over their cartesian product
+   char *items[SWEEP_MAX_VALUES];
+   unsigned int sizes[SWEEP_MAX_VALUES][3], createFroms[SWEEP_MAX_VALUES], repsList[SWEEP_MAX_VALUES], grains[SWEEP_MAX_VALUES];
+   order_t orders[SWEEP_MAX_VALUES];
+   unsigned int numSizes = 0, numCreateFroms = 1, numOrders = 1, numReps = 1, numGrains = 1;
+   createFroms[0] = 0;
+   grains[0] = 0;
+   orders[0] = ORDER_DEFAULT;
+   repsList[0] = 1;
+   unsigned int check = 0, warmup = 1, batch = 0, strassenCutoff = 0;
+   unsigned int gridP = 0, gridQ = 0;
+   const char *oocDir = NULL;
+   unsigned int oocWindowMiB = 1024;
+   unsigned int gen = REF_GEN_BLOCK_LCG;
+   const char *inputDir = NULL;
+   aff_policy_t affinity = AFF_RR;
+   double minTime = 0;
+   const char *jsonlFile = NULL;
+   layout_t layout = LAYOUT_BLOCKED;
+   mem_huge_t huge = MEM_HUGE_THP;
+   mem_numa_t numa = MEM_NUMA_LOCAL;
+   int opt;
+   distInit(&argc, &argv);
+   while ((opt = getopt_long(argc, argv, "s:c:f:o:w:r:t:L:H:N:S:g:b:P:O:W:G:I:a:j:h", longOpts, NULL)) != -1) {
+      int valid = 1;
+      unsigned int n = 0;
+      char *end;
+      switch (opt) {
+         case 's':
+            valid = (numSizes = n = splitList(optarg, items)) > 0;
+            for (unsigned int i = 0; i < n && valid; ++i) {
+               valid = parseDims(items[i], sizes[i]) == 0;
+            }
+            break;
+         case 'f':
+            valid = (numCreateFroms = n = splitList(optarg, items)) > 0;
+            for (unsigned int i = 0; i < n && valid; ++i) {
+               valid = parseUInt(items[i], &createFroms[i]) == 0 && createFroms[i] <= 2;
+            }
+            break;
+         case 'o':
+            valid = (numOrders = n = splitList(optarg, items)) > 0;
+            for (unsigned int i = 0; i < n && valid; ++i) {
+               valid = (orders[i] = parseOrder(items[i])) != ORDER_NUM;
+            }
+            break;
+         case 'r':
+            valid = (numReps = n = splitList(optarg, items)) > 0;
+            for (unsigned int i = 0; i < n && valid; ++i) {
+               valid = parseUInt(items[i], &repsList[i]) == 0 && repsList[i] > 0;
+            }
+            break;
+         case 'g':
+            valid = (numGrains = n = splitList(optarg, items)) > 0;
+            for (unsigned int i = 0; i < n && valid; ++i) {
+               valid = parseUInt(items[i], &grains[i]) == 0;
+            }
+            break;
+         case 'c': valid = parseUInt(optarg, &check) == 0 && check <= 4; break;
+         case 'w': valid = parseUInt(optarg, &warmup) == 0; break;
+         case 't': minTime = strtod(optarg, &end); valid = *end == '\0' && end != optarg && minTime >= 0; break;
+         case 'L': valid = (layout = parseLayout(optarg)) != LAYOUT_NUM; break;
+         case 'H': valid = (huge = memParse(optarg, MEM_HUGE_STR, MEM_HUGE_NUM)) != MEM_HUGE_NUM; break;
+         case 'N': valid = (numa = memParse(optarg, MEM_NUMA_STR, MEM_NUMA_NUM)) != MEM_NUMA_NUM; break;
+         case 'S': valid = parseUInt(optarg, &strassenCutoff) == 0; break;
+         case 'b': valid = parseUInt(optarg, &batch) == 0; break;
+         case 'P': valid = distParseGrid(optarg, &gridP, &gridQ) == 0; break;
+         case 'O': oocDir = optarg; break;
+         case 'W': valid = parseUInt(optarg, &oocWindowMiB) == 0 && oocWindowMiB > 0; break;
+         case 'G': valid = (gen = memParse(optarg, REF_GEN_STR, REF_GEN_FILE)) != REF_GEN_FILE; break;
+         case 'I': inputDir = optarg; break;
+         case 'a': valid = (affinity = (aff_policy_t)memParse(optarg, AFF_STR, AFF_NUM)) != AFF_NUM; break;
+         case 'j': jsonlFile = optarg; break;
+         case 'h': usage(argv[0]); exit(0);
+         default: valid = 0; optarg = NULL; break;
+      }
+      if (!valid) {
+         if (optarg != NULL) {
+            fprintf(stderr, "ERROR:\tInvalid value in option -%c\n", opt);
+         }
+         usage(argv[0]);
+         exit(1);
+      }
+   }
+   if (numSizes == 0 || optind != argc) {
+      usage(argv[0]);
+      exit(1);
+   }
+   //The external layouts are multiplied through the library API
+   const unsigned int api = layout != LAYOUT_BLOCKED;
+   if (api) {
+      unsigned int valid = batch == 0 && strassenCutoff == 0;
+      for (unsigned int i = 0; i < numCreateFroms; ++i) {
+         valid = valid && createFroms[i] <= 1;
+      }
+      for (unsigned int i = 0; i < numGrains; ++i) {
+         valid = valid && grains[i] == 0;
+      }
+      if (!valid) {
+         fprintf(stderr, "ERROR:\tThe row and col layouts run through the library API, which needs create from 0 or 1, and no -S, -g or -b\n");
+         exit(1);
+      }
+   }
+   for (unsigned int g = 0; g < numGrains; ++g) {
+      unsigned int valid = grains[g] == 0 || batch == 0;
+      for (unsigned int i = 0; i < numCreateFroms; ++i) {
+#if !defined(MATMUL_KCHAIN)
+         //The k-chain accelerator is not in the bitstream
+         valid = valid && (grains[g] == 0 || createFroms[i] != 0);
+#endif
+         valid = valid && (grains[g] == 0 || createFroms[i] != 2);
+      }
+      if (!valid) {
+         fprintf(stderr, "ERROR:\tk-chain tasks need create from 1, or 0 when built with MATMUL_KCHAIN, and no batch\n");
+         exit(1);
+      }
+   }
+   if (strassenCutoff > 0) {
+      unsigned int valid = batch == 0;
+      for (unsigned int i = 0; i < numCreateFroms; ++i) {
+         valid = valid && createFroms[i] <= 1;
+      }
+#if defined(USE_INT8)
+      //The quadrant sums would overflow the elements
+      valid = 0;
+#endif
+      if (!valid) {
+         fprintf(stderr, "ERROR:\tStrassen needs create from 0 or 1, no batch, the blocked layout and no int8 elements\n");
+         exit(1);
+      }
+   }
+   //Distributed over a grid of processes when asked for or when there are several
+   const unsigned int distributed = gridP > 0 || dist.size > 1;
+   if (distributed) {
+      unsigned int valid = batch == 0 && strassenCutoff == 0 && layout == LAYOUT_BLOCKED;
+      for (unsigned int i = 0; i < numCreateFroms; ++i) {
+         valid = valid && createFroms[i] <= 1;
+      }
+      for (unsigned int i = 0; i < numOrders; ++i) {
+         valid = valid && orders[i] == ORDER_DEFAULT;
+      }
+      for (unsigned int i = 0; i < numGrains; ++i) {
+         valid = valid && grains[i] == 0;
+      }
+      if (!valid) {
+         fprintf(stderr, "ERROR:\tThe distributed product needs create from 0 or 1, the default order, the blocked layout, and no -S, -g or -b\n");
+         exit(1);
+      }
+      if (distGrid(gridP, gridQ) != 0) {
+         fprintf(stderr, "ERROR:\tThe %ux%u grid does not match the %d processes\n", gridP, gridQ, dist.size);
+         exit(1);
+      }
+   }
+   if (oocDir != NULL) {
+      unsigned int valid = batch == 0 && strassenCutoff == 0 && layout == LAYOUT_BLOCKED && !distributed;
+      for (unsigned int i = 0; i < numCreateFroms; ++i) {
+         valid = valid && createFroms[i] <= 1;
+      }
+      for (unsigned int i = 0; i < numOrders; ++i) {
+         valid = valid && orders[i] == ORDER_DEFAULT;
+      }
+      for (unsigned int i = 0; i < numGrains; ++i) {
+         valid = valid && grains[i] == 0;
+      }
+      if (!valid) {
+         fprintf(stderr, "ERROR:\tThe out-of-core product needs create from 0 or 1, the default order, the blocked layout, a single process, and no -S, -g or -b\n");
+         exit(1);
+      }
+   }
+   if (inputDir != NULL && (batch > 0 || layout != LAYOUT_BLOCKED || distributed || oocDir != NULL)) {
+      fprintf(stderr, "ERROR:\tThe input files need the blocked layout, a single process, and no -b or -O\n");
+      exit(1);
+   }
+   if (batch > 0) {
+      unsigned int valid = (check == 0 || check == 4) && layout == LAYOUT_BLOCKED;
+      for (unsigned int i = 0; i < numCreateFroms; ++i) {
+         valid = valid && createFroms[i] <= 1;
+      }
+      if (!valid) {
+         fprintf(stderr, "ERROR:\tBatch mode only supports checks 0 and 4, create from 0 and 1, and the blocked layout\n");
+         exit(1);
+      }
+   }
+
+   //The buffers are allocated once for the largest configuration. Batches allocate their own
+   size_t asizeMax = 0, bsizeMax = 0, m2sizeMax = 0, blocksMax = 0, batchBlocks = 0;
+   for (unsigned int i = 0; i < numSizes; ++i) {
+      size_t const asize = (size_t)sizes[i][0]*sizes[i][2];
+      size_t const bsize = (size_t)sizes[i][2]*sizes[i][1];
+      size_t const m2size = (size_t)sizes[i][0]*sizes[i][1];
+      size_t const nblocks = (size_t)numBlocks(sizes[i][0])*numBlocks(sizes[i][1]);
+      asizeMax = asize > asizeMax ? asize : asizeMax;
+      bsizeMax = bsize > bsizeMax ? bsize : bsizeMax;
+      m2sizeMax = m2size > m2sizeMax ? m2size : m2sizeMax;
+      blocksMax = nblocks > blocksMax ? nblocks : blocksMax;
+   }
+   for (unsigned int l = 0; l < batch; ++l) {
+      batchBlocks += (size_t)numBlocks(sizes[l%numSizes][0])*numBlocks(sizes[l%numSizes][1]);
+   }
+   bench_pool_t pool;
+   memInit(huge, numa);
+   affInit(affinity);
+   //When distributed, the global matrices are only used by process 0 to check the result
+   //Out of core, the matrices are only in their files
+   const unsigned int global = oocDir == NULL && (!distributed || (dist.rank == 0 && check != 0));
+   //Input files are mapped instead of copied into A and B
+   const unsigned int generated = inputDir == NULL;
+   pool.aBytes = global*generated*asizeMax*sizeof(elem_t);
+   pool.bBytes = global*generated*bsizeMax*sizeof(elem_t);
+   pool.cBytes = global*m2sizeMax*sizeof(acc_t);
+   pool.a = (elem_t *)(memAlloc(pool.aBytes));
+   pool.b = (elem_t *)(memAlloc(pool.bBytes));
+   pool.c = (acc_t *)(memAlloc(pool.cBytes));
+   pool.extA = pool.extB = NULL;
+   pool.extC = NULL;
+   if (layout != LAYOUT_BLOCKED) {
+      pool.extA = (elem_t *)(memAlloc(pool.aBytes));
+      pool.extB = (elem_t *)(memAlloc(pool.bBytes));
+      pool.extC = (acc_t *)(memAlloc(pool.cBytes));
+      if (pool.extA == NULL || pool.extB == NULL || pool.extC == NULL) {
+         fprintf(stderr, "ERROR:\tCannot allocate memory for the matrices\n");
+         exit(1);
+      }
+      //Fault the output pages in, as a caller provided buffer would be
+      memset(pool.extC, 0, pool.cBytes);
+   }
+   pool.blocks = (unsigned int *)(malloc((blocksMax + 1)*sizeof(unsigned int)));
+   //Time of each timed execution, grown when the minimum time is not reached
+   pool.repsCap = 1;
+   for (unsigned int i = 0; i < numReps; ++i) {
+      pool.repsCap = repsList[i] > pool.repsCap ? repsList[i] : pool.repsCap;
+   }
+   pool.repTimes = (double *)(malloc(pool.repsCap*sizeof(double)));
+   if (pool.a == NULL || pool.b == NULL || pool.c == NULL || pool.blocks == NULL || pool.repTimes == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the matrices\n");
+      exit(1);
+   }
+   pool.smpKernel = smpKernelInit();
+#if defined(MATMUL_EMU)
+   //The Strassen products of the last level add up to 7/4 of the C blocks
+   emuInit(BSIZE, (batchBlocks > blocksMax ? batchBlocks : blocksMax)*(strassenCutoff > 0 ? 3 : 1));
+#endif
+
+   //Compare the SMP block kernel against the naive loop
+   smpKernelBench(BSIZE, &pool.smpGflopsNaive, &pool.smpGflopsKernel);
 
-   return check_ok ? 0 : 1;
+   //Create the JSON result file, or append one line per configuration when sweeping
+   const unsigned int numConfigs = (batch > 0 ? 1 : numSizes)*numCreateFroms*numOrders*numReps*numGrains;
+   if (jsonlFile == NULL && numConfigs > 1) {
+      jsonlFile = "test_results.jsonl";
+   }
+   const char *resFilename = jsonlFile != NULL ? jsonlFile : "test_result.json";
+   FILE *res_file = dist.rank == 0 ? fopen(resFilename, jsonlFile != NULL ? "a" : "w+") : NULL;
+   if (res_file == NULL && dist.rank == 0) {
+      printf( "Cannot open '%s' file\n", resFilename );
+      exit(1);
+   }
+
+   const double tIniSweep = wall_time();
+   unsigned int failed = 0;
+   //All the sizes are run together in batch mode
+   for (unsigned int s = 0; s < (batch > 0 ? 1 : numSizes); ++s) {
+      for (unsigned int f = 0; f < numCreateFroms; ++f) {
+         for (unsigned int o = 0; o < numOrders; ++o) {
+            for (unsigned int r = 0; r < numReps; ++r) {
+               for (unsigned int g = 0; g < numGrains; ++g) {
+                  const bench_config_t cfg = { sizes[s][0], sizes[s][1], sizes[s][2], check, createFroms[f], orders[o],
+                     layout, warmup, repsList[r], minTime, api, strassenCutoff, grains[g], oocDir,
+                     (size_t)oocWindowMiB << 20, inputDir != NULL ? REF_GEN_FILE : gen, inputDir };
+                  if (batch > 0) {
+                     failed += !matmulBatchBench(&cfg, (const unsigned int (*)[3])sizes, numSizes, batch, &pool, res_file);
+                  } else if (distributed) {
+                     failed += !summaBench(&cfg, &pool, res_file);
+                  } else if (oocDir != NULL) {
+                     failed += !oocBench(&cfg, &pool, res_file);
+                  } else {
+                     failed += !matmulBench(&cfg, &pool, res_file);
+                  }
+                  if (jsonlFile != NULL && res_file != NULL) {
+                     fprintf(res_file, "\n");
+                     fflush(res_file);
+                  }
+               }
+            }
+         }
+      }
+   }
+   if (res_file != NULL) {
+      fclose(res_file);
+   }
+   if (numConfigs > 1 && dist.rank == 0) {
+      printf( "===================== SWEEP ====================== \n" );
+      printf( "  Configurations:        %u\n", numConfigs );
+      printf( "  Failed checks:         %u\n", failed );
+      printf( "  Sweep time (secs):     %f\n", wall_time() - tIniSweep );
+      printf( "  Results file:          %s\n", resFilename );
+      printf( "================================================== \n" );
+   }
+
+   memFree(pool.a, pool.aBytes);
+   memFree(pool.b, pool.bBytes);
+   memFree(pool.c, pool.cBytes);
+   if (layout != LAYOUT_BLOCKED) {
+      memFree(pool.extA, pool.aBytes);
+      memFree(pool.extB, pool.bBytes);
+      memFree(pool.extC, pool.cBytes);
+   }
+   free(pool.blocks);
+   free(pool.repTimes);
+   if (api) ompss_gemm_fini();
+   smpFreeBuffers();
+   TRACE_FINI();
+   distFini();
+
+   return failed == 0 ? 0 : 1;
 }
+
+#endif // !defined(MATMUL_LIB)
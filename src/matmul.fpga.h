@@ -1,2 +1,51 @@
-typedef float      elem_t;
-#define ELEM_T_STR "float"
+#ifndef _MATMUL_FPGA_H_
+#define _MATMUL_FPGA_H_
+
+// Elements type of A and B (elem_t), and of C and the block accumulation (acc_t).
+// ELEM_ACC converts an element to the accumulation type and ELEM_SET a value to an element
+#if defined(USE_DOUBLE)
+   typedef double     elem_t;
+   typedef double     acc_t;
+#  define  ELEM_T_STR "double"
+#  define  ELEM_ACC(x) ((acc_t)(x))
+#  define  ELEM_SET(x) ((elem_t)(x))
+#elif defined(USE_HALF)
+   typedef _Float16   elem_t;
+   typedef float      acc_t;
+#  define  ELEM_T_STR "half"
+#  define  ELEM_ACC(x) ((acc_t)(x))
+#  define  ELEM_SET(x) ((elem_t)(x))
+#elif defined(USE_BFLOAT16)
+   //Stored as the upper half of a float
+   typedef unsigned short elem_t;
+   typedef float      acc_t;
+#  define  ELEM_T_STR "bfloat16"
+#  define  ELEM_ACC(x) bfloat16ToFloat(x)
+#  define  ELEM_SET(x) floatToBfloat16(x)
+   static inline float bfloat16ToFloat(const unsigned short x) {
+      union { unsigned int u; float f; } v;
+      v.u = (unsigned int)x << 16;
+      return v.f;
+   }
+   //Rounds to nearest even
+   static inline unsigned short floatToBfloat16(const float x) {
+      union { unsigned int u; float f; } v;
+      v.f = x;
+      return (unsigned short)((v.u + 0x7FFF + ((v.u >> 16) & 1)) >> 16);
+   }
+#elif defined(USE_INT8)
+   typedef signed char elem_t;
+   typedef int        acc_t;
+#  define  ELEM_T_STR "int8"
+#  define  ELEM_ACC(x) ((acc_t)(x))
+#  define  ELEM_SET(x) ((elem_t)(x))
+#else
+   typedef float      elem_t;
+   typedef float      acc_t;
+#  define  ELEM_T_STR "float"
+#  define  ELEM_T_FLOAT
+#  define  ELEM_ACC(x) ((acc_t)(x))
+#  define  ELEM_SET(x) ((elem_t)(x))
+#endif
+
+#endif /* _MATMUL_FPGA_H_ */
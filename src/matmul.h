@@ -53,31 +53,74 @@
 #ifndef FPGA_MEMORY_PORT_WIDTH
 #  error FPGA_MEMORY_PORT_WIDTH variable not defined
 #endif
+// FPGA kernel of the interior C blocks created from the FPGA: one matmulBlock
+// task per block product (block, default), or one output-stationary
+// matmulChain task per C block (os), which needs its accelerator
+#if defined(MATMUL_KERNEL_OS)
+#  define MATMUL_KERNEL_STR "os"
+#  ifndef MATMUL_KCHAIN
+#    define MATMUL_KCHAIN
+#  endif
+#else
+#  define MATMUL_KERNEL_STR "block"
+#endif
+// Compute core of the FPGA kernels: the kij loop nest pipelined with
+// MATMUL_BLOCK_II, which has BSIZE/II multipliers (flat, default), or a
+// MATMUL_PE_ROWS x MATMUL_PE_COLS systolic array (systolic)
+#if defined(MATMUL_CORE_SYSTOLIC)
+#  if !defined(MATMUL_PE_ROWS) || !defined(MATMUL_PE_COLS)
+#    error MATMUL_PE_ROWS and MATMUL_PE_COLS variables not defined
+#  endif
+#  if MATMUL_PE_ROWS < 1 || MATMUL_PE_COLS < 1 || MATMUL_BLOCK_SIZE%MATMUL_PE_ROWS != 0 || MATMUL_BLOCK_SIZE%MATMUL_PE_COLS != 0
+#    error MATMUL_PE_ROWS and MATMUL_PE_COLS must divide MATMUL_BLOCK_SIZE
+#  endif
+#  define MATMUL_CORE_STR   "systolic"
+#  define MATMUL_CORE_UNITS (MATMUL_PE_ROWS*MATMUL_PE_COLS)
+#else
+#  define MATMUL_CORE_STR   "flat"
+#  define MATMUL_CORE_UNITS (MATMUL_BLOCK_SIZE/MATMUL_BLOCK_II)
+#endif
 
 // Global variables
-const float THRESHOLD = 1e-4;
 //const unsigned int BSIZE = MATMUL_BLOCK_SIZE;
 //const unsigned int MBLOCK_II = MATMUL_BLOCK_II;
 //const unsigned int MBLOCK_FPGA_PWIDTH = FPGA_MEMORY_PORT_WIDTH;
 //const unsigned int MBLOCK_NUM_ACCS = MATMUL_NUM_ACCS;
 
-// Elements type
-//#if defined(USE_DOUBLE)
-//   typedef double     elem_t;
-//#  define  ELEM_T_STR "double"
-//#else
-//   typedef float      elem_t;
-//#  define  ELEM_T_STR "float"
-//#endif /* defined(USE_FLOAT) */
+// Elements type, see matmul.fpga.h. The tolerance of the reference check is
+// the relative error allowed on each C element, and the machine epsilon of
+// the C accumulation bounds the error of the reference-free check. Half and
+// bfloat16 products are exact in the float accumulation, and int8 products
+// are checked exactly (the int32 C must not overflow, reps*k*127*127 < 2^31)
+#if defined(USE_DOUBLE)
+const float THRESHOLD = 1e-10;
+#  define  ACC_T_EPSILON DBL_EPSILON
+#elif defined(USE_INT8)
+const float THRESHOLD = 0;
+#  define  ACC_T_EPSILON DBL_EPSILON
+#else
+const float THRESHOLD = 1e-4;
+#  define  ACC_T_EPSILON FLT_EPSILON
+#endif
+// Machine epsilon of the elements type, which rounds the Strassen quadrant sums
+#if defined(USE_HALF)
+#  define  ELEM_T_EPSILON 9.765625e-4
+#elif defined(USE_BFLOAT16)
+#  define  ELEM_T_EPSILON 7.8125e-3
+#else
+#  define  ELEM_T_EPSILON ACC_T_EPSILON
+#endif
 
-// MKL/OpenBLAS interface
+// MKL/OpenBLAS interface, only for float and double elements
 #if defined(USE_DOUBLE)
 #  define  GEMM       DGEMM
 #  define  cblas_gemm cblas_dgemm
-#else
+#  define  ELEM_T_BLAS
+#elif !defined(USE_HALF) && !defined(USE_BFLOAT16) && !defined(USE_INT8)
 #  define  GEMM       SGEMM
 #  define  cblas_gemm cblas_sgemm
-#endif /* defined(USE_FLOAT) */
+#  define  ELEM_T_BLAS
+#endif
 
 double wall_time () {
    struct timespec ts;
@@ -0,0 +1,98 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Placement of the block product tasks on the matmulBlock instances. All the
+// block products of a C block (its k-chain) get the affinity of one instance,
+// so its k steps run one after the other there and the C block can stay in
+// the instance between them instead of being copied in and out by each one.
+// The instances are chosen on the host for each product: the <chains> k-chains
+// of a product go, in creation order, to consecutive instances starting at the
+// one returned by affFirst. The tasks created from the FPGA compute their
+// instance from the position of the C block in the same way.
+
+#ifndef _MATMUL_AFFINITY_H_
+#define _MATMUL_AFFINITY_H_
+
+#include <string.h>
+
+// Affinity of the tasks that can run in any instance
+#define AFF_ANY 0xFF
+
+typedef enum {
+   AFF_NONE = 0,        // Any instance, chosen by the runtime
+   AFF_RR,              // Round robin, continuing from the last chain of the previous product
+   AFF_LOAD,            // Starting at the instance with the fewest block products assigned
+   AFF_NUM
+} aff_policy_t;
+
+static const char * const AFF_STR[AFF_NUM] = { "none", "rr", "load" };
+
+typedef struct {
+   aff_policy_t policy;
+   unsigned long long next;                  // Round robin position of the next chain
+   unsigned long long load[MATMUL_NUM_ACCS]; // Block products assigned to each instance
+} aff_state_t;
+
+static aff_state_t aff = { AFF_RR, 0, { 0 } };
+
+void affInit(const aff_policy_t policy) {
+   aff.policy = policy;
+   aff.next = 0;
+   memset(aff.load, 0, sizeof(aff.load));
+}
+
+// Returns the instance of the first of <chains> k-chains of <kblocks> block
+// products, or AFF_ANY without affinity. The products of a batch are created
+// concurrently, so the cursor and the loads are updated atomically, and the
+// loads read by the load-aware choice may miss the products being assigned
+unsigned int affFirst(const unsigned int chains, const unsigned int kblocks) {
+   if (aff.policy == AFF_NONE || chains == 0) return AFF_ANY;
+   if (aff.policy == AFF_RR) {
+      return __atomic_fetch_add(&aff.next, chains, __ATOMIC_RELAXED)%MATMUL_NUM_ACCS;
+   }
+   unsigned int first = 0;
+   unsigned long long minLoad = __atomic_load_n(&aff.load[0], __ATOMIC_RELAXED);
+   for (unsigned int i = 1; i < MATMUL_NUM_ACCS; ++i) {
+      const unsigned long long load = __atomic_load_n(&aff.load[i], __ATOMIC_RELAXED);
+      if (load < minLoad) {
+         first = i;
+         minLoad = load;
+      }
+   }
+   for (unsigned int i = 0; i < MATMUL_NUM_ACCS && i < chains; ++i) {
+      const unsigned long long n = chains/MATMUL_NUM_ACCS + (i < chains%MATMUL_NUM_ACCS);
+      __atomic_fetch_add(&aff.load[(first + i)%MATMUL_NUM_ACCS], n*kblocks, __ATOMIC_RELAXED);
+   }
+   return first;
+}
+
+// Instance of the <l>-th k-chain of a product whose first one goes to <first>
+static inline unsigned int affInstance(const unsigned int first, const unsigned int l) {
+   return first == AFF_ANY ? AFF_ANY : (first + l)%MATMUL_NUM_ACCS;
+}
+
+#endif /* _MATMUL_AFFINITY_H_ */
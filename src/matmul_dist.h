@@ -0,0 +1,203 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Process grid of the distributed products. The processes form a P x Q grid,
+// ranked in row-major order, with one communicator per grid row and one per
+// grid column for the panel broadcasts. Built with MATMUL_MPI the processes
+// are the ones of MPI_COMM_WORLD; otherwise there is a single process and
+// the communication calls do nothing, so the same code runs on a 1x1 grid.
+// MPI is only called from the thread creating the tasks, one call at a time.
+
+#ifndef _MATMUL_DIST_H_
+#define _MATMUL_DIST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(MATMUL_MPI)
+#  include <mpi.h>
+#endif
+
+// Bytes of each message, the MPI counts are int
+#define DIST_CHUNK (1UL << 30)
+
+typedef struct {
+   int rank, size;           // Process in the whole job
+   unsigned int p, q;        // Grid rows and columns
+   unsigned int pr, pc;      // Grid coordinates of this process
+#if defined(MATMUL_MPI)
+   MPI_Comm rowComm;         // Processes of the grid row, ranked by grid column
+   MPI_Comm colComm;         // Processes of the grid column, ranked by grid row
+#endif
+} dist_state_t;
+
+static dist_state_t dist = { 0, 1, 1, 1, 0, 0 };
+
+// Pending broadcast of a panel, it may be split in several messages
+#define DIST_MAX_REQS 16
+
+typedef struct {
+   unsigned int n;
+#if defined(MATMUL_MPI)
+   MPI_Request reqs[DIST_MAX_REQS];
+#endif
+} dist_req_t;
+
+void distInit(int *argc, char ***argv) {
+#if defined(MATMUL_MPI)
+   int provided;
+   MPI_Init_thread(argc, argv, MPI_THREAD_SERIALIZED, &provided);
+   MPI_Comm_rank(MPI_COMM_WORLD, &dist.rank);
+   MPI_Comm_size(MPI_COMM_WORLD, &dist.size);
+   if (provided < MPI_THREAD_SERIALIZED && dist.rank == 0) {
+      fprintf(stderr, "WARNING:\tThe MPI library does not support calls from several threads\n");
+   }
+#else
+   (void)argc;
+   (void)argv;
+#endif
+}
+
+void distFini() {
+#if defined(MATMUL_MPI)
+   if (dist.p*dist.q > 1) {
+      MPI_Comm_free(&dist.rowComm);
+      MPI_Comm_free(&dist.colComm);
+   }
+   MPI_Finalize();
+#endif
+}
+
+// Parses a <p>x<q> grid. Returns 0 on success
+int distParseGrid(const char *str, unsigned int *p, unsigned int *q) {
+   char end;
+   return sscanf(str, "%ux%u%c", p, q, &end) == 2 && *p > 0 && *q > 0 ? 0 : -1;
+}
+
+// Sets up a <p>x<q> grid of all the processes, or the most square one if <p>
+// is 0. Returns 0 on success
+int distGrid(unsigned int p, unsigned int q) {
+   if (p == 0) {
+      for (p = 1; (p + 1)*(p + 1) <= (unsigned int)dist.size; ++p);
+      while (dist.size%p != 0) --p;
+      q = dist.size/p;
+   }
+   if (p*q != (unsigned int)dist.size) return -1;
+   dist.p = p;
+   dist.q = q;
+   dist.pr = dist.rank/q;
+   dist.pc = dist.rank%q;
+#if defined(MATMUL_MPI)
+   if (p*q > 1) {
+      MPI_Comm_split(MPI_COMM_WORLD, dist.pr, dist.pc, &dist.rowComm);
+      MPI_Comm_split(MPI_COMM_WORLD, dist.pc, dist.pr, &dist.colComm);
+   }
+#endif
+   return 0;
+}
+
+// Starts broadcasting <bytes> of <buf> from the process at grid column <root>
+// of the grid row (<row> set) or at grid row <root> of the grid column
+void distIbcast(void *buf, const size_t bytes, const unsigned int root, const unsigned int row, dist_req_t *req) {
+   req->n = 0;
+#if defined(MATMUL_MPI)
+   if ((row ? dist.q : dist.p) == 1) return;
+   for (size_t off = 0; off < bytes; off += DIST_CHUNK) {
+      if (req->n == DIST_MAX_REQS) {
+         fprintf(stderr, "ERROR:\tPanel of %zu bytes too large to broadcast\n", bytes);
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      const size_t len = bytes - off < DIST_CHUNK ? bytes - off : DIST_CHUNK;
+      MPI_Ibcast((char *)buf + off, (int)len, MPI_BYTE, (int)root, row ? dist.rowComm : dist.colComm,
+         &req->reqs[req->n++]);
+   }
+#else
+   (void)buf;
+   (void)bytes;
+   (void)root;
+   (void)row;
+#endif
+}
+
+void distWait(dist_req_t *req) {
+#if defined(MATMUL_MPI)
+   MPI_Waitall(req->n, req->reqs, MPI_STATUSES_IGNORE);
+#endif
+   req->n = 0;
+}
+
+// Point to point transfers of <bytes> between processes
+void distSend(const void *buf, const size_t bytes, const int dest) {
+#if defined(MATMUL_MPI)
+   for (size_t off = 0; off < bytes; off += DIST_CHUNK) {
+      const size_t len = bytes - off < DIST_CHUNK ? bytes - off : DIST_CHUNK;
+      MPI_Send((const char *)buf + off, (int)len, MPI_BYTE, dest, 0, MPI_COMM_WORLD);
+   }
+#else
+   (void)buf;
+   (void)bytes;
+   (void)dest;
+#endif
+}
+
+void distRecv(void *buf, const size_t bytes, const int src) {
+#if defined(MATMUL_MPI)
+   for (size_t off = 0; off < bytes; off += DIST_CHUNK) {
+      const size_t len = bytes - off < DIST_CHUNK ? bytes - off : DIST_CHUNK;
+      MPI_Recv((char *)buf + off, (int)len, MPI_BYTE, src, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+   }
+#else
+   (void)buf;
+   (void)bytes;
+   (void)src;
+#endif
+}
+
+void distBarrier() {
+#if defined(MATMUL_MPI)
+   MPI_Barrier(MPI_COMM_WORLD);
+#endif
+}
+
+// Gathers <n> doubles of every process into <all> of process 0
+void distGather(const double *v, const unsigned int n, double *all) {
+#if defined(MATMUL_MPI)
+   MPI_Gather(v, n, MPI_DOUBLE, all, n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#else
+   memcpy(all, v, n*sizeof(double));
+#endif
+}
+
+// Returns the value <v> of process 0 in all the processes
+unsigned int distBcastUInt(unsigned int v) {
+#if defined(MATMUL_MPI)
+   MPI_Bcast(&v, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+#endif
+   return v;
+}
+
+#endif /* _MATMUL_DIST_H_ */
@@ -0,0 +1,338 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Cycle-approximate model of the matmulBlock accelerators, used by the
+// host-only emulation build (matmul-emu). The block computation itself runs
+// the matmulBlock loop nest unchanged; this file only accounts the cycles.
+// The instances form a pool where each task runs in the instance given by its
+// affinity, or in the first idle one. An instance keeps the C block of its
+// last task and writes it back only when another block needs the instance or
+// another instance needs the block, so the consecutive k steps of a C block
+// in the same instance skip the C copies between them. The host tasks are not
+// modeled.
+
+#ifndef _MATMUL_EMU_H_
+#define _MATMUL_EMU_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef FPGA_CLOCK
+#  error FPGA_CLOCK variable not defined
+#endif
+// Latency of one iteration of the pipelined loop (load, fmul, fadd, store)
+#ifndef MATMUL_EMU_PIPELINE_DEPTH
+#  define MATMUL_EMU_PIPELINE_DEPTH 12
+#endif
+// Cycles until the first beat of a memory burst arrives
+#ifndef MATMUL_EMU_MEM_LATENCY
+#  define MATMUL_EMU_MEM_LATENCY 64
+#endif
+// Cycles spent by the hardware runtime to launch and finalize a task
+#ifndef MATMUL_EMU_TASK_OVERHEAD
+#  define MATMUL_EMU_TASK_OVERHEAD 200
+#endif
+
+// Array partition factors, they must match the matmulBlock pragmas
+#define EMU_PART_A (FPGA_MEMORY_PORT_WIDTH/64)
+#define EMU_PART_B (MATMUL_BLOCK_SIZE/(MATMUL_BLOCK_II*2))
+#define EMU_PART_C (MATMUL_BLOCK_SIZE/MATMUL_BLOCK_II)
+
+typedef struct {
+   uint64_t copyIn;          // Cycles moving a, b and c into the accelerator
+   uint64_t compute;         // Cycles of the compute core
+   uint64_t copyOut;         // Cycles moving c back to memory
+   uint64_t copyC;           // Cycles moving c in or out, part of copyIn and copyOut
+   uint64_t total;           // Per-task latency, including the task overhead
+   unsigned int ii;          // Achieved initiation interval
+} emu_task_t;
+
+typedef struct {
+   emu_task_t task;
+   uint64_t numTasks;
+   uint64_t busy;                           // Sum of task latencies
+   uint64_t accFree[MATMUL_NUM_ACCS];       // Cycle when each instance becomes idle
+   uint64_t makespan;
+   uint64_t bytesAB;                        // Bytes moved through the memory ports for A and B
+   uint64_t bytesC;                         // and for C
+   uint64_t cTransfers;                     // C blocks moved in or out of the instances
+   uint64_t cAvoided;                       // and the moves saved against one in and one out per block product
+   const acc_t *resident[MATMUL_NUM_ACCS];  // C block kept in each instance, NULL if none
+   uint64_t coreBlocks;                     // Block products checked against the flat core
+   uint64_t coreMismatches;                 // C elements of them that differ in any bit
+   // Open addressing table with the cycle each C block is ready
+   const acc_t **blockKey;
+   uint64_t *blockReady;
+   size_t tableSize;
+} emu_state_t;
+
+static emu_state_t emu;
+
+static uint64_t emuDivCeil(uint64_t a, uint64_t b) {
+   return (a + b - 1)/b;
+}
+
+// Cycles to move one block of <size> byte elements between memory and a local
+// array partitioned by <factor> (two ports per partition), through the
+// accelerator memory port
+static uint64_t emuCopyCycles(const unsigned int elems, const size_t size, const unsigned int factor) {
+   const unsigned int elemsPerBeat = FPGA_MEMORY_PORT_WIDTH/(8*size) > 0 ? FPGA_MEMORY_PORT_WIDTH/(8*size) : 1;
+   const unsigned int localPorts = 2*(factor > 0 ? factor : 1);
+   const unsigned int rate = elemsPerBeat < localPorts ? elemsPerBeat : localPorts;
+   const uint64_t beats = emuDivCeil((uint64_t)elems*size*8, FPGA_MEMORY_PORT_WIDTH);
+   const uint64_t cycles = emuDivCeil(elems, rate);
+   return MATMUL_EMU_MEM_LATENCY + (cycles > beats ? cycles : beats);
+}
+
+static emu_task_t emuTaskModel(const unsigned int bsize) {
+   emu_task_t t;
+   const unsigned int b2size = bsize*bsize;
+
+#if defined(MATMUL_CORE_SYSTOLIC)
+   //Each step of the array reads one B element per PE column, the A rows of a tile row are copied
+   //to the feeders and each tile moves its C elements in and out of the PEs one PE row per cycle
+   const unsigned int ii = emuDivCeil(MATMUL_PE_COLS, 2*(EMU_PART_B > 0 ? EMU_PART_B : 1));
+   t.ii = ii;
+   const uint64_t feed = emuDivCeil((uint64_t)MATMUL_PE_ROWS*bsize, 2*EMU_PART_A);
+   const uint64_t tile = 2*MATMUL_PE_ROWS + (uint64_t)(bsize + MATMUL_PE_ROWS + MATMUL_PE_COLS - 2)*ii +
+      MATMUL_EMU_PIPELINE_DEPTH;
+   t.compute = (bsize/MATMUL_PE_ROWS)*(feed + (bsize/MATMUL_PE_COLS)*tile);
+#else
+   //Each pipelined iteration reads a row of b and reads/writes a row of c
+   unsigned int ii = MATMUL_BLOCK_II;
+   const unsigned int iiB = emuDivCeil(bsize, 2*(EMU_PART_B > 0 ? EMU_PART_B : 1));
+   const unsigned int iiC = emuDivCeil(2*bsize, 2*(EMU_PART_C > 0 ? EMU_PART_C : 1));
+   ii = iiB > ii ? iiB : ii;
+   ii = iiC > ii ? iiC : ii;
+   t.ii = ii;
+
+   //The c dependency across k stalls the pipeline if a k iteration is shorter than its depth
+   const uint64_t kIter = (uint64_t)bsize*ii;
+   t.compute = bsize*(kIter > MATMUL_EMU_PIPELINE_DEPTH ? kIter : MATMUL_EMU_PIPELINE_DEPTH) +
+      MATMUL_EMU_PIPELINE_DEPTH;
+#endif
+   t.copyIn = emuCopyCycles(b2size, sizeof(elem_t), EMU_PART_A) + emuCopyCycles(b2size, sizeof(elem_t), EMU_PART_B) +
+      emuCopyCycles(b2size, sizeof(acc_t), EMU_PART_C);
+   t.copyC = emuCopyCycles(b2size, sizeof(acc_t), EMU_PART_C);
+   t.copyOut = t.copyC;
+   t.total = MATMUL_EMU_TASK_OVERHEAD + t.copyIn + t.compute + t.copyOut;
+   return t;
+}
+
+void emuInit(const unsigned int bsize, const size_t numBlocks) {
+   emu.task = emuTaskModel(bsize);
+   emu.coreBlocks = emu.coreMismatches = 0;
+   emu.tableSize = 1;
+   while (emu.tableSize < 2*numBlocks) emu.tableSize <<= 1;
+   emu.blockKey = (const acc_t **)calloc(emu.tableSize, sizeof(const acc_t *));
+   emu.blockReady = (uint64_t *)calloc(emu.tableSize, sizeof(uint64_t));
+   if (emu.blockKey == NULL || emu.blockReady == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the emulator\n");
+      exit(1);
+   }
+   TRACE_ACC_RESET();
+}
+
+void emuFini() {
+   free(emu.blockKey);
+   free(emu.blockReady);
+   emu.blockKey = NULL;
+   emu.blockReady = NULL;
+   emu.tableSize = 0;
+}
+
+// Starts a new measurement, all instances idle and all blocks ready
+void emuReset() {
+   emu.numTasks = 0;
+   emu.busy = 0;
+   emu.makespan = 0;
+   emu.bytesAB = emu.bytesC = 0;
+   emu.cTransfers = emu.cAvoided = 0;
+   for (unsigned int i = 0; i < MATMUL_NUM_ACCS; ++i) {
+      emu.accFree[i] = 0;
+      emu.resident[i] = NULL;
+   }
+   memset(emu.blockKey, 0, emu.tableSize*sizeof(const acc_t *));
+   memset(emu.blockReady, 0, emu.tableSize*sizeof(uint64_t));
+   TRACE_ACC_RESET();
+}
+
+static uint64_t *emuBlockReady(const acc_t *c) {
+   size_t h = ((uintptr_t)c/sizeof(acc_t)*0x9E3779B97F4A7C15ULL) & (emu.tableSize - 1);
+   while (emu.blockKey[h] != NULL && emu.blockKey[h] != c) {
+      h = (h + 1) & (emu.tableSize - 1);
+   }
+   emu.blockKey[h] = c;
+   return &emu.blockReady[h];
+}
+
+double emuSeconds(const uint64_t cycles) {
+   return cycles/(FPGA_CLOCK*1e6);
+}
+
+// Accounts one C block moved in or out of an instance
+static void emuMoveC() {
+   emu.bytesC += (uint64_t)MATMUL_BLOCK_SIZE*MATMUL_BLOCK_SIZE*sizeof(acc_t);
+   emu.cTransfers++;
+}
+
+// Writes back the C block kept in instance <acc> after its last task
+static void emuWriteBack(const unsigned int acc) {
+   const uint64_t end = emu.accFree[acc] + emu.task.copyC;
+   *emuBlockReady(emu.resident[acc]) = end;
+   emu.accFree[acc] = end;
+   emu.makespan = end > emu.makespan ? end : emu.makespan;
+   emu.busy += emu.task.copyC;
+   emu.resident[acc] = NULL;
+   emuMoveC();
+}
+
+// Writes back the C blocks kept in the instances, at the end of a run
+void emuFlush() {
+   for (unsigned int i = 0; i < MATMUL_NUM_ACCS; ++i) {
+      if (emu.resident[i] != NULL) emuWriteBack(i);
+   }
+}
+
+// Forgets the C blocks of the previous products, which have finished, so the
+// table does not fill up with the blocks of the matrices of every call (see
+// ompss_gemm). The blocks kept in the instances are written back, and all the
+// blocks are ready at the current makespan
+void emuForget() {
+   emuFlush();
+   memset(emu.blockKey, 0, emu.tableSize*sizeof(const acc_t *));
+   for (size_t h = 0; h < emu.tableSize; ++h) emu.blockReady[h] = emu.makespan;
+}
+
+// Schedules a task of <cycles>, without the C copies, on instance <af> or on
+// the first idle instance if <af> is not one, after the previous task updating
+// the same C block has finished. C is copied in unless the instance keeps it,
+// and with <keep> it stays in the instance instead of being copied out
+static void emuSchedule(const elem_t *a, const acc_t *c, const unsigned int af, uint64_t cycles, const unsigned int keep) {
+   //Only traced, with MATMUL_TRACE
+   (void)a;
+   unsigned int acc = af;
+   if (acc >= MATMUL_NUM_ACCS) {
+      acc = 0;
+      for (unsigned int i = 1; i < MATMUL_NUM_ACCS; ++i) {
+         if (emu.accFree[i] < emu.accFree[acc]) acc = i;
+      }
+   }
+   for (unsigned int i = 0; i < MATMUL_NUM_ACCS; ++i) {
+      if ((i != acc && emu.resident[i] == c) || (i == acc && emu.resident[i] != NULL && emu.resident[i] != c)) {
+         emuWriteBack(i);
+      }
+   }
+   if (emu.resident[acc] == c) {
+      emu.cAvoided += 2;
+   } else {
+      cycles += emu.task.copyC;
+      emuMoveC();
+   }
+   if (keep) {
+      emu.resident[acc] = c;
+   } else {
+      cycles += emu.task.copyC;
+      emu.resident[acc] = NULL;
+      emuMoveC();
+   }
+   uint64_t *ready = emuBlockReady(c);
+   const uint64_t start = emu.accFree[acc] > *ready ? emu.accFree[acc] : *ready;
+   const uint64_t end = start + cycles;
+   emu.accFree[acc] = end;
+   *ready = end;
+   emu.makespan = end > emu.makespan ? end : emu.makespan;
+   emu.busy += cycles;
+   emu.numTasks++;
+   TRACE_ACC_TASK(acc, emuSeconds(start), emuSeconds(end), c, a);
+}
+
+// Schedules one matmulBlock task with affinity <af>
+void emuBlockTask(const elem_t *a, const acc_t *c, const unsigned int af) {
+   const uint64_t b2size = MATMUL_BLOCK_SIZE*MATMUL_BLOCK_SIZE;
+   emu.bytesAB += 2*b2size*sizeof(elem_t);
+   emuSchedule(a, c, af, emu.task.total - emu.task.copyC - emu.task.copyOut, 1);
+}
+
+// Schedules one matmulChain task over <kblocks> A and B blocks. C is moved in
+// and out once. The first A and B blocks are loaded before any computation,
+// then each step is a dataflow region (see matmulChainStep) that takes the
+// longest of loading the next blocks and computing the current ones
+void emuChainTask(const elem_t *a, const acc_t *c, const unsigned int kblocks) {
+   const uint64_t b2size = MATMUL_BLOCK_SIZE*MATMUL_BLOCK_SIZE;
+   const uint64_t load = emuCopyCycles(b2size, sizeof(elem_t), EMU_PART_A) + emuCopyCycles(b2size, sizeof(elem_t), EMU_PART_B);
+   const uint64_t step = load > emu.task.compute ? load : emu.task.compute;
+   emu.bytesAB += kblocks*2*b2size*sizeof(elem_t);
+   emu.cAvoided += kblocks > 0 ? 2*(uint64_t)(kblocks - 1) : 0;
+   emuSchedule(a, c, MATMUL_NUM_ACCS, MATMUL_EMU_TASK_OVERHEAD + load + (kblocks > 0 ? kblocks - 1 : 0)*step +
+      emu.task.compute, 0);
+}
+
+// Compares the <n> elements of <c> computed by the core under test with the
+// <ref> ones computed by the flat core
+void emuCoreCheck(const acc_t *c, const acc_t *ref, const unsigned int n) {
+   for (unsigned int i = 0; i < n; ++i) {
+      emu.coreMismatches += memcmp(&c[i], &ref[i], sizeof(acc_t)) != 0;
+   }
+   emu.coreBlocks++;
+}
+
+// Fraction of the MAC operations the compute core can issue that a block
+// product uses, with the modeled compute cycles
+double emuCoreUtilization() {
+   const double macs = (double)MATMUL_BLOCK_SIZE*MATMUL_BLOCK_SIZE*MATMUL_BLOCK_SIZE;
+   return macs/((double)MATMUL_CORE_UNITS*emu.task.compute);
+}
+
+void emuReport(const double flops) {
+   emuFlush();
+   const double time = emuSeconds(emu.makespan);
+   const double util = emu.makespan == 0 ? 0 : (double)emu.busy/((double)emu.makespan*MATMUL_NUM_ACCS);
+   printf( "================ EMULATED FPGA =================== \n" );
+   printf( "  Clock (MHz):           %u\n", (unsigned int)FPGA_CLOCK );
+   printf( "  Instances:             %u\n", MATMUL_NUM_ACCS );
+   printf( "  Achieved II:           %u\n", emu.task.ii );
+   printf( "  PE utilization:        %f (%u MAC units)\n", emuCoreUtilization(), MATMUL_CORE_UNITS );
+   printf( "  Task latency (cycles): %llu (in %llu, compute %llu, out %llu)\n",
+      (unsigned long long)emu.task.total, (unsigned long long)emu.task.copyIn,
+      (unsigned long long)emu.task.compute, (unsigned long long)emu.task.copyOut );
+   printf( "  Task latency (usecs):  %f\n", emuSeconds(emu.task.total)*1e6 );
+   printf( "  Tasks:                 %llu\n", (unsigned long long)emu.numTasks );
+   printf( "  Instances utilization: %f\n", util );
+   printf( "  Memory traffic (MiB):  %f (A and B %f, C %f)\n", (emu.bytesAB + emu.bytesC)/1048576.0,
+      emu.bytesAB/1048576.0, emu.bytesC/1048576.0 );
+   printf( "  C transfers:           %llu (%llu avoided)\n", (unsigned long long)emu.cTransfers,
+      (unsigned long long)emu.cAvoided );
+#if defined(MATMUL_CORE_SYSTOLIC)
+   printf( "  Core check (blocks):   %llu, %llu elements differ from the flat core\n",
+      (unsigned long long)emu.coreBlocks, (unsigned long long)emu.coreMismatches );
+#endif
+   printf( "  Exec. time (secs):     %f\n", time );
+   printf( "  Performance (GFLOPS):  %f\n", time > 0 ? flops/time/1e9 : 0 );
+}
+
+#endif /* _MATMUL_EMU_H_ */
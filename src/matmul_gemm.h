@@ -0,0 +1,73 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// C interface of the blocked matrix multiplication, provided by the
+// libmatmul.a and libmatmul.so targets. The element types are selected at
+// build time (see matmul.fpga.h), and the library must be built with the same
+// USE_* preprocessor variables as the application. Only these functions are
+// exported, the rest of the library is hidden (MATMUL_API)
+
+#ifndef _MATMUL_GEMM_H_
+#define _MATMUL_GEMM_H_
+
+#include "matmul.fpga.h"
+
+#if defined(__GNUC__)
+#  define MATMUL_API __attribute__((visibility("default")))
+#else
+#  define MATMUL_API
+#endif
+
+// Selects how the tasks of the following products are created: from the FPGA
+// (0, default) or from SMP (1), and the traversal order of the C tiles (see
+// order_t, 0 for the default one)
+MATMUL_API void ompss_gemm_set(const unsigned int createFrom, const unsigned int order);
+
+// Computes C = alpha*op(A)*op(B) + beta*C with row-major matrices, where op(X)
+// is X for 'N' and X^T for 'T' (or 'C'). op(A) is MxK, op(B) is KxN and C is
+// MxN, with leading dimensions lda, ldb and ldc. Each BSIZExBSIZE tile of C is
+// computed by one task running its whole k-chain, which reads the tiles of
+// op(A) and op(B) in place and accumulates the product in local memory, so C is
+// only written once, as alpha*product + beta*C, and not read when beta is 0.
+// Created from the FPGA, the full tiles run on the matmulChain accelerator when
+// the bitstream has it (MATMUL_KCHAIN). Otherwise their full k steps run on the
+// matmulBlock one, which only moves contiguous blocks, so the full tiles of
+// op(A) and op(B) are first copied into blocked matrices, kept between calls,
+// and C is written from a blocked product. The edge tiles and the last,
+// narrow, k step run on SMP, as do all the tiles created from SMP.
+// Returns 0 on success, -1 if the memory cannot be allocated, or the position
+// of the first invalid argument.
+// Not reentrant: the settings and the buffers of the library are shared by all
+// the calls, which must not run concurrently (from several threads or tasks)
+MATMUL_API int ompss_gemm(const char transA, const char transB, const unsigned int M, const unsigned int N,
+   const unsigned int K, const acc_t alpha, const elem_t *A, const unsigned int lda, const elem_t *B,
+   const unsigned int ldb, const acc_t beta, acc_t *C, const unsigned int ldc);
+
+// Releases the buffers kept between calls
+MATMUL_API void ompss_gemm_fini();
+
+#endif /* _MATMUL_GEMM_H_ */
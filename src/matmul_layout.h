@@ -0,0 +1,137 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// External matrix layouts and the copy and transpose kernels used to convert
+// them to and from the blocked layout
+
+#ifndef _MATMUL_LAYOUT_H_
+#define _MATMUL_LAYOUT_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+   LAYOUT_BLOCKED = 0,       // Already blocked, not converted
+   LAYOUT_ROW,               // Row-major
+   LAYOUT_COL,               // Column-major
+   LAYOUT_NUM
+} layout_t;
+
+static const char * const LAYOUT_STR[LAYOUT_NUM] = { "blocked", "row", "col" };
+
+// Side of the tiles where the recursive transpose stops
+#ifndef LAYOUT_TILE
+#  define LAYOUT_TILE 16
+#endif
+
+// Returns the layout named <str> (or given by its number), or LAYOUT_NUM if not valid
+layout_t parseLayout(const char *str) {
+   for (unsigned int l = 0; l < LAYOUT_NUM; ++l) {
+      if (strcmp(str, LAYOUT_STR[l]) == 0) return (layout_t)l;
+   }
+   char *end;
+   const long l = strtol(str, &end, 10);
+   return *end == '\0' && end != str && l >= 0 && l < LAYOUT_NUM ? (layout_t)l : LAYOUT_NUM;
+}
+
+// Copies <rows>x<cols> elements of <size> bytes between row-major arrays
+void layoutCopy(const void *src, const size_t lds, void *dst, const size_t ldd, const unsigned int rows,
+   const unsigned int cols, const size_t size)
+{
+   for (unsigned int r = 0; r < rows; ++r) {
+      memcpy((char *)dst + r*ldd*size, (const char *)src + r*lds*size, cols*size);
+   }
+}
+
+#define LAYOUT_TRANSPOSE_LOOP(T, r0) \
+   for (unsigned int r = r0; r < rows; ++r) { \
+      for (unsigned int c = 0; c < cols; ++c) { \
+         ((T *)dst)[r*ldd + c] = ((const T *)src)[c*lds + r]; \
+      } \
+   }
+
+static void layoutTransposeTile(const void *src, const size_t lds, void *dst, const size_t ldd,
+   const unsigned int rows, const unsigned int cols, const size_t size)
+{
+   unsigned int r0 = 0;
+#if defined(SMP_KERNEL_X86)
+   //4x4 sub-tiles of 4-byte elements transposed in SSE registers
+   const float *srcf = (const float *)src;
+   float *dstf = (float *)dst;
+   for (; size == sizeof(float) && r0 + 4 <= rows; r0 += 4) {
+      unsigned int c = 0;
+      for (; c + 4 <= cols; c += 4) {
+         __m128 s0 = _mm_loadu_ps(srcf + (c + 0)*lds + r0);
+         __m128 s1 = _mm_loadu_ps(srcf + (c + 1)*lds + r0);
+         __m128 s2 = _mm_loadu_ps(srcf + (c + 2)*lds + r0);
+         __m128 s3 = _mm_loadu_ps(srcf + (c + 3)*lds + r0);
+         _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+         _mm_storeu_ps(dstf + (r0 + 0)*ldd + c, s0);
+         _mm_storeu_ps(dstf + (r0 + 1)*ldd + c, s1);
+         _mm_storeu_ps(dstf + (r0 + 2)*ldd + c, s2);
+         _mm_storeu_ps(dstf + (r0 + 3)*ldd + c, s3);
+      }
+      for (; c < cols; ++c) {
+         for (unsigned int r = r0; r < r0 + 4; ++r) {
+            dstf[r*ldd + c] = srcf[c*lds + r];
+         }
+      }
+   }
+#endif
+   if (size == 1) {
+      LAYOUT_TRANSPOSE_LOOP(unsigned char, r0)
+   } else if (size == 2) {
+      LAYOUT_TRANSPOSE_LOOP(unsigned short, r0)
+   } else if (size == 4) {
+      LAYOUT_TRANSPOSE_LOOP(unsigned int, r0)
+   } else {
+      LAYOUT_TRANSPOSE_LOOP(unsigned long long, r0)
+   }
+}
+
+// Transposes <cols>x<rows> elements of <size> bytes (1, 2, 4 or 8) of <src>
+// into <rows>x<cols> of <dst>, both row-major: dst[r][c] = src[c][r]. The
+// larger dimension is halved until the tiles fit LAYOUT_TILE, so the accesses
+// stay in cache for any leading dimension
+void layoutTranspose(const void *src, const size_t lds, void *dst, const size_t ldd, const unsigned int rows,
+   const unsigned int cols, const size_t size)
+{
+   if (rows <= LAYOUT_TILE && cols <= LAYOUT_TILE) {
+      layoutTransposeTile(src, lds, dst, ldd, rows, cols, size);
+   } else if (rows >= cols) {
+      const unsigned int half = (rows/2 + 3) & ~3U;
+      layoutTranspose(src, lds, dst, ldd, half, cols, size);
+      layoutTranspose((const char *)src + half*size, lds, (char *)dst + half*ldd*size, ldd, rows - half, cols, size);
+   } else {
+      const unsigned int half = (cols/2 + 3) & ~3U;
+      layoutTranspose(src, lds, dst, ldd, rows, half, size);
+      layoutTranspose((const char *)src + half*lds*size, lds, (char *)dst + half*size, ldd, rows, cols - half, size);
+   }
+}
+
+#endif /* _MATMUL_LAYOUT_H_ */
@@ -0,0 +1,325 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Matrix memory. The matrices are allocated in 2 MiB aligned mappings, which
+// can be backed by transparent or explicit huge pages, and whose pages can be
+// interleaved across the NUMA nodes or bound to the node of the block rows
+// that use them. Linux system calls are used directly, so neither libnuma nor
+// special privileges are needed; unsupported features are reported and
+// ignored. The TLB and remote node misses are read from the perf counters.
+
+#ifndef _MATMUL_MEM_H_
+#define _MATMUL_MEM_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+#  include <linux/perf_event.h>
+#endif
+
+#define MEM_ALIGN (2UL << 20)
+#define MEM_MAX_NODES 64
+#define MEM_MAX_COUNTERS 512
+
+// Memory policies of the Linux mbind system call
+#define MEM_MPOL_DEFAULT    0
+#define MEM_MPOL_BIND       2
+#define MEM_MPOL_INTERLEAVE 3
+#define MEM_MPOL_MF_MOVE    (1 << 1)
+
+typedef enum {
+   MEM_HUGE_NONE = 0,        // Base pages
+   MEM_HUGE_THP,             // Transparent huge pages (madvise)
+   MEM_HUGE_EXPLICIT,        // Reserved huge pages (MAP_HUGETLB), THP if not available
+   MEM_HUGE_NUM
+} mem_huge_t;
+
+typedef enum {
+   MEM_NUMA_LOCAL = 0,       // Pages placed by the first touch of the initialization tasks
+   MEM_NUMA_INTERLEAVE,      // Pages interleaved across all nodes
+   MEM_NUMA_BIND,            // Block rows of A and C bound to consecutive nodes, B interleaved
+   MEM_NUMA_NUM
+} mem_numa_t;
+
+static const char * const MEM_HUGE_STR[MEM_HUGE_NUM] = { "none", "thp", "explicit" };
+static const char * const MEM_NUMA_STR[MEM_NUMA_NUM] = { "local", "interleave", "bind" };
+
+typedef struct {
+   mem_huge_t huge;
+   mem_numa_t numa;
+   unsigned int numNodes;
+   unsigned int nodes[MEM_MAX_NODES];
+   unsigned int maxNode;
+   unsigned int hugeFallback;  // Explicit huge pages were not available
+   unsigned int mbindFailed;
+   int counters[MEM_MAX_COUNTERS][2];
+   unsigned int numCounters;
+} mem_state_t;
+
+typedef struct {
+   int valid;                // The dTLB counters could be opened
+   int nodeValid;            // The remote node counters could be opened
+   uint64_t dtlbMisses;      // dTLB load misses
+   uint64_t nodeMisses;      // Loads served by a remote node
+} mem_counters_t;
+
+static mem_state_t mem;
+
+// Returns the value named <str> in <names> (or given by its number), or <num> if not valid
+unsigned int memParse(const char *str, const char * const *names, const unsigned int num) {
+   for (unsigned int v = 0; v < num; ++v) {
+      if (strcmp(str, names[v]) == 0) return v;
+   }
+   char *end;
+   const long v = strtol(str, &end, 10);
+   return *end == '\0' && end != str && v >= 0 && v < num ? (unsigned int)v : num;
+}
+
+// Reads the online NUMA nodes, one node (0) if unknown
+static void memReadNodes() {
+   mem.numNodes = 0;
+   mem.maxNode = 0;
+   FILE *f = fopen("/sys/devices/system/node/online", "r");
+   if (f != NULL) {
+      unsigned int first, last;
+      int sep;
+      while (mem.numNodes < MEM_MAX_NODES && fscanf(f, "%u", &first) == 1) {
+         last = first;
+         sep = fgetc(f);
+         if (sep == '-' && fscanf(f, "%u", &last) == 1) sep = fgetc(f);
+         for (unsigned int n = first; n <= last && n < MEM_MAX_NODES && mem.numNodes < MEM_MAX_NODES; ++n) {
+            mem.nodes[mem.numNodes++] = n;
+            mem.maxNode = n;
+         }
+         if (sep != ',') break;
+      }
+      fclose(f);
+   }
+   if (mem.numNodes == 0) {
+      mem.nodes[mem.numNodes++] = 0;
+   }
+}
+
+void memInit(const mem_huge_t huge, const mem_numa_t numa) {
+   memset(&mem, 0, sizeof(mem));
+   mem.huge = huge;
+   mem.numa = numa;
+   memReadNodes();
+}
+
+static size_t memRound(const size_t bytes, const size_t align) {
+   return (bytes + align - 1)/align*align;
+}
+
+// Page size used to place the memory
+static size_t memPageSize() {
+   return mem.huge != MEM_HUGE_NONE ? MEM_ALIGN : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void memBind(void *p, const size_t bytes, const int mode, const unsigned long *mask) {
+#if defined(SYS_mbind)
+   if (bytes > 0 && syscall(SYS_mbind, p, bytes, mode, mask, mask != NULL ? mem.maxNode + 2 : 0, MEM_MPOL_MF_MOVE) != 0) {
+      mem.mbindFailed = 1;
+   }
+#else
+   mem.mbindFailed = 1;
+#endif
+}
+
+static void memInterleave(void *p, const size_t bytes) {
+   unsigned long mask[MEM_MAX_NODES/(8*sizeof(unsigned long)) + 1] = { 0 };
+   for (unsigned int n = 0; n < mem.numNodes; ++n) {
+      mask[mem.nodes[n]/(8*sizeof(unsigned long))] |= 1UL << (mem.nodes[n]%(8*sizeof(unsigned long)));
+   }
+   memBind(p, bytes, MEM_MPOL_INTERLEAVE, mask);
+}
+
+// Returns <bytes> of MEM_ALIGN aligned memory, or NULL
+void *memAlloc(const size_t bytes) {
+   const size_t len = memRound(bytes > 0 ? bytes : 1, MEM_ALIGN);
+   void *p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+   if (mem.huge == MEM_HUGE_EXPLICIT) {
+      p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      mem.hugeFallback |= p == MAP_FAILED;
+   }
+#endif
+   if (p == MAP_FAILED) {
+      //Over-allocate and trim to get an aligned mapping
+      char *raw = (char *)mmap(NULL, len + MEM_ALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (raw == MAP_FAILED) return NULL;
+      char *aligned = (char *)(((uintptr_t)raw + MEM_ALIGN - 1) & ~(uintptr_t)(MEM_ALIGN - 1));
+      if (aligned > raw) munmap(raw, aligned - raw);
+      if (raw + MEM_ALIGN > aligned) munmap(aligned + len, raw + MEM_ALIGN - aligned);
+      p = aligned;
+#if defined(MADV_HUGEPAGE)
+      if (mem.huge != MEM_HUGE_NONE) madvise(p, len, MADV_HUGEPAGE);
+#endif
+   }
+   if (mem.numa == MEM_NUMA_INTERLEAVE) {
+      memInterleave(p, len);
+   }
+   return p;
+}
+
+void memFree(void *p, const size_t bytes) {
+   if (p != NULL) munmap(p, memRound(bytes > 0 ? bytes : 1, MEM_ALIGN));
+}
+
+// Places a blocked matrix of <rows> (split in block rows of <rowBytes>) before
+// its initialization. With the bind policy, block row i goes to the node
+// i*nodes/<rows>, otherwise (or if <interleave>) the matrix is interleaved
+void memPlace(void *p, const unsigned int rows, const size_t rowBytes, const size_t bytes, const unsigned int interleave) {
+   if (mem.numa == MEM_NUMA_LOCAL) return;
+   const size_t len = memRound(bytes, memPageSize());
+   if (mem.numa == MEM_NUMA_INTERLEAVE || interleave || mem.numNodes == 1) {
+      memInterleave(p, len);
+      return;
+   }
+   //Each node gets the pages starting in its block rows
+   const size_t page = memPageSize();
+   for (unsigned int n = 0; n < mem.numNodes; ++n) {
+      const size_t first = memRound(((size_t)rows*n/mem.numNodes)*rowBytes, page);
+      const size_t last = n + 1 == mem.numNodes ? len : memRound(((size_t)rows*(n + 1)/mem.numNodes)*rowBytes, page);
+      unsigned long mask[MEM_MAX_NODES/(8*sizeof(unsigned long)) + 1] = { 0 };
+      mask[mem.nodes[n]/(8*sizeof(unsigned long))] = 1UL << (mem.nodes[n]%(8*sizeof(unsigned long)));
+      if (last > first) memBind((char *)p + first, last - first, MEM_MPOL_BIND, mask);
+   }
+}
+
+// Counts the pages of [p, p+bytes) on each node. Returns the pages found
+size_t memPagesPerNode(const void *p, const size_t bytes, size_t *perNode) {
+   const size_t page = memPageSize();
+   const size_t num = memRound(bytes, page)/page;
+   size_t found = 0;
+#if defined(SYS_move_pages)
+   enum { CHUNK = 1024 };
+   void *pages[CHUNK];
+   int status[CHUNK];
+   for (size_t first = 0; first < num; first += CHUNK) {
+      const size_t count = num - first < CHUNK ? num - first : CHUNK;
+      for (size_t l = 0; l < count; ++l) pages[l] = (char *)p + (first + l)*page;
+      if (syscall(SYS_move_pages, 0, count, pages, NULL, status, 0) != 0) return found;
+      for (size_t l = 0; l < count; ++l) {
+         for (unsigned int n = 0; n < mem.numNodes; ++n) {
+            if (status[l] == (int)mem.nodes[n]) {
+               perNode[n]++;
+               found++;
+            }
+         }
+      }
+   }
+#endif
+   return found;
+}
+
+// Bytes of [p, p+bytes) backed by huge pages, from the process memory map.
+// The map only counts them per mapping, so the count of each mapping is bounded
+// by its overlap with the range, as the mappings may be larger than the matrices
+size_t memHugeBytes(const void *p, const size_t bytes) {
+   FILE *f = fopen("/proc/self/smaps", "r");
+   if (f == NULL) return 0;
+   char line[256];
+   size_t huge = 0, overlap = 0;
+   while (fgets(line, sizeof(line), f) != NULL) {
+      unsigned long start, end, kb;
+      if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+         const uintptr_t lo = start > (uintptr_t)p ? start : (uintptr_t)p;
+         const uintptr_t hi = end < (uintptr_t)p + bytes ? end : (uintptr_t)p + bytes;
+         overlap = lo < hi ? hi - lo : 0;
+      } else if (overlap > 0 && (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+         sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1))
+      {
+         huge += (size_t)kb*1024 < overlap ? (size_t)kb*1024 : overlap;
+      }
+   }
+   fclose(f);
+   return huge;
+}
+
+#if defined(__linux__) && defined(SYS_perf_event_open)
+static int memOpenCounter(const pid_t tid, const uint64_t config, const int group) {
+   struct perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = PERF_TYPE_HW_CACHE;
+   attr.config = config;
+   attr.disabled = group == -1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   return syscall(SYS_perf_event_open, &attr, tid, -1, group, 0);
+}
+#endif
+
+// Starts counting the dTLB and remote node load misses of all the threads of
+// the process, which includes the runtime workers
+void memCountersStart() {
+   mem.numCounters = 0;
+#if defined(__linux__) && defined(SYS_perf_event_open)
+   DIR *dir = opendir("/proc/self/task");
+   if (dir == NULL) return;
+   struct dirent *ent;
+   const uint64_t read = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+   while ((ent = readdir(dir)) != NULL && mem.numCounters < MEM_MAX_COUNTERS) {
+      const pid_t tid = atoi(ent->d_name);
+      if (tid <= 0) continue;
+      const int tlb = memOpenCounter(tid, PERF_COUNT_HW_CACHE_DTLB | read, -1);
+      if (tlb < 0) continue;
+      mem.counters[mem.numCounters][0] = tlb;
+      mem.counters[mem.numCounters][1] = memOpenCounter(tid, PERF_COUNT_HW_CACHE_NODE | read, tlb);
+      ioctl(tlb, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      mem.numCounters++;
+   }
+   closedir(dir);
+#endif
+}
+
+void memCountersStop(mem_counters_t *cnt) {
+   memset(cnt, 0, sizeof(mem_counters_t));
+   cnt->valid = mem.numCounters > 0;
+   for (unsigned int t = 0; t < mem.numCounters; ++t) {
+      uint64_t val;
+      for (unsigned int e = 0; e < 2; ++e) {
+         if (mem.counters[t][e] < 0) continue;
+         cnt->nodeValid |= e == 1;
+         if (read(mem.counters[t][e], &val, sizeof(val)) == sizeof(val)) {
+            *(e == 0 ? &cnt->dtlbMisses : &cnt->nodeMisses) += val;
+         }
+         close(mem.counters[t][e]);
+      }
+   }
+   mem.numCounters = 0;
+}
+
+#endif /* _MATMUL_MEM_H_ */
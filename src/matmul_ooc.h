@@ -0,0 +1,144 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Files of the out-of-core products. The matrices are stored in the blocked
+// layout, so a block row is a contiguous range of the file, and are moved
+// with positioned reads and writes from the I/O tasks. The files are mapped
+// read-only to check the result. Input files with the same format are mapped
+// in place of the generated A and B of in-memory products.
+
+#ifndef _MATMUL_OOC_H_
+#define _MATMUL_OOC_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Opens the file <name> of directory <dir>, creating it if needed. It is
+// resized to <bytes>, and <existed> tells whether it already had that size.
+// Exits on error
+int oocOpen(const char *dir, const char *name, const size_t bytes, unsigned int *existed) {
+   char path[4096];
+   snprintf(path, sizeof(path), "%s/%s", dir, name);
+   const int fd = open(path, O_RDWR | O_CREAT, 0644);
+   struct stat st;
+   if (fd == -1 || fstat(fd, &st) != 0) {
+      fprintf(stderr, "ERROR:\tCannot open '%s': %s\n", path, strerror(errno));
+      exit(1);
+   }
+   *existed = (size_t)st.st_size == bytes;
+   if (!*existed && ftruncate(fd, bytes) != 0) {
+      fprintf(stderr, "ERROR:\tCannot resize '%s' to %zu bytes: %s\n", path, bytes, strerror(errno));
+      exit(1);
+   }
+#if defined(POSIX_FADV_SEQUENTIAL)
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+   return fd;
+}
+
+// Sets the <bytes> of <fd> to zero, releasing the previous blocks
+void oocZero(const int fd, const size_t bytes) {
+   if (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0) {
+      fprintf(stderr, "ERROR:\tCannot clear the matrix file: %s\n", strerror(errno));
+      exit(1);
+   }
+}
+
+// Reads <bytes> at offset <off> of <fd> into <buf>. Exits on error
+void oocRead(const int fd, void *buf, size_t bytes, off_t off) {
+   char *p = (char *)buf;
+   while (bytes > 0) {
+      const ssize_t r = pread(fd, p, bytes, off);
+      if (r <= 0) {
+         if (r == -1 && errno == EINTR) continue;
+         fprintf(stderr, "ERROR:\tCannot read the matrix file: %s\n", r == 0 ? "unexpected end of file" : strerror(errno));
+         exit(1);
+      }
+      p += r;
+      off += r;
+      bytes -= r;
+   }
+}
+
+// Writes <bytes> of <buf> at offset <off> of <fd>. Exits on error
+void oocWrite(const int fd, const void *buf, size_t bytes, off_t off) {
+   const char *p = (const char *)buf;
+   while (bytes > 0) {
+      const ssize_t r = pwrite(fd, p, bytes, off);
+      if (r <= 0) {
+         if (r == -1 && errno == EINTR) continue;
+         fprintf(stderr, "ERROR:\tCannot write the matrix file: %s\n", strerror(errno));
+         exit(1);
+      }
+      p += r;
+      off += r;
+      bytes -= r;
+   }
+}
+
+// Maps <bytes> of <fd> read-only. Returns NULL on error
+const void *oocMap(const int fd, const size_t bytes) {
+   void *p = mmap(NULL, bytes > 0 ? bytes : 1, PROT_READ, MAP_SHARED, fd, 0);
+   return p == MAP_FAILED ? NULL : p;
+}
+
+// Maps the input matrix file <name> of directory <dir>, which must have <bytes>.
+// The mapping is private, so the file is never modified. Exits on error
+void *oocMapInput(const char *dir, const char *name, const size_t bytes) {
+   char path[4096];
+   snprintf(path, sizeof(path), "%s/%s", dir, name);
+   const int fd = open(path, O_RDONLY);
+   struct stat st;
+   if (fd == -1 || fstat(fd, &st) != 0) {
+      fprintf(stderr, "ERROR:\tCannot open '%s': %s\n", path, strerror(errno));
+      exit(1);
+   }
+   if ((size_t)st.st_size != bytes) {
+      fprintf(stderr, "ERROR:\t'%s' has %zu bytes instead of %zu\n", path, (size_t)st.st_size, bytes);
+      exit(1);
+   }
+   void *p = mmap(NULL, bytes > 0 ? bytes : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED) {
+      fprintf(stderr, "ERROR:\tCannot map '%s': %s\n", path, strerror(errno));
+      exit(1);
+   }
+   return p;
+}
+
+void oocUnmap(const void *p, const size_t bytes) {
+   if (p != NULL) munmap((void *)p, bytes > 0 ? bytes : 1);
+}
+
+#endif /* _MATMUL_OOC_H_ */
@@ -0,0 +1,118 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Traversal orders of the C block grid used to create the matmulBlock tasks
+
+#ifndef _MATMUL_ORDER_H_
+#define _MATMUL_ORDER_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+   ORDER_DEFAULT = 0,   // i-k-j when created from SMP, row-major groups when created from FPGA
+   ORDER_IJK,           // Row-major C blocks, k loop inside each block
+   ORDER_KIJ,           // k loop outermost, row-major C blocks inside
+   ORDER_MORTON,        // Z-order C blocks, k loop inside each block
+   ORDER_HILBERT,       // Hilbert curve C blocks, k loop inside each block
+   ORDER_GROUPS,        // Row-major groups of MBLOCK_NUM_ACCS C blocks, k loop inside each group
+   ORDER_NUM
+} order_t;
+
+static const char * const ORDER_STR[ORDER_NUM] = { "default", "ijk", "kij", "morton", "hilbert", "groups" };
+
+// Returns the order named <str> (or given by its number), or ORDER_NUM if not valid
+order_t parseOrder(const char *str) {
+   for (unsigned int o = 0; o < ORDER_NUM; ++o) {
+      if (strcmp(str, ORDER_STR[o]) == 0) return (order_t)o;
+   }
+   char *end;
+   const long o = strtol(str, &end, 10);
+   return *end == '\0' && end != str && o >= 0 && o < ORDER_NUM ? (order_t)o : ORDER_NUM;
+}
+
+// Position (i,j) of the <d>-th cell of the Hilbert curve filling a <side>x<side> grid
+static void hilbertCell(const unsigned int side, unsigned int d, unsigned int *i, unsigned int *j) {
+   unsigned int x = 0, y = 0;
+   for (unsigned int s = 1; s < side; s *= 2) {
+      const unsigned int rx = 1 & (d/2);
+      const unsigned int ry = 1 & (d ^ rx);
+      if (ry == 0) {
+         if (rx == 1) {
+            x = s - 1 - x;
+            y = s - 1 - y;
+         }
+         const unsigned int t = x;
+         x = y;
+         y = t;
+      }
+      x += s*rx;
+      y += s*ry;
+      d /= 4;
+   }
+   *i = y;
+   *j = x;
+}
+
+// Position (i,j) of the <d>-th cell of the Z-order curve
+static void mortonCell(unsigned int d, unsigned int *i, unsigned int *j) {
+   unsigned int x = 0, y = 0;
+   for (unsigned int b = 0; d != 0; ++b, d >>= 2) {
+      x |= (d & 1) << b;
+      y |= ((d >> 1) & 1) << b;
+   }
+   *i = y;
+   *j = x;
+}
+
+// Fills <blocks> with the linear indices (i*cols + j) of a <rows>x<cols> grid of
+// C blocks in the sequence given by <order>. Curves are laid over the smallest
+// power of two square containing the grid, skipping the cells out of it
+void blockOrder(const order_t order, const unsigned int rows, const unsigned int cols, unsigned int *blocks) {
+   unsigned int n = 0;
+   if (order == ORDER_MORTON || order == ORDER_HILBERT) {
+      unsigned int side = 1;
+      while (side < rows || side < cols) side *= 2;
+      for (unsigned int d = 0; n < rows*cols; ++d) {
+         unsigned int i, j;
+         if (order == ORDER_MORTON) {
+            mortonCell(d, &i, &j);
+         } else {
+            hilbertCell(side, d, &i, &j);
+         }
+         if (i < rows && j < cols) {
+            blocks[n++] = i*cols + j;
+         }
+      }
+   } else {
+      for (; n < rows*cols; ++n) {
+         blocks[n] = n;
+      }
+   }
+}
+
+#endif /* _MATMUL_ORDER_H_ */
@@ -0,0 +1,246 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Reference solution files. A file holds a header describing the product,
+// an index with the position and checksum of each block, and the blocked
+// result matrix. Legacy files (raw blocked matrix with the current block size)
+// can also be opened.
+
+#ifndef _MATMUL_REF_H_
+#define _MATMUL_REF_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define REF_MAGIC   "MMULREF"
+#define REF_VERSION 1
+#define REF_LAYOUT_BLOCKED 0
+
+// Input generators. The results of a block size dependent generator can only
+// be compared with runs using the same block size
+#define REF_GEN_BLOCK_LCG 0  // setBlockSeq seeded with rand() in block order
+#define REF_GEN_COUNTER   1  // Hash of the matrix and the element position, independent of the block size
+#define REF_GEN_FILE      2  // Read from input files
+#define REF_GEN_NUM       3
+
+static const char * const REF_GEN_STR[REF_GEN_NUM] = { "lcg", "counter", "file" };
+
+typedef struct {
+   char magic[8];
+   uint32_t version;
+   uint32_t elemSize;
+   char dtype[16];
+   uint64_t m, n, k;         // C[m x n] = A[m x k] * B[k x n]
+   uint64_t seed;            // Seed of the input generator
+   uint32_t reps;            // Products accumulated in C
+   uint32_t generator;       // Input generator (REF_GEN_*)
+   uint32_t layout;
+   uint32_t blockSize;
+   uint32_t numBlocks;
+   uint64_t indexOffset;     // File offset of the block index
+   uint64_t dataOffset;      // File offset of the matrix data
+} ref_header_t;
+
+typedef struct {
+   uint64_t offset;          // Elements from dataOffset
+   uint32_t rows;
+   uint32_t cols;
+   uint64_t checksum;
+} ref_block_t;
+
+typedef struct {
+   int fd;
+   size_t len;
+   void *map;
+   unsigned int m, n;
+   unsigned int bsize;
+   unsigned int generator;
+   const ref_block_t *index;  // NULL for legacy files
+   const acc_t *data;
+} ref_file_t;
+
+// Block geometry of a blocked matrix with block size <bs>, see blockOffset
+static unsigned int refBlockDim(const unsigned int n, const unsigned int i, const unsigned int bs) {
+   return n - i*bs < bs ? n - i*bs : bs;
+}
+
+static size_t refBlockOffset(const unsigned int rows, const unsigned int cols, const unsigned int i, const unsigned int j,
+   const unsigned int bs)
+{
+   return (size_t)i*bs*cols + (size_t)j*bs*refBlockDim(rows, i, bs);
+}
+
+// FNV-1a hash of <n> elements
+uint64_t refChecksum(const acc_t *v, const size_t n, uint64_t h) {
+   const unsigned char *p = (const unsigned char *)v;
+   for (size_t i = 0; i < n*sizeof(acc_t); ++i) {
+      h = (h ^ p[i])*0x100000001B3ULL;
+   }
+   return h;
+}
+
+#define REF_CHECKSUM_INIT 0xCBF29CE484222325ULL
+
+// Writes <c>, a blocked matrix with block size <bs>, as a reference file
+int refWrite(const char *filename, const acc_t *c, const unsigned int m, const unsigned int n, const unsigned int k,
+   const unsigned int bs, const uint64_t seed, const unsigned int generator, const unsigned int reps)
+{
+   const unsigned int brows = (m + bs - 1)/bs;
+   const unsigned int bcols = (n + bs - 1)/bs;
+   ref_header_t hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, REF_MAGIC, sizeof(REF_MAGIC));
+   hdr.version = REF_VERSION;
+   hdr.elemSize = sizeof(acc_t);
+   strncpy(hdr.dtype, ELEM_T_STR, sizeof(hdr.dtype) - 1);
+   hdr.m = m;
+   hdr.n = n;
+   hdr.k = k;
+   hdr.seed = seed;
+   hdr.reps = reps;
+   hdr.generator = generator;
+   hdr.layout = REF_LAYOUT_BLOCKED;
+   hdr.blockSize = bs;
+   hdr.numBlocks = brows*bcols;
+   hdr.indexOffset = sizeof(hdr);
+   hdr.dataOffset = ((sizeof(hdr) + hdr.numBlocks*sizeof(ref_block_t) + 63)/64)*64;
+
+   ref_block_t *index = (ref_block_t *)calloc(hdr.numBlocks, sizeof(ref_block_t));
+   if (index == NULL) return -1;
+   for (unsigned int i = 0; i < brows; ++i) {
+      for (unsigned int j = 0; j < bcols; ++j) {
+         ref_block_t *blk = &index[i*bcols + j];
+         blk->offset = refBlockOffset(m, n, i, j, bs);
+         blk->rows = refBlockDim(m, i, bs);
+         blk->cols = refBlockDim(n, j, bs);
+         blk->checksum = refChecksum(c + blk->offset, (size_t)blk->rows*blk->cols, REF_CHECKSUM_INIT);
+      }
+   }
+
+   int ok = 0;
+   FILE *f = fopen(filename, "w+");
+   if (f != NULL) {
+      static const char pad[64] = {0};
+      const size_t padLen = hdr.dataOffset - sizeof(hdr) - hdr.numBlocks*sizeof(ref_block_t);
+      ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+         fwrite(index, sizeof(ref_block_t), hdr.numBlocks, f) == hdr.numBlocks &&
+         fwrite(pad, 1, padLen, f) == padLen &&
+         fwrite(c, sizeof(acc_t), (size_t)m*n, f) == (size_t)m*n;
+      ok = fclose(f) == 0 && ok;
+   }
+   free(index);
+   return ok ? 0 : -1;
+}
+
+// Maps a reference file. Returns 0 on success
+int refOpen(const char *filename, ref_file_t *ref) {
+   memset(ref, 0, sizeof(ref_file_t));
+   ref->fd = open(filename, O_RDONLY);
+   if (ref->fd == -1) return -1;
+   struct stat st;
+   if (fstat(ref->fd, &st) != 0 || (size_t)st.st_size < sizeof(ref_header_t)) {
+      close(ref->fd);
+      return -1;
+   }
+   ref->len = st.st_size;
+   ref->map = mmap(NULL, ref->len, PROT_READ, MAP_SHARED, ref->fd, 0);
+   if (ref->map == MAP_FAILED) {
+      close(ref->fd);
+      return -1;
+   }
+   const ref_header_t *hdr = (const ref_header_t *)ref->map;
+   if (memcmp(hdr->magic, REF_MAGIC, sizeof(REF_MAGIC)) != 0 || hdr->version != REF_VERSION ||
+      hdr->elemSize != sizeof(acc_t) || strncmp(hdr->dtype, ELEM_T_STR, sizeof(hdr->dtype)) != 0 ||
+      hdr->layout != REF_LAYOUT_BLOCKED || hdr->blockSize == 0 ||
+      hdr->dataOffset + hdr->m*hdr->n*sizeof(acc_t) > ref->len)
+   {
+      fprintf(stderr, "ERROR:\t'%s' is not a valid %s reference file\n", filename, ELEM_T_STR);
+      munmap(ref->map, ref->len);
+      close(ref->fd);
+      return -1;
+   }
+   ref->m = hdr->m;
+   ref->n = hdr->n;
+   ref->bsize = hdr->blockSize;
+   ref->generator = hdr->generator;
+   ref->index = (const ref_block_t *)((const char *)ref->map + hdr->indexOffset);
+   ref->data = (const acc_t *)((const char *)ref->map + hdr->dataOffset);
+   return 0;
+}
+
+// Maps a legacy reference file: the raw <m>x<n> matrix blocked with <bs>
+int refOpenLegacy(const char *filename, ref_file_t *ref, const unsigned int m, const unsigned int n, const unsigned int bs) {
+   memset(ref, 0, sizeof(ref_file_t));
+   ref->fd = open(filename, O_RDONLY);
+   if (ref->fd == -1) return -1;
+   ref->len = (size_t)m*n*sizeof(acc_t);
+   ref->map = mmap(NULL, ref->len, PROT_READ, MAP_SHARED, ref->fd, 0);
+   if (ref->map == MAP_FAILED) {
+      close(ref->fd);
+      return -1;
+   }
+   ref->m = m;
+   ref->n = n;
+   ref->bsize = bs;
+   ref->generator = REF_GEN_BLOCK_LCG;
+   ref->data = (const acc_t *)ref->map;
+   return 0;
+}
+
+void refClose(ref_file_t *ref) {
+   munmap(ref->map, ref->len);
+   close(ref->fd);
+}
+
+// Copies the <rows>x<cols> region starting at (<row0>,<col0>) of the reference
+// matrix into <dst> in row-major order
+void refGather(const ref_file_t *ref, const unsigned int row0, const unsigned int col0, const unsigned int rows,
+   const unsigned int cols, acc_t *dst)
+{
+   const unsigned int bs = ref->bsize;
+   for (unsigned int r = 0; r < rows; ++r) {
+      const unsigned int row = row0 + r;
+      unsigned int c = 0;
+      while (c < cols) {
+         const unsigned int col = col0 + c;
+         const unsigned int bj = col/bs;
+         const unsigned int bcols = refBlockDim(ref->n, bj, bs);
+         const unsigned int len = (bj*bs + bcols - col) < (cols - c) ? (bj*bs + bcols - col) : (cols - c);
+         const acc_t *src = ref->data + refBlockOffset(ref->m, ref->n, row/bs, bj, bs) +
+            (size_t)(row%bs)*bcols + col%bs;
+         memcpy(dst + (size_t)r*cols + c, src, len*sizeof(acc_t));
+         c += len;
+      }
+   }
+}
+
+#endif /* _MATMUL_REF_H_ */
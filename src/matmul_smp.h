@@ -0,0 +1,309 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Host-only SMP kernels used by the matmulBlock SMP implementation.
+// Computes C[MxN] += A[MxK] * B[KxN] (row-major with leading dimensions)
+// using a register-blocked micro-kernel over packed B panels.
+
+#ifndef _MATMUL_SMP_H_
+#define _MATMUL_SMP_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(ELEM_T_FLOAT)
+#  include <immintrin.h>
+#  define SMP_KERNEL_X86
+#endif
+
+typedef void (*smp_ukernel_fn)(unsigned int kc, const elem_t *a, unsigned int lda,
+   const elem_t *bp, acc_t *c, unsigned int ldc);
+
+typedef struct {
+   const char *name;
+   unsigned int mr;          // Micro-tile rows
+   unsigned int nr;          // Micro-tile columns (packed B panel width)
+   smp_ukernel_fn ukernel;   // Full mr x nr tile
+} smp_kernel_t;
+
+// Per-thread buffers, linked in smp_bufs_list so that smpFreeBuffers can
+// release the ones of every thread at shutdown
+typedef struct smp_bufs_s {
+   struct smp_bufs_s *next;
+   elem_t *pack;             // Packed B panels, of packLen elements
+   size_t packLen;
+   acc_t *tileAcc;           // Local tiles of matmulTileHost: the product
+   elem_t *tileAB;           // and the transposed A and B tiles
+} smp_bufs_t;
+
+static smp_bufs_t *smp_bufs_list = NULL;
+static __thread smp_bufs_t *smp_bufs = NULL;
+
+// Buffers of the calling thread, or NULL if they cannot be allocated
+static smp_bufs_t *smpThreadBufs() {
+   if (smp_bufs == NULL) {
+      smp_bufs_t *bufs = (smp_bufs_t *)calloc(1, sizeof(smp_bufs_t));
+      if (bufs == NULL) return NULL;
+      bufs->next = __atomic_load_n(&smp_bufs_list, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(&smp_bufs_list, &bufs->next, bufs, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+      smp_bufs = bufs;
+   }
+   return smp_bufs;
+}
+
+static elem_t *smpPackBuffer(size_t len) {
+   smp_bufs_t *bufs = smpThreadBufs();
+   if (bufs == NULL) return NULL;
+   if (len > bufs->packLen) {
+      free(bufs->pack);
+      size_t const bytes = ((len*sizeof(elem_t) + 63)/64)*64;
+      if (posix_memalign((void **)&bufs->pack, 64, bytes) != 0) {
+         bufs->pack = NULL;
+      }
+      bufs->packLen = bufs->pack == NULL ? 0 : len;
+   }
+   return bufs->pack;
+}
+
+// Releases the buffers of all threads, which must not be running SMP tasks.
+// The list itself is kept, as the threads still point to their entries
+void smpFreeBuffers() {
+   for (smp_bufs_t *bufs = __atomic_load_n(&smp_bufs_list, __ATOMIC_ACQUIRE); bufs != NULL; bufs = bufs->next) {
+      free(bufs->pack);
+      free(bufs->tileAcc);
+      free(bufs->tileAB);
+      bufs->pack = NULL;
+      bufs->packLen = 0;
+      bufs->tileAcc = NULL;
+      bufs->tileAB = NULL;
+   }
+}
+
+static void smpUkernelScalar(unsigned int kc, const elem_t *a, unsigned int lda,
+   const elem_t *bp, acc_t *c, unsigned int ldc)
+{
+   acc_t acc[4][8];
+   memset(acc, 0, sizeof(acc));
+   for (unsigned int k = 0; k < kc; ++k) {
+      for (unsigned int r = 0; r < 4; ++r) {
+         const acc_t av = ELEM_ACC(a[r*lda + k]);
+         for (unsigned int j = 0; j < 8; ++j) {
+            acc[r][j] += av * ELEM_ACC(bp[k*8 + j]);
+         }
+      }
+   }
+   for (unsigned int r = 0; r < 4; ++r) {
+      for (unsigned int j = 0; j < 8; ++j) {
+         c[r*ldc + j] += acc[r][j];
+      }
+   }
+}
+
+#if defined(SMP_KERNEL_X86)
+__attribute__((target("avx2,fma")))
+static void smpUkernelAvx2(unsigned int kc, const elem_t *a, unsigned int lda,
+   const elem_t *bp, acc_t *c, unsigned int ldc)
+{
+   __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+   __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+   __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+   __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+   for (unsigned int k = 0; k < kc; ++k) {
+      const __m256 b0 = _mm256_load_ps(bp + k*16);
+      const __m256 b1 = _mm256_load_ps(bp + k*16 + 8);
+      __m256 av;
+      av = _mm256_broadcast_ss(a + 0*lda + k);
+      c00 = _mm256_fmadd_ps(av, b0, c00); c01 = _mm256_fmadd_ps(av, b1, c01);
+      av = _mm256_broadcast_ss(a + 1*lda + k);
+      c10 = _mm256_fmadd_ps(av, b0, c10); c11 = _mm256_fmadd_ps(av, b1, c11);
+      av = _mm256_broadcast_ss(a + 2*lda + k);
+      c20 = _mm256_fmadd_ps(av, b0, c20); c21 = _mm256_fmadd_ps(av, b1, c21);
+      av = _mm256_broadcast_ss(a + 3*lda + k);
+      c30 = _mm256_fmadd_ps(av, b0, c30); c31 = _mm256_fmadd_ps(av, b1, c31);
+   }
+   _mm256_storeu_ps(c + 0*ldc, _mm256_add_ps(_mm256_loadu_ps(c + 0*ldc), c00));
+   _mm256_storeu_ps(c + 0*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + 0*ldc + 8), c01));
+   _mm256_storeu_ps(c + 1*ldc, _mm256_add_ps(_mm256_loadu_ps(c + 1*ldc), c10));
+   _mm256_storeu_ps(c + 1*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + 1*ldc + 8), c11));
+   _mm256_storeu_ps(c + 2*ldc, _mm256_add_ps(_mm256_loadu_ps(c + 2*ldc), c20));
+   _mm256_storeu_ps(c + 2*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + 2*ldc + 8), c21));
+   _mm256_storeu_ps(c + 3*ldc, _mm256_add_ps(_mm256_loadu_ps(c + 3*ldc), c30));
+   _mm256_storeu_ps(c + 3*ldc + 8, _mm256_add_ps(_mm256_loadu_ps(c + 3*ldc + 8), c31));
+}
+
+__attribute__((target("avx512f")))
+static void smpUkernelAvx512(unsigned int kc, const elem_t *a, unsigned int lda,
+   const elem_t *bp, acc_t *c, unsigned int ldc)
+{
+   __m512 acc[8][2];
+   for (unsigned int r = 0; r < 8; ++r) {
+      acc[r][0] = _mm512_setzero_ps();
+      acc[r][1] = _mm512_setzero_ps();
+   }
+   for (unsigned int k = 0; k < kc; ++k) {
+      const __m512 b0 = _mm512_load_ps(bp + k*32);
+      const __m512 b1 = _mm512_load_ps(bp + k*32 + 16);
+      for (unsigned int r = 0; r < 8; ++r) {
+         const __m512 av = _mm512_set1_ps(a[r*lda + k]);
+         acc[r][0] = _mm512_fmadd_ps(av, b0, acc[r][0]);
+         acc[r][1] = _mm512_fmadd_ps(av, b1, acc[r][1]);
+      }
+   }
+   for (unsigned int r = 0; r < 8; ++r) {
+      _mm512_storeu_ps(c + r*ldc, _mm512_add_ps(_mm512_loadu_ps(c + r*ldc), acc[r][0]));
+      _mm512_storeu_ps(c + r*ldc + 16, _mm512_add_ps(_mm512_loadu_ps(c + r*ldc + 16), acc[r][1]));
+   }
+}
+#endif // defined(SMP_KERNEL_X86)
+
+static const smp_kernel_t smp_kernel_scalar = { "scalar", 4, 8, smpUkernelScalar };
+#if defined(SMP_KERNEL_X86)
+static const smp_kernel_t smp_kernel_avx2 = { "avx2", 4, 16, smpUkernelAvx2 };
+static const smp_kernel_t smp_kernel_avx512 = { "avx512", 8, 32, smpUkernelAvx512 };
+#endif
+
+// Kernel used by smpGemm, selected by smpKernelInit
+static const smp_kernel_t *smp_kernel = &smp_kernel_scalar;
+
+// Selects the best micro-kernel supported by the running CPU
+const smp_kernel_t *smpKernelInit() {
+   smp_kernel = &smp_kernel_scalar;
+#if defined(SMP_KERNEL_X86)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f")) {
+      smp_kernel = &smp_kernel_avx512;
+   } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      smp_kernel = &smp_kernel_avx2;
+   }
+#endif
+   return smp_kernel;
+}
+
+// Reference i-j-k loop, kept for comparison
+void smpGemmNaive(const unsigned int m, const unsigned int n, const unsigned int k,
+   const elem_t *a, const unsigned int lda, const elem_t *b, const unsigned int ldb,
+   acc_t *c, const unsigned int ldc)
+{
+   for (unsigned int i = 0; i < m; ++i) {
+      for (unsigned int j = 0; j < n; ++j) {
+         acc_t l = 0;
+         for (unsigned int kk = 0; kk < k; ++kk) {
+            l += ELEM_ACC(a[i*lda + kk]) * ELEM_ACC(b[kk*ldb + j]);
+         }
+         c[i*ldc + j] += l;
+      }
+   }
+}
+
+void smpGemm(const unsigned int m, const unsigned int n, const unsigned int k,
+   const elem_t *a, const unsigned int lda, const elem_t *b, const unsigned int ldb,
+   acc_t *c, const unsigned int ldc)
+{
+   const smp_kernel_t *kern = smp_kernel;
+   const unsigned int mr = kern->mr;
+   const unsigned int nr = kern->nr;
+   const unsigned int npanels = (n + nr - 1)/nr;
+   elem_t *bp = smpPackBuffer((size_t)npanels*nr*k);
+   if (bp == NULL) {
+      smpGemmNaive(m, n, k, a, lda, b, ldb, c, ldc);
+      return;
+   }
+
+   //Pack B into nr-wide column panels, zero-padding the last one
+   for (unsigned int p = 0; p < npanels; ++p) {
+      const unsigned int j0 = p*nr;
+      const unsigned int nv = n - j0 < nr ? n - j0 : nr;
+      elem_t *dst = bp + (size_t)p*nr*k;
+      for (unsigned int kk = 0; kk < k; ++kk) {
+         memcpy(dst + kk*nr, b + (size_t)kk*ldb + j0, nv*sizeof(elem_t));
+         for (unsigned int j = nv; j < nr; ++j) {
+            dst[kk*nr + j] = ELEM_SET(0);
+         }
+      }
+   }
+
+   for (unsigned int p = 0; p < npanels; ++p) {
+      const unsigned int j0 = p*nr;
+      const unsigned int nv = n - j0 < nr ? n - j0 : nr;
+      const elem_t *panel = bp + (size_t)p*nr*k;
+      for (unsigned int i0 = 0; i0 < m; i0 += mr) {
+         const unsigned int mv = m - i0 < mr ? m - i0 : mr;
+         if (mv == mr && nv == nr) {
+            kern->ukernel(k, a + (size_t)i0*lda, lda, panel, c + (size_t)i0*ldc + j0, ldc);
+         } else {
+            //Edge tile
+            for (unsigned int r = 0; r < mv; ++r) {
+               for (unsigned int j = 0; j < nv; ++j) {
+                  acc_t l = 0;
+                  for (unsigned int kk = 0; kk < k; ++kk) {
+                     l += ELEM_ACC(a[(size_t)(i0 + r)*lda + kk]) * ELEM_ACC(panel[kk*nr + j]);
+                  }
+                  c[(size_t)(i0 + r)*ldc + j0 + j] += l;
+               }
+            }
+         }
+      }
+   }
+}
+
+// Measures the GFLOPS of the naive loop and the selected kernel on one block
+void smpKernelBench(const unsigned int bsize, double *gflopsNaive, double *gflopsKernel) {
+   const size_t b2size = (size_t)bsize*bsize;
+   elem_t *a = (elem_t *)malloc(2*b2size*sizeof(elem_t));
+   acc_t *c = (acc_t *)malloc(b2size*sizeof(acc_t));
+   *gflopsNaive = *gflopsKernel = 0;
+   if (a == NULL || c == NULL) {
+      free(a);
+      free(c);
+      return;
+   }
+   elem_t *b = a + b2size;
+   for (size_t i = 0; i < b2size; ++i) {
+      a[i] = ELEM_SET((double)((i*7)%13) - 6);
+      b[i] = ELEM_SET((double)((i*5)%11) - 5);
+      c[i] = 0;
+   }
+   const double flops = 2.0*bsize*bsize*bsize;
+   unsigned int reps = 0;
+   double t0 = wall_time(), t1;
+   do {
+      smpGemmNaive(bsize, bsize, bsize, a, bsize, b, bsize, c, bsize);
+      t1 = wall_time();
+   } while (++reps < 3 || t1 - t0 < 0.05);
+   *gflopsNaive = flops*reps/(t1 - t0)/1e9;
+   reps = 0;
+   t0 = wall_time();
+   do {
+      smpGemm(bsize, bsize, bsize, a, bsize, b, bsize, c, bsize);
+      t1 = wall_time();
+   } while (++reps < 3 || t1 - t0 < 0.05);
+   *gflopsKernel = flops*reps/(t1 - t0)/1e9;
+   free(a);
+   free(c);
+}
+
+#endif /* _MATMUL_SMP_H_ */
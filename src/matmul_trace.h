@@ -0,0 +1,369 @@
+/*
+* Copyright (c) 2020, BSC (Barcelona Supercomputing Center)
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the <organization> nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY BSC ''AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <copyright holder> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+// Task tracer. Each thread records the creation, start and end of the tasks in
+// its own ring buffer, without any synchronization but the registration of the
+// buffer. The traces are written in the Chrome trace event format, which can
+// be opened with chrome://tracing or Perfetto. Built only with MATMUL_TRACE,
+// otherwise the TRACE_* macros are empty.
+
+#ifndef _MATMUL_TRACE_H_
+#define _MATMUL_TRACE_H_
+
+#if defined(MATMUL_TRACE)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Events kept per thread, the oldest ones are overwritten. Must be a power of two
+#ifndef TRACE_BUF_EVENTS
+#  define TRACE_BUF_EVENTS (1 << 18)
+#endif
+#ifndef TRACE_FILE
+#  define TRACE_FILE "matmul_trace.json"
+#endif
+
+typedef enum {
+   TRACE_SET_BLOCK = 0,
+   TRACE_MATMUL_BLOCK,
+   TRACE_CHECK_BLOCK,
+   TRACE_NUM_KINDS
+} trace_kind_t;
+
+static const char * const TRACE_KIND_STR[TRACE_NUM_KINDS] = { "setBlockSeq", "matmulBlock", "checkBlock" };
+
+enum {
+   TRACE_CREATE = 0,
+   TRACE_START,
+   TRACE_END,
+   TRACE_ACC_START,          // Emulated accelerator, <unit> is the instance
+   TRACE_ACC_END
+};
+
+typedef struct {
+   uint64_t ts;              // Nanoseconds
+   uint8_t kind;
+   uint8_t phase;
+   uint16_t unit;            // Matrix (0 A, 1 B, 2 C) or accelerator instance
+   uint32_t i, j, k;         // Block coordinates, k is only set for matmulBlock
+} trace_event_t;
+
+typedef struct trace_buf {
+   struct trace_buf *next;
+   unsigned int tid;
+   uint64_t count;           // Events recorded, including the overwritten ones
+   trace_event_t events[TRACE_BUF_EVENTS];
+} trace_buf_t;
+
+// Matrices of the current product, used to find the coordinates of a block
+typedef struct {
+   const char *base[3];
+   unsigned int rows[3], cols[3];
+   size_t elemSize[3];
+   uint64_t accBase;         // Start of the emulated accelerators timeline
+} trace_state_t;
+
+static trace_buf_t *traceBufs = NULL;
+static unsigned int traceNumThreads = 0;
+static __thread trace_buf_t *traceBuf = NULL;
+static trace_state_t trace;
+
+static uint64_t traceNow() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (uint64_t)t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+static trace_buf_t *traceThreadBuf() {
+   if (traceBuf == NULL) {
+      trace_buf_t *buf = (trace_buf_t *)malloc(sizeof(trace_buf_t));
+      if (buf == NULL) {
+         fprintf(stderr, "ERROR:\tCannot allocate memory for the trace\n");
+         exit(1);
+      }
+      buf->count = 0;
+      buf->tid = __atomic_fetch_add(&traceNumThreads, 1, __ATOMIC_RELAXED);
+      buf->next = __atomic_load_n(&traceBufs, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(&traceBufs, &buf->next, buf, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+      traceBuf = buf;
+   }
+   return traceBuf;
+}
+
+static void traceRecord(const uint64_t ts, const unsigned int kind, const unsigned int phase, const unsigned int unit,
+   const unsigned int i, const unsigned int j, const unsigned int k)
+{
+   trace_buf_t *buf = traceThreadBuf();
+   trace_event_t *ev = &buf->events[buf->count++ & (TRACE_BUF_EVENTS - 1)];
+   ev->ts = ts;
+   ev->kind = kind;
+   ev->phase = phase;
+   ev->unit = unit;
+   ev->i = i;
+   ev->j = j;
+   ev->k = k;
+}
+
+void traceMatrices(const elem_t *a, const elem_t *b, const acc_t *c, const unsigned int m, const unsigned int n,
+   const unsigned int k)
+{
+   trace.base[0] = (const char *)a; trace.rows[0] = m; trace.cols[0] = k; trace.elemSize[0] = sizeof(elem_t);
+   trace.base[1] = (const char *)b; trace.rows[1] = k; trace.cols[1] = n; trace.elemSize[1] = sizeof(elem_t);
+   trace.base[2] = (const char *)c; trace.rows[2] = m; trace.cols[2] = n; trace.elemSize[2] = sizeof(acc_t);
+}
+
+// Finds the matrix and block coordinates of the block starting at <p>
+static unsigned int traceBlock(const void *p, unsigned int *i, unsigned int *j) {
+   const char *q = (const char *)p;
+   for (unsigned int mat = 0; mat < 3; ++mat) {
+      const size_t size = (size_t)trace.rows[mat]*trace.cols[mat]*trace.elemSize[mat];
+      if (trace.base[mat] != NULL && q >= trace.base[mat] && q < trace.base[mat] + size) {
+         const size_t off = (q - trace.base[mat])/trace.elemSize[mat];
+         const size_t rowSize = (size_t)MATMUL_BLOCK_SIZE*trace.cols[mat];
+         *i = off/rowSize;
+         const unsigned int bm = trace.rows[mat] - *i*MATMUL_BLOCK_SIZE < MATMUL_BLOCK_SIZE ?
+            trace.rows[mat] - *i*MATMUL_BLOCK_SIZE : MATMUL_BLOCK_SIZE;
+         *j = (off - *i*rowSize)/((size_t)MATMUL_BLOCK_SIZE*bm);
+         return mat;
+      }
+   }
+   *i = *j = 0;
+   return 0;
+}
+
+// Records a task working on the block at <p>. For matmulBlock, <p> is the C
+// block and <a> the A block, which gives k
+void traceTask(const unsigned int kind, const unsigned int phase, const void *p, const elem_t *a) {
+   const uint64_t ts = traceNow();
+   unsigned int i, j, ak = 0, ai;
+   const unsigned int mat = traceBlock(p, &i, &j);
+   if (a != NULL) traceBlock(a, &ai, &ak);
+   traceRecord(ts, kind, phase, mat, i, j, ak);
+}
+
+// Records a task working on block (i,j,k) of matrix <mat>
+void traceTaskAt(const unsigned int kind, const unsigned int phase, const unsigned int mat, const unsigned int i,
+   const unsigned int j, const unsigned int k)
+{
+   traceRecord(traceNow(), kind, phase, mat, i, j, k);
+}
+
+void traceCreate(const unsigned int kind, const unsigned int mat, const unsigned int i, const unsigned int j,
+   const unsigned int k)
+{
+   traceRecord(traceNow(), kind, TRACE_CREATE, mat, i, j, k);
+}
+
+void traceAccReset() {
+   trace.accBase = traceNow();
+}
+
+// Records a task of the emulated accelerator <acc>, from <start> to <end> seconds of the model
+void traceAccTask(const unsigned int acc, const double start, const double end, const acc_t *c, const elem_t *a) {
+   unsigned int i, j, ak = 0, ai;
+   traceBlock(c, &i, &j);
+   traceBlock(a, &ai, &ak);
+   traceRecord(trace.accBase + (uint64_t)(start*1e9), TRACE_MATMUL_BLOCK, TRACE_ACC_START, acc, i, j, ak);
+   traceRecord(trace.accBase + (uint64_t)(end*1e9), TRACE_MATMUL_BLOCK, TRACE_ACC_END, acc, i, j, ak);
+}
+
+// Creation or execution of a task, used to write the trace
+typedef struct {
+   trace_event_t ev;         // Creation or start event
+   unsigned int tid;         // Thread, or traceNumThreads + instance for the accelerators
+   uint64_t end;
+} trace_rec_t;
+
+// Orders by task (kind and coordinates)
+static int traceCmpKey(const trace_rec_t *x, const trace_rec_t *y) {
+   const trace_event_t *a = &x->ev, *b = &y->ev;
+   if (a->kind != b->kind) return a->kind < b->kind ? -1 : 1;
+   if (a->unit != b->unit) return a->unit < b->unit ? -1 : 1;
+   if (a->i != b->i) return a->i < b->i ? -1 : 1;
+   if (a->j != b->j) return a->j < b->j ? -1 : 1;
+   if (a->k != b->k) return a->k < b->k ? -1 : 1;
+   return 0;
+}
+
+// Orders by task, then by time
+static int traceCmpTask(const void *x, const void *y) {
+   const int key = traceCmpKey((const trace_rec_t *)x, (const trace_rec_t *)y);
+   const uint64_t a = ((const trace_rec_t *)x)->ev.ts, b = ((const trace_rec_t *)y)->ev.ts;
+   return key != 0 ? key : (a > b) - (a < b);
+}
+
+// Writes the trace into <filename> and prints the occupancy of each thread
+// and emulated accelerator
+void traceFini(const char *filename) {
+   //Gather the task starts (with their end) and creations of all threads
+   size_t total = 0;
+   for (trace_buf_t *buf = traceBufs; buf != NULL; buf = buf->next) {
+      total += buf->count < TRACE_BUF_EVENTS ? buf->count : TRACE_BUF_EVENTS;
+   }
+   trace_rec_t *starts = (trace_rec_t *)malloc((total + 1)*sizeof(trace_rec_t));
+   trace_rec_t *creates = (trace_rec_t *)malloc((total + 1)*sizeof(trace_rec_t));
+   uint64_t *busy = (uint64_t *)calloc(traceNumThreads + MATMUL_NUM_ACCS, sizeof(uint64_t));
+   uint64_t *tasks = (uint64_t *)calloc(traceNumThreads + MATMUL_NUM_ACCS, sizeof(uint64_t));
+   if (starts == NULL || creates == NULL || busy == NULL || tasks == NULL) {
+      fprintf(stderr, "ERROR:\tCannot allocate memory for the trace\n");
+      exit(1);
+   }
+   size_t numStarts = 0, numCreates = 0;
+   uint64_t t0 = UINT64_MAX, t1 = 0, dropped = 0;
+   for (trace_buf_t *buf = traceBufs; buf != NULL; buf = buf->next) {
+      const uint64_t first = buf->count < TRACE_BUF_EVENTS ? 0 : buf->count - TRACE_BUF_EVENTS;
+      dropped += first;
+      const trace_event_t *open[TRACE_NUM_KINDS + 1] = { NULL };
+      for (uint64_t e = first; e < buf->count; ++e) {
+         const trace_event_t *ev = &buf->events[e & (TRACE_BUF_EVENTS - 1)];
+         t0 = ev->ts < t0 ? ev->ts : t0;
+         t1 = ev->ts > t1 ? ev->ts : t1;
+         if (ev->phase == TRACE_CREATE) {
+            creates[numCreates].ev = *ev;
+            creates[numCreates++].tid = buf->tid;
+         } else if (ev->phase == TRACE_START || ev->phase == TRACE_ACC_START) {
+            open[ev->phase == TRACE_START ? ev->kind : TRACE_NUM_KINDS] = ev;
+         } else {
+            //Tasks are not nested, an end closes the last start of its thread
+            const unsigned int slot = ev->phase == TRACE_END ? ev->kind : TRACE_NUM_KINDS;
+            if (open[slot] == NULL) continue;
+            const unsigned int unit = ev->phase == TRACE_END ? buf->tid : traceNumThreads + ev->unit;
+            starts[numStarts].ev = *open[slot];
+            starts[numStarts].tid = unit;
+            starts[numStarts++].end = ev->ts;
+            busy[unit] += ev->ts - open[slot]->ts;
+            tasks[unit]++;
+            open[slot] = NULL;
+         }
+      }
+   }
+   qsort(starts, numStarts, sizeof(trace_rec_t), traceCmpTask);
+   qsort(creates, numCreates, sizeof(trace_rec_t), traceCmpTask);
+
+   FILE *f = fopen(filename, "w");
+   if (f == NULL) {
+      fprintf(stderr, "Cannot open '%s' file\n", filename);
+      exit(1);
+   }
+   fprintf(f, "{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+   fprintf(f, "  { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": { \"name\": \"SMP\" } },\n");
+   fprintf(f, "  { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": { \"name\": \"FPGA (emulated)\" } }");
+   for (unsigned int t = 0; t < traceNumThreads; ++t) {
+      fprintf(f, ",\n  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": { \"name\": \"worker %u\" } }", t, t);
+   }
+   for (unsigned int t = 0; t < MATMUL_NUM_ACCS; ++t) {
+      fprintf(f, ",\n  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 2, \"tid\": %u, \"args\": { \"name\": \"acc %u\" } }", t, t);
+   }
+   //The n-th creation of a task is paired with its n-th execution on the SMP workers
+   uint64_t waitSum[TRACE_NUM_KINDS] = { 0 }, waitNum[TRACE_NUM_KINDS] = { 0 };
+   size_t c = 0;
+   for (size_t s = 0; s < numStarts; ++s) {
+      const trace_rec_t *r = &starts[s];
+      uint64_t created = 0;
+      if (r->tid < traceNumThreads) {
+         while (c < numCreates && traceCmpKey(&creates[c], r) < 0) ++c;
+         if (c < numCreates && traceCmpKey(&creates[c], r) == 0 && creates[c].ev.ts <= r->ev.ts) {
+            created = creates[c++].ev.ts;
+         }
+      }
+      if (created != 0) {
+         waitSum[r->ev.kind] += r->ev.ts - created;
+         waitNum[r->ev.kind]++;
+      }
+      const unsigned int acc = r->tid >= traceNumThreads;
+      fprintf(f, ",\n  { \"name\": \"%s\", \"cat\": \"task\", \"ph\": \"X\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+         "\"args\": { \"i\": %u, \"j\": %u, \"k\": %u",
+         TRACE_KIND_STR[r->ev.kind], acc ? 2 : 1, acc ? r->tid - traceNumThreads : r->tid,
+         (r->ev.ts - t0)/1e3, (r->end - r->ev.ts)/1e3, r->ev.i, r->ev.j, r->ev.k);
+      if (r->ev.kind == TRACE_SET_BLOCK) {
+         fprintf(f, ", \"matrix\": \"%c\"", "ABC"[r->ev.unit]);
+      }
+      if (created != 0) {
+         fprintf(f, ", \"wait\": %.3f", (r->ev.ts - created)/1e3);
+      }
+      fprintf(f, " } }");
+   }
+   for (size_t l = 0; l < numCreates; ++l) {
+      const trace_event_t *ev = &creates[l].ev;
+      fprintf(f, ",\n  { \"name\": \"create %s\", \"cat\": \"create\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %u, "
+         "\"ts\": %.3f, \"args\": { \"i\": %u, \"j\": %u, \"k\": %u } }",
+         TRACE_KIND_STR[ev->kind], creates[l].tid, (ev->ts - t0)/1e3, ev->i, ev->j, ev->k);
+   }
+   fprintf(f, "\n] }\n");
+   fclose(f);
+
+   const double span = t1 > t0 ? (t1 - t0)/1e9 : 0;
+   printf( "===================== TRACE ====================== \n" );
+   printf( "  Trace file:            %s\n", filename );
+   printf( "  Traced time (secs):    %f\n", span );
+   printf( "  Dropped events:        %llu\n", (unsigned long long)dropped );
+   for (unsigned int k = 0; k < TRACE_NUM_KINDS; ++k) {
+      if (waitNum[k] > 0) {
+         printf( "  %-12s avg. wait since creation (usecs): %f\n", TRACE_KIND_STR[k], waitSum[k]/1e3/waitNum[k] );
+      }
+   }
+   for (unsigned int t = 0; t < traceNumThreads + MATMUL_NUM_ACCS; ++t) {
+      if (tasks[t] == 0) continue;
+      printf( "  %s %-3u tasks %-8llu busy (secs) %f occupancy %f\n", t < traceNumThreads ? "Worker" : "Acc.  ",
+         t < traceNumThreads ? t : t - traceNumThreads, (unsigned long long)tasks[t], busy[t]/1e9,
+         span > 0 ? busy[t]/1e9/span : 0 );
+   }
+   printf( "================================================== \n" );
+   free(starts);
+   free(creates);
+   free(busy);
+   free(tasks);
+}
+
+#  define TRACE_MATRICES(a, b, c, m, n, k)     traceMatrices(a, b, c, m, n, k)
+#  define TRACE_CREATE(kind, mat, i, j, k)     traceCreate(kind, mat, i, j, k)
+#  define TRACE_START(kind, p, a)              traceTask(kind, TRACE_START, p, a)
+#  define TRACE_END(kind, p, a)                traceTask(kind, TRACE_END, p, a)
+#  define TRACE_START_AT(kind, mat, i, j, k)   traceTaskAt(kind, TRACE_START, mat, i, j, k)
+#  define TRACE_END_AT(kind, mat, i, j, k)     traceTaskAt(kind, TRACE_END, mat, i, j, k)
+#  define TRACE_ACC_RESET()                    traceAccReset()
+#  define TRACE_ACC_TASK(acc, start, end, c, a) traceAccTask(acc, start, end, c, a)
+#  define TRACE_FINI()                         traceFini(TRACE_FILE)
+
+#else
+
+#  define TRACE_MATRICES(a, b, c, m, n, k)
+#  define TRACE_CREATE(kind, mat, i, j, k)
+#  define TRACE_START(kind, p, a)
+#  define TRACE_END(kind, p, a)
+#  define TRACE_START_AT(kind, mat, i, j, k)
+#  define TRACE_END_AT(kind, mat, i, j, k)
+#  define TRACE_ACC_RESET()
+#  define TRACE_ACC_TASK(acc, start, end, c, a)
+#  define TRACE_FINI()
+
+#endif /* defined(MATMUL_TRACE) */
+
+#endif /* _MATMUL_TRACE_H_ */